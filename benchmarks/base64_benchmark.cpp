@@ -0,0 +1,122 @@
+// Measures the decode throughput of base64_decode against a naive decoder
+// of the kind commonly found in glTF loaders
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base64.hpp"
+
+namespace {
+
+constexpr std::string_view alphabet =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+[[nodiscard]] auto encode(const std::vector<std::byte>& data) -> std::string
+{
+  std::string result;
+  result.reserve((data.size() + 2) / 3 * 4);
+
+  std::size_t i = 0;
+  for (; i + 3 <= data.size(); i += 3) {
+    const auto triple = std::to_integer<std::uint32_t>(data[i]) << 16 |
+                        std::to_integer<std::uint32_t>(data[i + 1]) << 8 |
+                        std::to_integer<std::uint32_t>(data[i + 2]);
+    result += alphabet[triple >> 18];
+    result += alphabet[(triple >> 12) & 63];
+    result += alphabet[(triple >> 6) & 63];
+    result += alphabet[triple & 63];
+  }
+  if (const auto rest = data.size() - i; rest > 0) {
+    auto triple = std::to_integer<std::uint32_t>(data[i]) << 16;
+    if (rest == 2) {
+      triple |= std::to_integer<std::uint32_t>(data[i + 1]) << 8;
+    }
+    result += alphabet[triple >> 18];
+    result += alphabet[(triple >> 12) & 63];
+    result += rest == 2 ? alphabet[(triple >> 6) & 63] : '=';
+    result += '=';
+  }
+  return result;
+}
+
+// Looks every character up with a linear search and appends to a vector
+[[nodiscard]] auto naive_decode(std::string_view input) -> std::vector<std::byte>
+{
+  std::vector<std::byte> result;
+  std::uint32_t accumulator = 0;
+  int bits = 0;
+  for (const char c : input) {
+    if (c == '=') {
+      break;
+    }
+    const auto value = alphabet.find(c);
+    if (value == std::string_view::npos) {
+      throw std::runtime_error{"invalid base64 input"};
+    }
+    accumulator = (accumulator << 6) | static_cast<std::uint32_t>(value);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      result.push_back(static_cast<std::byte>(accumulator >> bits));
+    }
+  }
+  return result;
+}
+
+template <typename Func>
+auto measure(std::string_view name, std::size_t decoded_size, Func&& f) -> void
+{
+  constexpr int iterations = 20;
+
+  // Warm up caches and the page tables of the output
+  f();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  const auto bytes = static_cast<double>(decoded_size) * iterations;
+  fmt::print("{:<8} {:8.3f} GB/s\n", name, bytes / elapsed.count() / 1e9);
+}
+
+} // anonymous namespace
+
+int main()
+{
+  constexpr std::size_t size = 64 * 1024 * 1024;
+
+  std::vector<std::byte> data(size);
+  std::mt19937 rng{42};
+  for (auto& b : data) {
+    b = static_cast<std::byte>(rng());
+  }
+  const auto encoded = encode(data);
+
+  std::vector<std::byte> output(base64_decoded_size(encoded));
+
+  measure("naive", size, [&] {
+    const auto result = naive_decode(encoded);
+    if (result.size() != size) {
+      std::abort();
+    }
+  });
+  measure("scalar", size, [&] { base64_decode_scalar(encoded, output); });
+  measure("simd", size, [&] { base64_decode(encoded, output); });
+
+  if (std::memcmp(output.data(), data.data(), size) != 0) {
+    fmt::print(stderr, "Decoded data does not match the input!\n");
+    return 1;
+  }
+}
@@ -0,0 +1,139 @@
+// Compares parse time and peak memory of the glTF JSON parse modes on a
+// synthetic document with many meshes, accessors and nodes.
+//
+// Peak RSS only ever grows within a process, so every mode is measured in a
+// child process: run without arguments to compare all modes, or pass a mode
+// name (dom, insitu, sax) and an optional mesh count to measure one.
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "gltf_json.hpp"
+
+namespace {
+
+constexpr std::size_t default_mesh_count = 100'000;
+
+// Each mesh gets a node, three accessors and a buffer view, in the shape that
+// typical exporters write
+[[nodiscard]] auto make_document(std::size_t mesh_count) -> std::string
+{
+  std::string json = R"({"asset":{"version":"2.0","generator":"benchmark"},)";
+  json += R"("buffers":[{"uri":"scene.bin","byteLength":4294967295}],)";
+
+  json += R"("bufferViews":[)";
+  for (std::size_t i = 0; i < mesh_count; ++i) {
+    json += fmt::format(R"({}{{"buffer":0,"byteOffset":{},"byteLength":1024}})",
+                        i == 0 ? "" : ",", i * 1024);
+  }
+
+  json += R"(],"accessors":[)";
+  for (std::size_t i = 0; i < mesh_count; ++i) {
+    json += fmt::format(
+        R"({}{{"bufferView":{},"componentType":5126,"count":24,"type":"VEC3",)"
+        R"("min":[-1.0,-1.0,-1.0],"max":[1.0,1.0,1.0]}},)"
+        R"({{"bufferView":{},"byteOffset":288,"componentType":5126,"count":24,)"
+        R"("type":"VEC3"}},)"
+        R"({{"bufferView":{},"byteOffset":576,"componentType":5123,"count":36,)"
+        R"("type":"SCALAR"}})",
+        i == 0 ? "" : ",", i, i, i);
+  }
+
+  json += R"(],"meshes":[)";
+  for (std::size_t i = 0; i < mesh_count; ++i) {
+    json += fmt::format(
+        R"({}{{"name":"Mesh_{}","primitives":[{{"attributes":{{)"
+        R"("POSITION":{},"NORMAL":{}}},"indices":{},"material":0}}]}})",
+        i == 0 ? "" : ",", i, 3 * i, 3 * i + 1, 3 * i + 2);
+  }
+
+  json += R"(],"nodes":[)";
+  for (std::size_t i = 0; i < mesh_count; ++i) {
+    json += fmt::format(
+        R"({}{{"name":"Node_{}","mesh":{},"translation":[{}.5,0.0,-2.25],)"
+        R"("rotation":[0.0,0.7071068,0.0,0.7071068]}})",
+        i == 0 ? "" : ",", i, i, i % 100);
+  }
+  json += "]}";
+  return json;
+}
+
+[[nodiscard]] auto parse_mode(std::string_view name) -> GltfParseMode
+{
+  if (name == "dom") {
+    return GltfParseMode::dom;
+  }
+  if (name == "insitu") {
+    return GltfParseMode::insitu;
+  }
+  if (name == "sax") {
+    return GltfParseMode::sax;
+  }
+  fmt::print(stderr, "Unknown parse mode {}\n", name);
+  std::exit(EXIT_FAILURE);
+}
+
+// Returns the peak resident set size of this process in KiB
+[[nodiscard]] auto peak_rss_kib() -> long
+{
+#ifndef _WIN32
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+#else
+  return 0;
+#endif
+}
+
+auto run(std::string_view mode_name, std::size_t mesh_count) -> void
+{
+  const auto mode = parse_mode(mode_name);
+  auto json = make_document(mesh_count);
+  const auto size = json.size();
+  const auto rss_before = peak_rss_kib();
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto tables = parse_gltf_json(json, mode);
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (tables.meshes.size() != mesh_count) {
+    fmt::print(stderr, "Parsed {} meshes, expected {}\n",
+               tables.meshes.size(), mesh_count);
+    std::exit(EXIT_FAILURE);
+  }
+
+  fmt::print("{:<8} {:8.1f} MB {:9.2f} ms {:8.1f} MB/s {:8} KiB peak RSS "
+             "growth\n",
+             mode_name, static_cast<double>(size) / 1e6, elapsed.count(),
+             static_cast<double>(size) / 1e3 / elapsed.count(),
+             peak_rss_kib() - rss_before);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+  if (argc > 1) {
+    const auto mesh_count =
+        argc > 2 ? std::stoul(argv[2]) : default_mesh_count;
+    run(argv[1], mesh_count);
+    return 0;
+  }
+
+  for (const char* mode : {"dom", "insitu", "sax"}) {
+    const auto command =
+        fmt::format("\"{}\" {} {}", argv[0], mode, default_mesh_count);
+    if (std::system(command.c_str()) != 0) {
+      return 1;
+    }
+  }
+}
@@ -1,12 +1,49 @@
 #version 450
 
+// Number of textures bound by the application, at least one
+layout(constant_id = 0) const uint texture_count = 1;
+
+const uint no_texture = 0xFFFFFFFFu;
+
+// Matches GpuMaterial in material.hpp
+struct Material {
+    vec4 base_color_factor;
+    vec3 emissive_factor;
+    float metallic_factor;
+    float roughness_factor;
+    float alpha_cutoff;
+    uint base_color_texture;
+    uint metallic_roughness_texture;
+    uint normal_texture;
+    uint occlusion_texture;
+    uint emissive_texture;
+    uint padding;
+};
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
-layout(binding = 1) uniform sampler2D texSampler;
+layout(binding = 1) uniform sampler2D textures[texture_count];
+
+layout(std430, binding = 3) readonly buffer Materials {
+    Material materials[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint node;
+    uint material;
+} push;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    Material material = materials[push.material];
+    vec4 color = material.base_color_factor;
+    if (material.base_color_texture != no_texture) {
+        color *= texture(textures[material.base_color_texture], fragTexCoord);
+    }
+    if (color.a < material.alpha_cutoff) {
+        discard;
+    }
+    outColor = color;
 }
@@ -6,6 +6,16 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+// World matrices of the scene nodes, indexed by the node being drawn
+layout(std430, binding = 2) readonly buffer NodeTransforms {
+    mat4 world[];
+} nodes;
+
+layout(push_constant) uniform PushConstants {
+    uint node;
+    uint material;
+} push;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
@@ -14,7 +24,8 @@ layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-  gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+  gl_Position = ubo.proj * ubo.view * ubo.model * nodes.world[push.node] *
+                vec4(inPosition, 1.0);
   fragColor = inColor;
   fragTexCoord = inTexCoord;
 }
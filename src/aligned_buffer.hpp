@@ -0,0 +1,64 @@
+#ifndef ALIGNED_BUFFER_HPP
+#define ALIGNED_BUFFER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+
+/**
+ * @brief An uninitialized heap byte buffer with a guaranteed alignment.
+ *
+ * Used as the final storage of data that is produced by the loader rather
+ * than memory-mapped, so that SIMD code may write to it with aligned stores.
+ */
+class AlignedBuffer {
+public:
+  static constexpr std::size_t alignment = 64;
+
+  AlignedBuffer() = default;
+  explicit AlignedBuffer(std::size_t size)
+      : data_{static_cast<std::byte*>(
+            ::operator new(size, std::align_val_t{alignment}))},
+        size_{size}
+  {
+  }
+
+  [[nodiscard]] auto data() noexcept -> std::byte*
+  {
+    return data_.get();
+  }
+
+  [[nodiscard]] auto data() const noexcept -> const std::byte*
+  {
+    return data_.get();
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t
+  {
+    return size_;
+  }
+
+  [[nodiscard]] auto bytes() noexcept -> std::span<std::byte>
+  {
+    return {data_.get(), size_};
+  }
+
+  [[nodiscard]] auto bytes() const noexcept -> std::span<const std::byte>
+  {
+    return {data_.get(), size_};
+  }
+
+private:
+  struct Deleter {
+    void operator()(std::byte* p) const noexcept
+    {
+      ::operator delete(p, std::align_val_t{alignment});
+    }
+  };
+
+  std::unique_ptr<std::byte, Deleter> data_;
+  std::size_t size_ = 0;
+};
+
+#endif // ALIGNED_BUFFER_HPP
@@ -0,0 +1,508 @@
+#include "animation.hpp"
+
+#include <fmt/format.h>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <ranges>
+#include <stdexcept>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define ANIMATION_USE_SSE 1
+#endif
+
+#include "gltf.hpp"
+#include "morph.hpp"
+#include "scene_graph.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+// Clips with fewer channels are sampled on the calling thread
+constexpr std::size_t min_channels_per_task = 1024;
+
+auto to_animation_path(GltfAnimationPath path) noexcept -> AnimationPath
+{
+  switch (path) {
+  case GltfAnimationPath::rotation:
+    return AnimationPath::rotation;
+  case GltfAnimationPath::scale:
+    return AnimationPath::scale;
+  case GltfAnimationPath::weights:
+    return AnimationPath::weights;
+  default:
+    return AnimationPath::translation;
+  }
+}
+
+auto to_animation_interpolation(GltfInterpolation interpolation) noexcept
+    -> AnimationInterpolation
+{
+  switch (interpolation) {
+  case GltfInterpolation::step:
+    return AnimationInterpolation::step;
+  case GltfInterpolation::cubic_spline:
+    return AnimationInterpolation::cubic_spline;
+  default:
+    return AnimationInterpolation::linear;
+  }
+}
+
+// Normalized integers map to [-1, 1] for signed and [0, 1] for unsigned types
+template <typename T>
+auto append_normalized(const GltfScene& scene, std::size_t accessor,
+                       std::vector<glm::vec4>& values) -> void
+{
+  constexpr auto max = static_cast<float>(std::numeric_limits<T>::max());
+  const auto view = scene.accessor_view<std::array<T, 4>>(accessor);
+  for (std::size_t i = 0; i < view.size(); ++i) {
+    const auto value = view[i];
+    const auto component = [&](std::size_t c) {
+      return std::max(static_cast<float>(value[c]) / max, -1.0F);
+    };
+    values.emplace_back(component(0), component(1), component(2),
+                        component(3));
+  }
+}
+
+auto append_values(const GltfScene& scene, std::size_t accessor,
+                   AnimationPath path, std::vector<glm::vec4>& values)
+    -> void
+{
+  if (path != AnimationPath::rotation) {
+    const auto view = scene.accessor_view<std::array<float, 3>>(accessor);
+    for (std::size_t i = 0; i < view.size(); ++i) {
+      values.emplace_back(glm::make_vec3(view[i].data()), 0.0F);
+    }
+    return;
+  }
+
+  switch (scene.accessors[accessor].component_type) {
+  case GltfComponentType::i8:
+    append_normalized<std::int8_t>(scene, accessor, values);
+    break;
+  case GltfComponentType::u8:
+    append_normalized<std::uint8_t>(scene, accessor, values);
+    break;
+  case GltfComponentType::i16:
+    append_normalized<std::int16_t>(scene, accessor, values);
+    break;
+  case GltfComponentType::u16:
+    append_normalized<std::uint16_t>(scene, accessor, values);
+    break;
+  default: {
+    const auto view = scene.accessor_view<std::array<float, 4>>(accessor);
+    for (std::size_t i = 0; i < view.size(); ++i) {
+      values.push_back(glm::make_vec4(view[i].data()));
+    }
+  } break;
+  }
+}
+
+template <typename T>
+auto append_normalized_weights(const GltfScene& scene, std::size_t accessor,
+                               std::vector<float>& weights) -> void
+{
+  constexpr auto max = static_cast<float>(std::numeric_limits<T>::max());
+  const auto view = scene.accessor_view<T>(accessor);
+  for (std::size_t i = 0; i < view.size(); ++i) {
+    weights.push_back(std::max(static_cast<float>(view[i]) / max, -1.0F));
+  }
+}
+
+// Reads a scalar accessor of float or normalized integer weights
+auto read_weights(const GltfScene& scene, std::size_t accessor)
+    -> std::vector<float>
+{
+  std::vector<float> result;
+  switch (scene.accessors[accessor].component_type) {
+  case GltfComponentType::i8:
+    append_normalized_weights<std::int8_t>(scene, accessor, result);
+    break;
+  case GltfComponentType::u8:
+    append_normalized_weights<std::uint8_t>(scene, accessor, result);
+    break;
+  case GltfComponentType::i16:
+    append_normalized_weights<std::int16_t>(scene, accessor, result);
+    break;
+  case GltfComponentType::u16:
+    append_normalized_weights<std::uint16_t>(scene, accessor, result);
+    break;
+  default: {
+    const auto view = scene.accessor_view<float>(accessor);
+    for (std::size_t i = 0; i < view.size(); ++i) {
+      result.push_back(view[i]);
+    }
+  } break;
+  }
+  return result;
+}
+
+// Adjusts the factor of an nlerp so that it follows the constant angular
+// velocity of slerp closely. d is the absolute cosine of the angle between
+// the quaternions. The polynomial is a least squares fit of the error.
+auto corrected_factor(float t, float d) noexcept -> float
+{
+  const auto a = 1.0904F + d * (-3.2452F + d * (3.55645F - d * 1.43519F));
+  const auto b = 0.848013F + d * (-1.06021F + d * 0.215638F);
+  const auto half = t - 0.5F;
+  const auto k = a * half * half + b;
+  return t + t * half * (t - 1.0F) * k;
+}
+
+auto interpolate_rotation(glm::vec4 from, glm::vec4 to, float t) noexcept
+    -> glm::vec4
+{
+  const auto cosine = glm::dot(from, to);
+  if (cosine < 0.0F) {
+    to = -to;
+  }
+  const auto factor = corrected_factor(t, std::abs(cosine));
+  return glm::normalize(from + (to - from) * factor);
+}
+
+// Evaluates the cubic Hermite spline between two keys, whose tangents are
+// already scaled by the time between them
+auto hermite(glm::vec4 p0, glm::vec4 m0, glm::vec4 p1, glm::vec4 m1,
+             float t) noexcept -> glm::vec4
+{
+  const auto t2 = t * t;
+  const auto t3 = t2 * t;
+  return (2.0F * t3 - 3.0F * t2 + 1.0F) * p0 + (t3 - 2.0F * t2 + t) * m0 +
+         (-2.0F * t3 + 3.0F * t2) * p1 + (t3 - t2) * m1;
+}
+
+// Splits the weights of every key into channels of up to four weights
+auto append_weight_channels(const GltfScene& scene, std::size_t accessor,
+                            AnimationChannel channel, FlatAnimations& result)
+    -> void
+{
+  const auto weights = read_weights(scene, accessor);
+  const std::size_t values_per_key =
+      channel.interpolation == AnimationInterpolation::cubic_spline ? 3 : 1;
+  const auto element_count = std::size_t{channel.key_count} * values_per_key;
+  const auto weight_count = weights.size() / element_count;
+  if (weight_count > std::numeric_limits<std::uint16_t>::max()) {
+    throw std::runtime_error{fmt::format(
+        "Animating {} morph target weights is not supported", weight_count)};
+  }
+
+  for (std::size_t first = 0; first < weight_count; first += 4) {
+    channel.first_weight = static_cast<std::uint16_t>(first);
+    channel.first_value = static_cast<std::uint32_t>(result.values.size());
+    for (std::size_t element = 0; element < element_count; ++element) {
+      const auto weight = [&](std::size_t c) {
+        return first + c < weight_count
+                   ? weights[element * weight_count + first + c]
+                   : 0.0F;
+      };
+      result.values.emplace_back(weight(0), weight(1), weight(2), weight(3));
+    }
+    result.channels.push_back(channel);
+  }
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto flatten_animations(const GltfScene& scene)
+    -> FlatAnimations
+{
+  FlatAnimations result;
+  if (scene.animations.empty()) {
+    return result;
+  }
+
+  const auto flat_indices = flat_node_indices(scene);
+  // Channels of one node usually share their input, whose times are then
+  // stored once
+  std::unordered_map<std::size_t, std::uint32_t> first_keys;
+  for (const auto& animation : scene.animations) {
+    AnimationClip clip;
+    clip.first_channel = static_cast<std::uint32_t>(result.channels.size());
+
+    for (const auto& channel : animation.channels) {
+      if (!channel.node) {
+        continue;
+      }
+      const auto& sampler = animation.samplers[channel.sampler];
+      const auto times = scene.accessor_view<float>(sampler.input);
+
+      AnimationChannel flat;
+      flat.node = flat_indices[*channel.node];
+      flat.path = to_animation_path(channel.path);
+      flat.interpolation = to_animation_interpolation(sampler.interpolation);
+      flat.key_count = static_cast<std::uint32_t>(times.size());
+
+      const auto [key, inserted] = first_keys.try_emplace(
+          sampler.input, static_cast<std::uint32_t>(result.times.size()));
+      if (inserted) {
+        for (std::size_t i = 0; i < times.size(); ++i) {
+          result.times.push_back(times[i]);
+        }
+      }
+      flat.first_key = key->second;
+      clip.duration = std::max(clip.duration, times[times.size() - 1]);
+
+      if (flat.path == AnimationPath::weights) {
+        append_weight_channels(scene, sampler.output, flat, result);
+        continue;
+      }
+      flat.first_value = static_cast<std::uint32_t>(result.values.size());
+      append_values(scene, sampler.output, flat.path, result.values);
+      result.channels.push_back(flat);
+    }
+
+    clip.channel_count =
+        static_cast<std::uint32_t>(result.channels.size()) - clip.first_channel;
+    std::ranges::stable_sort(
+        std::ranges::subrange{result.channels.begin() + clip.first_channel,
+                              result.channels.end()},
+        {}, &AnimationChannel::path);
+    result.clips.push_back(clip);
+  }
+  return result;
+}
+
+auto interpolate_rotations(std::span<const glm::vec4> from,
+                           std::span<const glm::vec4> to,
+                           std::span<const float> factors,
+                           std::span<glm::vec4> result) noexcept -> void
+{
+  std::size_t i = 0;
+#ifdef ANIMATION_USE_SSE
+  const auto madd = [](__m128 a, __m128 b, __m128 c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  };
+  const auto splat = [](float value) { return _mm_set1_ps(value); };
+
+  // Transposing four quaternions puts each component into a register of its
+  // own, so that every lane works on a different quaternion
+  for (; i + 4 <= result.size(); i += 4) {
+    auto x0 = _mm_loadu_ps(glm::value_ptr(from[i]));
+    auto y0 = _mm_loadu_ps(glm::value_ptr(from[i + 1]));
+    auto z0 = _mm_loadu_ps(glm::value_ptr(from[i + 2]));
+    auto w0 = _mm_loadu_ps(glm::value_ptr(from[i + 3]));
+    _MM_TRANSPOSE4_PS(x0, y0, z0, w0);
+    auto x1 = _mm_loadu_ps(glm::value_ptr(to[i]));
+    auto y1 = _mm_loadu_ps(glm::value_ptr(to[i + 1]));
+    auto z1 = _mm_loadu_ps(glm::value_ptr(to[i + 2]));
+    auto w1 = _mm_loadu_ps(glm::value_ptr(to[i + 3]));
+    _MM_TRANSPOSE4_PS(x1, y1, z1, w1);
+    const auto t = _mm_loadu_ps(&factors[i]);
+
+    // Flip the target into the hemisphere of the source
+    const auto cosine =
+        madd(x0, x1, madd(y0, y1, madd(z0, z1, _mm_mul_ps(w0, w1))));
+    const auto sign = _mm_and_ps(cosine, splat(-0.0F));
+    x1 = _mm_xor_ps(x1, sign);
+    y1 = _mm_xor_ps(y1, sign);
+    z1 = _mm_xor_ps(z1, sign);
+    w1 = _mm_xor_ps(w1, sign);
+    const auto d = _mm_xor_ps(cosine, sign);
+
+    const auto a = madd(
+        d,
+        madd(d, _mm_sub_ps(splat(3.55645F), _mm_mul_ps(d, splat(1.43519F))),
+             splat(-3.2452F)),
+        splat(1.0904F));
+    const auto b =
+        madd(d, madd(d, splat(0.215638F), splat(-1.06021F)), splat(0.848013F));
+    const auto half = _mm_sub_ps(t, splat(0.5F));
+    const auto k = madd(_mm_mul_ps(a, half), half, b);
+    const auto factor = madd(
+        _mm_mul_ps(_mm_mul_ps(t, half), _mm_sub_ps(t, splat(1.0F))), k, t);
+
+    auto x = madd(_mm_sub_ps(x1, x0), factor, x0);
+    auto y = madd(_mm_sub_ps(y1, y0), factor, y0);
+    auto z = madd(_mm_sub_ps(z1, z0), factor, z0);
+    auto w = madd(_mm_sub_ps(w1, w0), factor, w0);
+    const auto length =
+        _mm_sqrt_ps(madd(x, x, madd(y, y, madd(z, z, _mm_mul_ps(w, w)))));
+    x = _mm_div_ps(x, length);
+    y = _mm_div_ps(y, length);
+    z = _mm_div_ps(z, length);
+    w = _mm_div_ps(w, length);
+
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(glm::value_ptr(result[i]), x);
+    _mm_storeu_ps(glm::value_ptr(result[i + 1]), y);
+    _mm_storeu_ps(glm::value_ptr(result[i + 2]), z);
+    _mm_storeu_ps(glm::value_ptr(result[i + 3]), w);
+  }
+#endif
+  for (; i < result.size(); ++i) {
+    result[i] = interpolate_rotation(from[i], to[i], factors[i]);
+  }
+}
+
+AnimationSampler::AnimationSampler(const AnimationClip& clip,
+                                   std::span<const AnimationChannel> channels,
+                                   std::span<const float> times,
+                                   std::span<const glm::vec4> values)
+    : duration_{clip.duration}
+{
+  const auto clip_channels =
+      channels.subspan(clip.first_channel, clip.channel_count);
+  const auto count = clip_channels.size();
+  nodes_.reserve(count);
+  interpolations_.reserve(count);
+  first_keys_.reserve(count);
+  key_counts_.reserve(count);
+  first_values_.reserve(count);
+  first_weights_.reserve(count);
+
+  // Only the keyframes of this clip are copied, rebased to its first key and
+  // value
+  std::unordered_map<std::uint32_t, std::uint32_t> first_keys;
+  for (const auto& channel : clip_channels) {
+    const auto [key, inserted] = first_keys.try_emplace(
+        channel.first_key, static_cast<std::uint32_t>(times_.size()));
+    if (inserted) {
+      const auto keys = times.subspan(channel.first_key, channel.key_count);
+      times_.insert(times_.end(), keys.begin(), keys.end());
+    }
+    const auto value_count =
+        channel.interpolation == AnimationInterpolation::cubic_spline
+            ? channel.key_count * 3
+            : channel.key_count;
+    first_values_.push_back(static_cast<std::uint32_t>(values_.size()));
+    first_weights_.push_back(channel.first_weight);
+    const auto channel_values =
+        values.subspan(channel.first_value, value_count);
+    values_.insert(values_.end(), channel_values.begin(),
+                   channel_values.end());
+
+    nodes_.push_back(channel.node);
+    interpolations_.push_back(channel.interpolation);
+    first_keys_.push_back(key->second);
+    key_counts_.push_back(channel.key_count);
+
+    if (channel.path == AnimationPath::translation) {
+      ++rotations_begin_;
+    }
+    if (channel.path == AnimationPath::translation ||
+        channel.path == AnimationPath::rotation) {
+      ++rotations_end_;
+    }
+    if (channel.path != AnimationPath::weights) {
+      ++weights_begin_;
+    }
+  }
+
+  cursors_.assign(count, 0);
+  from_.resize(count);
+  to_.resize(count);
+  factors_.resize(count);
+  results_.resize(count);
+}
+
+auto AnimationSampler::find_key(std::size_t channel, float time) noexcept
+    -> std::uint32_t
+{
+  const auto* times = times_.data() + first_keys_[channel];
+  const auto count = key_counts_[channel];
+  auto key = cursors_[channel];
+
+  // Forward playback stays on the cached keyframe or moves to the next one
+  for (const auto end = std::min(key + 2, count);
+       key < end && times[key] <= time; ++key) {
+    if (key + 1 == count || time < times[key + 1]) {
+      cursors_[channel] = key;
+      return key;
+    }
+  }
+
+  // Anything else, such as the clip wrapping around, searches the channel
+  const auto* next = std::upper_bound(times, times + count, time);
+  key = next == times ? 0 : static_cast<std::uint32_t>(next - times - 1);
+  cursors_[channel] = key;
+  return key;
+}
+
+auto AnimationSampler::sample_range(std::size_t begin, std::size_t end,
+                                    float time) noexcept -> void
+{
+  for (std::size_t i = begin; i < end; ++i) {
+    const auto key = find_key(i, time);
+    const auto* times = times_.data() + first_keys_[i];
+    const auto* values = values_.data() + first_values_[i];
+    const auto interpolation = interpolations_[i];
+    // Cubic splines surround each value with its tangents
+    const auto cubic = interpolation == AnimationInterpolation::cubic_spline;
+    const auto value = [&](std::uint32_t k) {
+      return cubic ? values[k * 3 + 1] : values[k];
+    };
+
+    from_[i] = value(key);
+    to_[i] = from_[i];
+    factors_[i] = 0.0F;
+    // Before the first and after the last keyframe the value is held
+    if (key + 1 == key_counts_[i] || time <= times[key] ||
+        interpolation == AnimationInterpolation::step) {
+      continue;
+    }
+
+    const auto delta = times[key + 1] - times[key];
+    const auto t = std::clamp((time - times[key]) / delta, 0.0F, 1.0F);
+    if (cubic) {
+      from_[i] = hermite(from_[i], values[key * 3 + 2] * delta,
+                         value(key + 1), values[key * 3 + 3] * delta, t);
+      to_[i] = from_[i];
+    } else {
+      to_[i] = value(key + 1);
+      factors_[i] = t;
+    }
+  }
+
+  for (std::size_t i = begin; i < std::min(end, rotations_begin_); ++i) {
+    results_[i] = from_[i] + (to_[i] - from_[i]) * factors_[i];
+  }
+  const auto rotations_first = std::max(begin, rotations_begin_);
+  const auto rotations_last = std::min(end, rotations_end_);
+  if (rotations_first < rotations_last) {
+    const auto count = rotations_last - rotations_first;
+    interpolate_rotations(
+        std::span{from_}.subspan(rotations_first, count),
+        std::span{to_}.subspan(rotations_first, count),
+        std::span{factors_}.subspan(rotations_first, count),
+        std::span{results_}.subspan(rotations_first, count));
+  }
+  for (auto i = std::max(begin, rotations_end_); i < end; ++i) {
+    results_[i] = from_[i] + (to_[i] - from_[i]) * factors_[i];
+  }
+}
+
+auto AnimationSampler::update(float time, SceneGraph& graph,
+                              MorphWeights& weights, ThreadPool& pool) -> void
+{
+  if (empty()) {
+    return;
+  }
+  const auto clip_time = duration_ > 0.0F ? std::fmod(time, duration_) : 0.0F;
+
+  const auto count = nodes_.size();
+  parallel_for(pool, count, min_channels_per_task,
+               [this, clip_time](std::size_t begin, std::size_t end) {
+                 sample_range(begin, end, clip_time);
+               });
+
+  for (std::size_t i = 0; i < rotations_begin_; ++i) {
+    graph.set_translation(nodes_[i], glm::vec3{results_[i]});
+  }
+  for (auto i = rotations_begin_; i < rotations_end_; ++i) {
+    const auto& q = results_[i];
+    graph.set_rotation(nodes_[i], glm::quat{q.w, q.x, q.y, q.z});
+  }
+  for (auto i = rotations_end_; i < weights_begin_; ++i) {
+    graph.set_scale(nodes_[i], glm::vec3{results_[i]});
+  }
+  for (auto i = weights_begin_; i < count; ++i) {
+    weights.set(nodes_[i], first_weights_[i], results_[i]);
+  }
+}
@@ -0,0 +1,141 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct GltfScene;
+class MorphWeights;
+class SceneGraph;
+class ThreadPool;
+
+enum class AnimationPath : std::uint8_t {
+  translation,
+  rotation,
+  scale,
+  weights,
+};
+
+enum class AnimationInterpolation : std::uint8_t {
+  step,
+  linear,
+  cubic_spline,
+};
+
+/**
+ * @brief One animated property of a node.
+ *
+ * Keyframe times and values are stored in separate arrays shared by all
+ * channels. Every value is a vec4: rotations in x, y, z, w order,
+ * translations and scales padded with a zero. Morph target weights are split
+ * into channels of four weights each. Cubic splines store an in-tangent, the
+ * value and an out-tangent per key.
+ */
+struct AnimationChannel {
+  // Index of the target node in the flattened hierarchy
+  std::uint32_t node = 0;
+  AnimationPath path = AnimationPath::translation;
+  AnimationInterpolation interpolation = AnimationInterpolation::linear;
+  // The first morph target weight of the node that a weights channel sets
+  std::uint16_t first_weight = 0;
+  std::uint32_t first_key = 0;
+  std::uint32_t key_count = 0;
+  std::uint32_t first_value = 0;
+};
+
+// The channels of one animation, ordered by path
+struct AnimationClip {
+  std::uint32_t first_channel = 0;
+  std::uint32_t channel_count = 0;
+  // Time of the last keyframe of any channel, in seconds
+  float duration = 0.0F;
+};
+
+struct FlatAnimations {
+  std::vector<AnimationClip> clips;
+  std::vector<AnimationChannel> channels;
+  std::vector<float> times;
+  std::vector<glm::vec4> values;
+};
+
+// Converts every animation to the flattened hierarchy produced by
+// flatten_nodes()
+[[nodiscard]] auto flatten_animations(const GltfScene& scene)
+    -> FlatAnimations;
+
+// Writes the normalized interpolation of from[i] and to[i] at factors[i] to
+// result[i]. The interpolation follows the shorter arc and closely
+// approximates slerp, four quaternions at a time where SSE is available.
+auto interpolate_rotations(std::span<const glm::vec4> from,
+                           std::span<const glm::vec4> to,
+                           std::span<const float> factors,
+                           std::span<glm::vec4> result) noexcept -> void;
+
+/**
+ * @brief Plays one animation clip onto a scene graph.
+ *
+ * Channel state is kept as structure of arrays. Each channel remembers the
+ * keyframe it sampled last, so that forward playback finds the next keyframe
+ * in constant time and only falls back to a binary search after a jump.
+ * Rotations are blended in batches across channels, and large clips are
+ * split across a thread pool.
+ */
+class AnimationSampler {
+public:
+  AnimationSampler() = default;
+  AnimationSampler(const AnimationClip& clip,
+                   std::span<const AnimationChannel> channels,
+                   std::span<const float> times,
+                   std::span<const glm::vec4> values);
+
+  [[nodiscard]] auto empty() const noexcept -> bool
+  {
+    return nodes_.empty();
+  }
+
+  [[nodiscard]] auto duration() const noexcept -> float
+  {
+    return duration_;
+  }
+
+  // Samples every channel at time, wrapped around the clip duration, and
+  // sets the local transforms and morph target weights of the target nodes
+  auto update(float time, SceneGraph& graph, MorphWeights& weights,
+              ThreadPool& pool) -> void;
+
+private:
+  float duration_ = 0.0F;
+  std::vector<float> times_;
+  std::vector<glm::vec4> values_;
+
+  // Channels in clip order, so that every path is a contiguous range
+  std::vector<std::uint32_t> nodes_;
+  std::vector<AnimationInterpolation> interpolations_;
+  std::vector<std::uint32_t> first_keys_;
+  std::vector<std::uint32_t> key_counts_;
+  std::vector<std::uint32_t> first_values_;
+  std::vector<std::uint16_t> first_weights_;
+  // The keyframe each channel sampled last
+  std::vector<std::uint32_t> cursors_;
+  // Translations come first, followed by rotations, scales and weights
+  std::size_t rotations_begin_ = 0;
+  std::size_t rotations_end_ = 0;
+  std::size_t weights_begin_ = 0;
+
+  // The keyframe values around the sampled time and the blend factor
+  // between them
+  std::vector<glm::vec4> from_;
+  std::vector<glm::vec4> to_;
+  std::vector<float> factors_;
+  std::vector<glm::vec4> results_;
+
+  auto find_key(std::size_t channel, float time) noexcept -> std::uint32_t;
+  auto sample_range(std::size_t begin, std::size_t end, float time) noexcept
+      -> void;
+};
+
+#endif // ANIMATION_HPP
@@ -0,0 +1,301 @@
+#include "base64.hpp"
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define BASE64_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC exposes every intrinsic regardless of the target architecture
+#define BASE64_TARGET(isa)
+#else
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace {
+
+constexpr std::uint8_t invalid_char = 0xFF;
+constexpr std::uint32_t max_sextet = 63;
+
+constexpr auto decode_table = [] {
+  std::array<std::uint8_t, 256> table{};
+  table.fill(invalid_char);
+  for (std::uint8_t i = 0; i < 26; ++i) {
+    table[static_cast<std::size_t>('A' + i)] = i;
+    table[static_cast<std::size_t>('a' + i)] = static_cast<std::uint8_t>(26 + i);
+  }
+  for (std::uint8_t i = 0; i < 10; ++i) {
+    table[static_cast<std::size_t>('0' + i)] = static_cast<std::uint8_t>(52 + i);
+  }
+  table['+'] = 62;
+  table['/'] = 63;
+  return table;
+}();
+
+[[nodiscard]] auto strip_padding(std::string_view input) noexcept
+    -> std::string_view
+{
+  for (int i = 0; i < 2 && !input.empty() && input.back() == '='; ++i) {
+    input.remove_suffix(1);
+  }
+  return input;
+}
+
+[[nodiscard]] auto lookup(char c) noexcept -> std::uint32_t
+{
+  return decode_table[static_cast<unsigned char>(c)];
+}
+
+[[noreturn]] auto throw_invalid_input() -> void
+{
+  throw std::runtime_error{"invalid base64 input"};
+}
+
+// Decodes unpadded base64 text. Writes exactly the decoded size of input.
+auto decode_tail(std::string_view input, std::byte* output) -> void
+{
+  const char* in = input.data();
+  std::size_t remaining = input.size();
+
+  while (remaining >= 4) {
+    const auto a = lookup(in[0]);
+    const auto b = lookup(in[1]);
+    const auto c = lookup(in[2]);
+    const auto d = lookup(in[3]);
+    if ((a | b | c | d) > max_sextet) {
+      throw_invalid_input();
+    }
+    const auto triple = (a << 18) | (b << 12) | (c << 6) | d;
+    output[0] = static_cast<std::byte>(triple >> 16);
+    output[1] = static_cast<std::byte>(triple >> 8);
+    output[2] = static_cast<std::byte>(triple);
+    in += 4;
+    remaining -= 4;
+    output += 3;
+  }
+
+  if (remaining == 1) {
+    throw_invalid_input();
+  }
+  if (remaining >= 2) {
+    const auto a = lookup(in[0]);
+    const auto b = lookup(in[1]);
+    const auto c = remaining == 3 ? lookup(in[2]) : 0;
+    if ((a | b | c) > max_sextet) {
+      throw_invalid_input();
+    }
+    const auto triple = (a << 18) | (b << 12) | (c << 6);
+    output[0] = static_cast<std::byte>(triple >> 16);
+    if (remaining == 3) {
+      output[1] = static_cast<std::byte>(triple >> 8);
+    }
+  }
+}
+
+#ifdef BASE64_X86
+
+// Both vector decoders follow Muła and Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions". Characters are classified by their high
+// and low nibbles with two pshufb lookups, translated to 6-bit values with a
+// third one, and packed with multiply-add instructions.
+
+BASE64_TARGET("ssse3")
+auto decode_ssse3(const char*& in, std::size_t& remaining, std::byte*& out)
+    -> bool
+{
+  const __m128i lut_lo =
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi =
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2F);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+  const __m128i pack_ab = _mm_set1_epi32(0x01400140);
+  const __m128i pack_abc = _mm_set1_epi32(0x00011000);
+  const __m128i pack_shuffle =
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  // Each step stores 16 bytes but only produces 12 of them, so stop while the
+  // remaining output still has room for the overhang
+  while (remaining >= 24) {
+    const __m128i input =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+    const __m128i hi_nibbles =
+        _mm_and_si128(_mm_srli_epi32(input, 4), nibble_mask);
+    const __m128i lo_nibbles = _mm_and_si128(input, nibble_mask);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128())) != 0) {
+      return false;
+    }
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(input, mask_2f);
+    const __m128i roll =
+        _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    const __m128i values = _mm_add_epi8(input, roll);
+
+    const __m128i merged_ab = _mm_maddubs_epi16(values, pack_ab);
+    const __m128i merged_abc = _mm_madd_epi16(merged_ab, pack_abc);
+    const __m128i packed = _mm_shuffle_epi8(merged_abc, pack_shuffle);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+
+    in += 16;
+    remaining -= 16;
+    out += 12;
+  }
+  return true;
+}
+
+BASE64_TARGET("avx2")
+auto decode_avx2(const char*& in, std::size_t& remaining, std::byte*& out)
+    -> bool
+{
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+      0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+      -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+  const __m256i pack_ab = _mm256_set1_epi32(0x01400140);
+  const __m256i pack_abc = _mm256_set1_epi32(0x00011000);
+  const __m256i pack_shuffle = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+      10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i lane_merge = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+  // 32 bytes are stored per 24 produced, see decode_ssse3
+  while (remaining >= 48) {
+    const __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+
+    const __m256i hi_nibbles =
+        _mm256_and_si256(_mm256_srli_epi32(input, 4), nibble_mask);
+    const __m256i lo_nibbles = _mm256_and_si256(input, nibble_mask);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) {
+      return false;
+    }
+
+    const __m256i eq_2f = _mm256_cmpeq_epi8(input, mask_2f);
+    const __m256i roll =
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    const __m256i values = _mm256_add_epi8(input, roll);
+
+    const __m256i merged_ab = _mm256_maddubs_epi16(values, pack_ab);
+    const __m256i merged_abc = _mm256_madd_epi16(merged_ab, pack_abc);
+    const __m256i packed = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(merged_abc, pack_shuffle), lane_merge);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+
+    in += 32;
+    remaining -= 32;
+    out += 24;
+  }
+  return true;
+}
+
+enum class SimdLevel { none, ssse3, avx2 };
+
+[[nodiscard]] auto detect_simd_level() noexcept -> SimdLevel
+{
+#ifdef _MSC_VER
+  std::array<int, 4> info{};
+  __cpuid(info.data(), 0);
+  const int max_leaf = info[0];
+
+  __cpuid(info.data(), 1);
+  const bool ssse3 = (info[2] & (1 << 9)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+  bool avx2 = false;
+  if (max_leaf >= 7 && osxsave &&
+      (_xgetbv(0) & 0x6) == 0x6) { // The OS saves the ymm registers
+    __cpuidex(info.data(), 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  const bool ssse3 = __builtin_cpu_supports("ssse3");
+  const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (avx2) {
+    return SimdLevel::avx2;
+  }
+  if (ssse3) {
+    return SimdLevel::ssse3;
+  }
+  return SimdLevel::none;
+}
+
+#endif // BASE64_X86
+
+} // anonymous namespace
+
+[[nodiscard]] auto base64_decoded_size(std::string_view input) noexcept
+    -> std::size_t
+{
+  const auto data = strip_padding(input);
+  const auto remainder = data.size() % 4;
+  return data.size() / 4 * 3 + (remainder == 0 ? 0 : remainder - 1);
+}
+
+auto base64_decode_scalar(std::string_view input, std::span<std::byte> output)
+    -> void
+{
+  if (output.size() != base64_decoded_size(input)) {
+    throw std::invalid_argument{"base64 output has the wrong size"};
+  }
+  decode_tail(strip_padding(input), output.data());
+}
+
+auto base64_decode(std::string_view input, std::span<std::byte> output)
+    -> void
+{
+  if (output.size() != base64_decoded_size(input)) {
+    throw std::invalid_argument{"base64 output has the wrong size"};
+  }
+
+  const auto data = strip_padding(input);
+  const char* in = data.data();
+  std::size_t remaining = data.size();
+  std::byte* out = output.data();
+
+#ifdef BASE64_X86
+  static const SimdLevel simd_level = detect_simd_level();
+
+  bool valid = true;
+  switch (simd_level) {
+  case SimdLevel::avx2:
+    valid = decode_avx2(in, remaining, out);
+    [[fallthrough]];
+  case SimdLevel::ssse3:
+    valid = valid && decode_ssse3(in, remaining, out);
+    break;
+  case SimdLevel::none:
+    break;
+  }
+  if (!valid) {
+    throw_invalid_input();
+  }
+#endif
+
+  decode_tail({in, remaining}, out);
+}
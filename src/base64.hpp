@@ -0,0 +1,28 @@
+#ifndef BASE64_HPP
+#define BASE64_HPP
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+// Returns the number of bytes that the base64 text decodes to
+[[nodiscard]] auto base64_decoded_size(std::string_view input) noexcept
+    -> std::size_t;
+
+/**
+ * @brief Decodes base64 text into output.
+ *
+ * output must hold exactly base64_decoded_size(input) bytes. Uses the widest
+ * SIMD implementation supported by the CPU (AVX2 or SSSE3) and falls back to a
+ * table-driven scalar decoder.
+ *
+ * @throw std::runtime_error if the input is not valid base64
+ */
+auto base64_decode(std::string_view input, std::span<std::byte> output)
+    -> void;
+
+// The scalar decoder used for tails and on CPUs without SIMD support
+auto base64_decode_scalar(std::string_view input, std::span<std::byte> output)
+    -> void;
+
+#endif // BASE64_HPP
@@ -3,48 +3,69 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "memory_allocator.hpp"
+
 namespace vulkan {
 
-[[nodiscard]] auto create_buffer(vk::PhysicalDevice physical_device,
-                                 vk::Device device, vk::DeviceSize size,
+class ImageStateTracker;
+class StagingRing;
+
+[[nodiscard]] auto create_buffer(MemoryAllocator& allocator, vk::Device device,
+                                 vk::DeviceSize size,
                                  vk::BufferUsageFlags usages,
                                  vk::MemoryPropertyFlags properties)
-    -> std::tuple<vk::UniqueBuffer, vk::UniqueDeviceMemory>;
+    -> std::tuple<vk::UniqueBuffer, Allocation>;
 
-// Copy a vulkan device buffer to another
-// queue is the Vulkan queue to submit to
-auto copy_buffer(vk::Device device, vk::Queue queue,
-                 vk::CommandPool command_pool, vk::Buffer src, vk::Buffer dst,
-                 vk::DeviceSize size) -> void;
+// Creates a buffer like the one of old and places it outside the blocks
+// being defragmented. Returns null handles if no other block has room.
+[[nodiscard]] auto relocate_buffer(MemoryAllocator& allocator,
+                                   vk::Device device, const Allocation& old,
+                                   vk::DeviceSize size,
+                                   vk::BufferUsageFlags usages)
+    -> std::tuple<vk::UniqueBuffer, Allocation>;
 
+// Creates a device local buffer and uploads data to it through the staging
+// ring
 [[nodiscard]] auto
-create_buffer_from_data(vk::PhysicalDevice physical_device, vk::Device device,
-                        vk::Queue queue, vk::CommandPool command_pool,
-                        vk::BufferUsageFlags usages, const void* data,
-                        vk::DeviceSize size)
-    -> std::tuple<vk::UniqueBuffer, vk::UniqueDeviceMemory>;
+create_buffer_from_data(MemoryAllocator& allocator, vk::Device device,
+                        StagingRing& staging, vk::BufferUsageFlags usages,
+                        const void* data, vk::DeviceSize size)
+    -> std::tuple<vk::UniqueBuffer, Allocation>;
 
 [[nodiscard]] auto
-create_image(vk::PhysicalDevice physical_device, vk::Device device,
-             std::uint32_t width, std::uint32_t height, vk::Format format,
-             vk::ImageTiling tiling, vk::ImageUsageFlags usage,
-             vk::MemoryPropertyFlags properties)
-    -> std::tuple<vk::UniqueImage, vk::UniqueDeviceMemory>;
+create_image(MemoryAllocator& allocator, vk::Device device, std::uint32_t width,
+             std::uint32_t height, vk::Format format, vk::ImageTiling tiling,
+             vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties)
+    -> std::tuple<vk::UniqueImage, Allocation>;
+
+// The image counterpart of relocate_buffer
+[[nodiscard]] auto
+relocate_image(MemoryAllocator& allocator, vk::Device device,
+               const Allocation& old, std::uint32_t width,
+               std::uint32_t height, vk::Format format, vk::ImageTiling tiling,
+               vk::ImageUsageFlags usage)
+    -> std::tuple<vk::UniqueImage, Allocation>;
 
 [[nodiscard]] auto create_image_view(vk::Device device, vk::Image image,
                                      vk::Format format,
                                      vk::ImageAspectFlags image_aspect)
     -> vk::UniqueImageView;
 
-void copy_buffer_to_image(vk::Device device, vk::Queue queue,
-                          vk::CommandPool command_pool, vk::Buffer buffer,
-                          vk::Image image, std::uint32_t width,
-                          std::uint32_t height);
+// Starts tracking a newly created 2D color image dst and queues the barriers
+// that let dst be copied to from src
+auto use_for_image_copy(ImageStateTracker& image_states, vk::Image src,
+                        vk::Image dst) -> void;
+
+// Blits a 2D color image to a smaller one, with the layouts set by
+// use_for_image_copy
+void record_downsample(vk::CommandBuffer command_buffer, vk::Image src,
+                       vk::Extent2D src_extent, vk::Image dst,
+                       vk::Extent2D dst_extent);
 
-void transition_image_layout(vk::Device device, vk::Queue queue,
-                             vk::CommandPool command_pool, vk::Image image,
-                             vk::Format format, vk::ImageLayout old_layout,
-                             vk::ImageLayout new_layout);
+// Copies a 2D color image to one of the same extent, with the layouts set by
+// use_for_image_copy
+void record_image_copy(vk::CommandBuffer command_buffer, vk::Image src,
+                       vk::Image dst, vk::Extent2D extent);
 
 } // namespace vulkan
 
@@ -0,0 +1,88 @@
+#include "cache_file.hpp"
+
+#include <array>
+#include <utility>
+
+#include "hash.hpp"
+#include "mapped_file.hpp"
+
+namespace fs = std::filesystem;
+
+[[nodiscard]] auto cache_section(std::span<const std::byte> file,
+                                 std::uint64_t offset, std::uint64_t size)
+    -> std::span<const std::byte>
+{
+  if (offset > file.size() || size > file.size() - offset) {
+    throw std::runtime_error{"Cache section is out of bounds"};
+  }
+  return file.subspan(offset, size);
+}
+
+[[nodiscard]] auto
+hash_cache_sources(const fs::path& gltf_path,
+                   const std::vector<std::string>& dependencies)
+    -> std::uint64_t
+{
+  std::uint64_t hash = xxhash64(MappedFile{gltf_path.string()}.bytes());
+  for (const auto& dependency : dependencies) {
+    const MappedFile file{(gltf_path.parent_path() / dependency).string()};
+    hash = xxhash64(file.bytes(), hash);
+  }
+  return hash;
+}
+
+[[nodiscard]] auto join_lines(const std::vector<std::string>& lines)
+    -> std::string
+{
+  std::string result;
+  for (const auto& line : lines) {
+    if (!result.empty()) {
+      result += '\n';
+    }
+    result += line;
+  }
+  return result;
+}
+
+[[nodiscard]] auto split_lines(std::string_view text)
+    -> std::vector<std::string>
+{
+  std::vector<std::string> result;
+  while (!text.empty()) {
+    const auto end = text.find('\n');
+    result.emplace_back(text.substr(0, end));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    text.remove_prefix(end + 1);
+  }
+  return result;
+}
+
+CacheWriter::CacheWriter(fs::path path)
+    : path_{std::move(path)}, temp_path_{path_.string() + ".tmp"},
+      file_{temp_path_, std::ios::binary | std::ios::trunc}
+{
+  if (!file_) {
+    throw std::runtime_error{"failed to open file: " + temp_path_.string()};
+  }
+}
+
+auto CacheWriter::write_at(std::uint64_t offset, const void* data,
+                           std::size_t size) -> void
+{
+  static constexpr std::array<char, cache_section_alignment> padding{};
+  const auto position = static_cast<std::uint64_t>(file_.tellp());
+  file_.write(padding.data(), static_cast<std::streamsize>(offset - position));
+  file_.write(static_cast<const char*>(data),
+              static_cast<std::streamsize>(size));
+}
+
+auto CacheWriter::commit() -> void
+{
+  file_.close();
+  if (!file_) {
+    throw std::runtime_error{"failed to write file: " + temp_path_.string()};
+  }
+  fs::rename(temp_path_, path_);
+}
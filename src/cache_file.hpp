@@ -0,0 +1,73 @@
+#ifndef CACHE_FILE_HPP
+#define CACHE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Cooked data is cached next to the glTF file in files made of a header and
+// sections that are served in place from a memory mapping. Sections start at
+// multiples of this, which covers the alignment of every element type.
+constexpr std::size_t cache_section_alignment = 16;
+
+// Returns the size bytes of a cache section, throwing if a corrupt header
+// points them out of the file
+[[nodiscard]] auto cache_section(std::span<const std::byte> file,
+                                 std::uint64_t offset, std::uint64_t size)
+    -> std::span<const std::byte>;
+
+// Returns the count elements of a cache section. The count is checked
+// before it is multiplied, which a corrupt header could overflow.
+template <typename T>
+[[nodiscard]] auto cache_table(std::span<const std::byte> file,
+                               std::uint64_t offset, std::uint64_t count)
+    -> std::span<const T>
+{
+  if (offset > file.size() || count > (file.size() - offset) / sizeof(T)) {
+    throw std::runtime_error{"Cache section is out of bounds"};
+  }
+  return {reinterpret_cast<const T*>(file.data() + offset), count};
+}
+
+// Hashes the glTF file followed by every file it depends on, given by paths
+// relative to it
+[[nodiscard]] auto
+hash_cache_sources(const std::filesystem::path& gltf_path,
+                   const std::vector<std::string>& dependencies)
+    -> std::uint64_t;
+
+// The dependencies are stored as newline separated paths
+[[nodiscard]] auto join_lines(const std::vector<std::string>& lines)
+    -> std::string;
+[[nodiscard]] auto split_lines(std::string_view text)
+    -> std::vector<std::string>;
+
+/**
+ * @brief Writes the sections of a cache file.
+ *
+ * Everything goes to a temporary file first, which commit() renames to the
+ * cache path, so that an interrupted write never leaves a truncated cache
+ * behind.
+ */
+class CacheWriter {
+public:
+  explicit CacheWriter(std::filesystem::path path);
+
+  // Zero-fills the alignment padding up to offset and writes data there
+  auto write_at(std::uint64_t offset, const void* data, std::size_t size)
+      -> void;
+  auto commit() -> void;
+
+private:
+  std::filesystem::path path_;
+  std::filesystem::path temp_path_;
+  std::ofstream file_;
+};
+
+#endif // CACHE_FILE_HPP
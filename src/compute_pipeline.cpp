@@ -0,0 +1,23 @@
+#include "compute_pipeline.hpp"
+
+namespace vulkan {
+
+[[nodiscard]] auto create_compute_pipeline(vk::Device device,
+                                           vk::PipelineLayout pipeline_layout,
+                                           vk::ShaderModule shader)
+    -> vk::UniquePipeline
+{
+  vk::PipelineShaderStageCreateInfo shader_stage_info;
+  shader_stage_info.setStage(vk::ShaderStageFlagBits::eCompute)
+      .setModule(shader)
+      .setPName("main");
+
+  vk::ComputePipelineCreateInfo pipeline_create_info;
+  pipeline_create_info.setStage(shader_stage_info)
+      .setLayout(pipeline_layout)
+      .setBasePipelineHandle(nullptr);
+
+  return device.createComputePipelineUnique(nullptr, pipeline_create_info);
+}
+
+} // namespace vulkan
@@ -0,0 +1,16 @@
+#ifndef COMPUTE_PIPELINE_HPP
+#define COMPUTE_PIPELINE_HPP
+
+#include <vulkan/vulkan.hpp>
+
+namespace vulkan {
+
+// Compute pipelines share create_graphics_pipeline_layout() for their layout
+[[nodiscard]] auto create_compute_pipeline(vk::Device device,
+                                           vk::PipelineLayout pipeline_layout,
+                                           vk::ShaderModule shader)
+    -> vk::UniquePipeline;
+
+} // namespace vulkan
+
+#endif // COMPUTE_PIPELINE_HPP
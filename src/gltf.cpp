@@ -1,37 +1,898 @@
 #include "gltf.hpp"
 
-#include <rapidjson/document.h>
+#include <meshoptimizer.h>
+#include <stb_image.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
-#include <tuple>
+#include <future>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include "base64.hpp"
+#include "gltf_json.hpp"
+#include "hash.hpp"
+#include "thread_pool.hpp"
 #include "utils.hpp"
 #include <fmt/format.h>
 
 namespace fs = std::filesystem;
 
-[[nodiscard]] auto load_gltf_scene(std::string_view file_location) -> GltfScene
+// The SAX parser builds the tables without an intermediate DOM, so peak memory
+// does not grow with the size of the JSON. The DOM modes are compared against
+// it in benchmarks/gltf_parse_benchmark.cpp.
+constexpr auto json_parse_mode = GltfParseMode::sax;
+
+// Required extensions that the loader and the mesh cooker understand
+constexpr std::array<std::string_view, 2> supported_extensions{
+    "KHR_mesh_quantization",
+    "EXT_meshopt_compression",
+};
+
+// The chunks of a binary glTF (.glb) container
+struct GlbChunks {
+  std::string_view json;
+  std::optional<std::span<const std::byte>> bin;
+};
+
+static auto read_u32(std::span<const std::byte> bytes, std::size_t offset)
+    -> std::uint32_t
+{
+  // glb is little-endian, as are all platforms we run on
+  std::uint32_t result;
+  std::memcpy(&result, bytes.data() + offset, sizeof(result));
+  return result;
+}
+
+static auto parse_glb(std::span<const std::byte> file) -> GlbChunks
+{
+  constexpr std::uint32_t glb_magic = 0x46546C67;      // "glTF"
+  constexpr std::uint32_t json_chunk_type = 0x4E4F534A; // "JSON"
+  constexpr std::uint32_t bin_chunk_type = 0x004E4942;  // "BIN\0"
+  constexpr std::size_t header_size = 12;
+  constexpr std::size_t chunk_header_size = 8;
+
+  if (file.size() < header_size + chunk_header_size ||
+      read_u32(file, 0) != glb_magic) {
+    throw std::runtime_error{"Not a binary glTF file"};
+  }
+  if (const auto version = read_u32(file, 4); version != 2) {
+    throw std::runtime_error{
+        fmt::format("Unsupported binary glTF version {}", version)};
+  }
+  const std::size_t length = read_u32(file, 8);
+  if (length > file.size()) {
+    throw std::runtime_error{"Binary glTF file is truncated"};
+  }
+
+  GlbChunks chunks;
+  std::size_t offset = header_size;
+  bool first_chunk = true;
+  while (offset + chunk_header_size <= length) {
+    const std::size_t chunk_length = read_u32(file, offset);
+    const auto chunk_type = read_u32(file, offset + 4);
+    offset += chunk_header_size;
+    if (chunk_length > length - offset) {
+      throw std::runtime_error{"Binary glTF chunk is out of bounds"};
+    }
+    const auto chunk = file.subspan(offset, chunk_length);
+
+    if (first_chunk) {
+      if (chunk_type != json_chunk_type) {
+        throw std::runtime_error{
+            "The first chunk of a binary glTF file must be JSON"};
+      }
+      chunks.json = {reinterpret_cast<const char*>(chunk.data()),
+                     chunk.size()};
+      first_chunk = false;
+    } else if (chunk_type == bin_chunk_type && !chunks.bin) {
+      chunks.bin = chunk;
+    }
+    // Unknown chunks must be ignored
+
+    // Chunks are padded to 4 bytes
+    offset += (chunk_length + 3) & ~std::size_t{3};
+  }
+
+  if (first_chunk) {
+    throw std::runtime_error{"Binary glTF file has no JSON chunk"};
+  }
+  return chunks;
+}
+
+// Decodes a base64 data uri straight into newly allocated storage
+static auto decode_data_uri(std::string_view uri) -> AlignedBuffer
+{
+  const auto comma = uri.find(',');
+  constexpr std::string_view base64_suffix{";base64"};
+  if (comma == std::string_view::npos ||
+      !uri.substr(0, comma).ends_with(base64_suffix)) {
+    throw std::runtime_error{"Only base64 data uris are supported"};
+  }
+
+  const auto encoded = uri.substr(comma + 1);
+  AlignedBuffer buffer{base64_decoded_size(encoded)};
+  base64_decode(encoded, buffer.bytes());
+  return buffer;
+}
+
+[[nodiscard]] static auto is_data_uri(std::string_view uri) noexcept -> bool
+{
+  constexpr std::string_view data_uri_prefix{"data:"};
+  return uri.starts_with(data_uri_prefix);
+}
+
+// The bytes of a buffer together with the storage that owns them
+struct LoadedBuffer {
+  MappedFile file;
+  AlignedBuffer decoded;
+  std::span<const std::byte> bytes;
+};
+
+static auto load_buffer(const GltfBufferDesc& buffer, std::size_t index,
+                        const fs::path& base_path,
+                        std::optional<std::span<const std::byte>> glb_bin)
+    -> LoadedBuffer
+{
+  const auto byte_length = buffer.byte_length;
+  LoadedBuffer result;
+  if (buffer.meshopt_fallback) {
+    // All of its views are decoded from compressed data in other buffers
+    return result;
+  }
+
+  const auto& uri = buffer.uri;
+  if (!uri) {
+    // Only the first buffer of a glb may refer to the BIN chunk
+    if (!glb_bin || index != 0) {
+      throw std::runtime_error{"Buffers without uri are not supported"};
+    }
+    result.bytes = *glb_bin;
+  } else if (is_data_uri(*uri)) {
+    result.decoded = decode_data_uri(*uri);
+    result.bytes = result.decoded.bytes();
+  } else {
+    result.file = MappedFile{(base_path / fs::path{*uri}).string()};
+    result.bytes = result.file.bytes();
+  }
+
+  if (result.bytes.size() < byte_length) {
+    throw std::runtime_error{
+        fmt::format("Buffer {} has {} bytes but {} are declared", index,
+                    result.bytes.size(), byte_length)};
+  }
+  result.bytes = result.bytes.first(byte_length);
+  return result;
+}
+
+static auto check_meshopt_view(const GltfMeshoptView& view) -> void
+{
+  const auto valid = [&] {
+    switch (view.mode) {
+    case GltfMeshoptMode::attributes:
+      return view.byte_stride % 4 == 0 && view.byte_stride <= 256;
+    case GltfMeshoptMode::triangles:
+      if (view.count % 3 != 0) {
+        return false;
+      }
+      [[fallthrough]];
+    case GltfMeshoptMode::indices:
+      return view.byte_stride == 2 || view.byte_stride == 4;
+    }
+    return false;
+  }();
+  if (!valid || view.byte_stride == 0) {
+    throw std::runtime_error{fmt::format(
+        "Buffer view {} has an invalid meshopt stride or count", view.view)};
+  }
+}
+
+// Decodes an EXT_meshopt_compression buffer view, including its filter, into
+// newly allocated storage
+static auto decode_meshopt_view(const GltfMeshoptView& view,
+                                std::span<const std::byte> source)
+    -> AlignedBuffer
+{
+  check_meshopt_view(view);
+
+  AlignedBuffer result{view.count * view.byte_stride};
+  const auto* data = reinterpret_cast<const unsigned char*>(source.data());
+  int error = 0;
+  switch (view.mode) {
+  case GltfMeshoptMode::attributes:
+    error = meshopt_decodeVertexBuffer(result.data(), view.count,
+                                       view.byte_stride, data, source.size());
+    break;
+  case GltfMeshoptMode::triangles:
+    error = meshopt_decodeIndexBuffer(result.data(), view.count,
+                                      view.byte_stride, data, source.size());
+    break;
+  case GltfMeshoptMode::indices:
+    error = meshopt_decodeIndexSequence(result.data(), view.count,
+                                        view.byte_stride, data, source.size());
+    break;
+  }
+  if (error != 0) {
+    throw std::runtime_error{fmt::format(
+        "Failed to decode meshopt buffer view {} (error {})", view.view,
+        error)};
+  }
+
+  switch (view.filter) {
+  case GltfMeshoptFilter::none:
+    break;
+  case GltfMeshoptFilter::octahedral:
+    meshopt_decodeFilterOct(result.data(), view.count, view.byte_stride);
+    break;
+  case GltfMeshoptFilter::quaternion:
+    meshopt_decodeFilterQuat(result.data(), view.count, view.byte_stride);
+    break;
+  case GltfMeshoptFilter::exponential:
+    meshopt_decodeFilterExp(result.data(), view.count, view.byte_stride);
+    break;
+  }
+  return result;
+}
+
+void GltfImage::PixelsDeleter::operator()(std::byte* pixels) const noexcept
+{
+  stbi_image_free(pixels);
+}
+
+[[nodiscard]] auto decode_gltf_image(std::span<const std::byte> encoded)
+    -> GltfImage
+{
+  int width, height, channels;
+  auto* pixels = stbi_load_from_memory(
+      reinterpret_cast<const stbi_uc*>(encoded.data()),
+      static_cast<int>(encoded.size()), &width, &height, &channels,
+      STBI_rgb_alpha);
+  if (pixels == nullptr) {
+    throw std::runtime_error{
+        fmt::format("Failed to decode image: {}", stbi_failure_reason())};
+  }
+
+  GltfImage image;
+  image.width = static_cast<std::uint32_t>(width);
+  image.height = static_cast<std::uint32_t>(height);
+  image.pixels.reset(reinterpret_cast<std::byte*>(pixels));
+  return image;
+}
+
+// Decodes an image that is stored in a file or a data uri. Only an image
+// file is recorded as the source.
+static auto load_image_from_uri(std::string_view uri,
+                                const fs::path& base_path,
+                                GltfImageSource& source) -> GltfImage
+{
+  if (is_data_uri(uri)) {
+    return decode_gltf_image(decode_data_uri(uri).bytes());
+  }
+  const MappedFile file{(base_path / fs::path{uri}).string()};
+  source = {std::string{uri}, 0, file.size()};
+  return decode_gltf_image(file.bytes());
+}
+
+// Runs f on the pool, or immediately when loading synchronously
+template <typename Func>
+static auto spawn(ThreadPool* pool, Func&& f)
+    -> std::future<std::invoke_result_t<std::decay_t<Func>>>
+{
+  if (pool != nullptr) {
+    return pool->submit(std::forward<Func>(f));
+  }
+  std::packaged_task<std::invoke_result_t<std::decay_t<Func>>()> task{
+      std::forward<Func>(f)};
+  auto future = task.get_future();
+  task();
+  return future;
+}
+
+template <typename T>
+static auto wait_all(ThreadPool* pool,
+                     const std::vector<std::future<T>>& futures) -> void
+{
+  for (const auto& future : futures) {
+    if (!future.valid()) {
+      continue;
+    }
+    if (pool != nullptr) {
+      pool->wait(future);
+    } else {
+      future.wait();
+    }
+  }
+}
+
+// Waits for every future before returning the results, so that no task
+// still references the document when an exception propagates
+template <typename T>
+static auto get_all(ThreadPool* pool, std::vector<std::future<T>>& futures)
+    -> std::vector<T>
+{
+  wait_all(pool, futures);
+
+  std::vector<T> results;
+  results.reserve(futures.size());
+  for (auto& future : futures) {
+    results.push_back(future.get());
+  }
+  return results;
+}
+
+static auto check_buffer_views(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.buffer_views.size(); ++i) {
+    const auto& view = scene.buffer_views[i];
+    // Compared without adding, as a crafted file could wrap the sum
+    if (view.buffer >= scene.buffers.size() ||
+        view.byte_length > scene.buffers[view.buffer].size() ||
+        view.byte_offset >
+            scene.buffers[view.buffer].size() - view.byte_length) {
+      throw std::runtime_error{
+          fmt::format("Buffer view {} is out of bounds", i)};
+    }
+  }
+}
+
+static auto check_accessors(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.accessors.size(); ++i) {
+    const auto& accessor = scene.accessors[i];
+    if (!accessor.buffer_view) {
+      continue;
+    }
+    if (*accessor.buffer_view >= scene.buffer_views.size()) {
+      throw std::runtime_error{
+          fmt::format("Accessor {} refers to a missing buffer view", i)};
+    }
+    const auto& view = scene.buffer_views[*accessor.buffer_view];
+    // The element count is checked by dividing, as multiplying it by the
+    // stride could wrap
+    const auto element_size = accessor.element_size();
+    const auto fits = [&] {
+      if (accessor.count == 0) {
+        return true;
+      }
+      if (accessor.byte_offset > view.byte_length ||
+          element_size > view.byte_length - accessor.byte_offset) {
+        return false;
+      }
+      const auto room =
+          view.byte_length - accessor.byte_offset - element_size;
+      return accessor.count - 1 <= room / scene.accessor_stride(i);
+    };
+    if (!fits()) {
+      throw std::runtime_error{fmt::format("Accessor {} is out of bounds", i)};
+    }
+    // accessor_span reads the elements in place, so the components have to
+    // be aligned as glTF requires of offsets and strides
+    const auto alignment = component_size(accessor.component_type);
+    const auto start =
+        reinterpret_cast<std::uintptr_t>(scene.accessor_bytes(i).data());
+    if (start % alignment != 0 || scene.accessor_stride(i) % alignment != 0) {
+      throw std::runtime_error{fmt::format(
+          "Accessor {} is not aligned to its {} byte components", i,
+          alignment)};
+    }
+  }
+}
+
+static auto check_textures(const GltfScene& scene, std::size_t image_count)
+    -> void
+{
+  for (std::size_t i = 0; i < scene.textures.size(); ++i) {
+    const auto& texture = scene.textures[i];
+    if (texture.sampler && *texture.sampler >= scene.samplers.size()) {
+      throw std::runtime_error{
+          fmt::format("Texture {} refers to a missing sampler", i)};
+    }
+    if (texture.source && *texture.source >= image_count) {
+      throw std::runtime_error{
+          fmt::format("Texture {} refers to a missing image", i)};
+    }
+  }
+}
+
+static auto check_materials(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.materials.size(); ++i) {
+    const auto& material = scene.materials[i];
+    for (const auto texture :
+         {material.base_color_texture, material.metallic_roughness_texture,
+          material.normal_texture, material.occlusion_texture,
+          material.emissive_texture}) {
+      if (texture && *texture >= scene.textures.size()) {
+        throw std::runtime_error{
+            fmt::format("Material {} refers to a missing texture", i)};
+      }
+    }
+  }
+}
+
+// Morph targets displace every vertex of the primitive by a float vector
+static auto check_morph_targets(const GltfScene& scene, std::size_t mesh,
+                                const GltfPrimitive& primitive) -> void
+{
+  if (primitive.targets.size() != scene.meshes[mesh].target_count()) {
+    throw std::runtime_error{fmt::format(
+        "Primitives of mesh {} differ in their morph targets", mesh)};
+  }
+  for (const auto& target : primitive.targets) {
+    if (!target.position) {
+      continue;
+    }
+    const auto accessor = *target.position;
+    if (accessor >= scene.accessors.size() || !primitive.position ||
+        scene.accessors[accessor].type != GltfAccessorType::vec3 ||
+        scene.accessors[accessor].component_type != GltfComponentType::f32 ||
+        scene.accessors[accessor].count !=
+            scene.accessors[*primitive.position].count) {
+      throw std::runtime_error{
+          fmt::format("Mesh {} has an invalid morph target", mesh)};
+    }
+  }
+}
+
+static auto check_meshes(const GltfScene& scene) -> void
+{
+  const auto check_accessor = [&](std::optional<std::size_t> accessor) {
+    if (accessor && *accessor >= scene.accessors.size()) {
+      throw std::runtime_error{
+          fmt::format("Accessor {} does not exist", *accessor)};
+    }
+  };
+
+  for (std::size_t i = 0; i < scene.meshes.size(); ++i) {
+    const auto& mesh = scene.meshes[i];
+    if (!mesh.weights.empty() && mesh.weights.size() != mesh.target_count()) {
+      throw std::runtime_error{
+          fmt::format("Mesh {} has a weight count that does not match its "
+                      "morph targets",
+                      i)};
+    }
+    for (const auto& primitive : mesh.primitives) {
+      check_accessor(primitive.position);
+      check_accessor(primitive.normal);
+      check_accessor(primitive.texcoord0);
+      check_accessor(primitive.color0);
+      check_accessor(primitive.joints0);
+      check_accessor(primitive.weights0);
+      check_accessor(primitive.indices);
+      if (primitive.material &&
+          *primitive.material >= scene.materials.size()) {
+        throw std::runtime_error{
+            fmt::format("Material {} does not exist", *primitive.material)};
+      }
+      check_morph_targets(scene, i, primitive);
+    }
+  }
+}
+
+static auto check_nodes(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.nodes.size(); ++i) {
+    const auto& node = scene.nodes[i];
+    if (node.mesh && *node.mesh >= scene.meshes.size()) {
+      throw std::runtime_error{
+          fmt::format("Node {} refers to a missing mesh", i)};
+    }
+    if (node.skin && *node.skin >= scene.skins.size()) {
+      throw std::runtime_error{
+          fmt::format("Node {} refers to a missing skin", i)};
+    }
+    if (!node.weights.empty() &&
+        (!node.mesh ||
+         node.weights.size() != scene.meshes[*node.mesh].target_count())) {
+      throw std::runtime_error{fmt::format(
+          "Node {} has weights that do not match its morph targets", i)};
+    }
+    for (const auto child : node.children) {
+      if (child >= scene.nodes.size()) {
+        throw std::runtime_error{
+            fmt::format("Node {} refers to a missing child", i)};
+      }
+    }
+  }
+}
+
+static auto check_skins(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.skins.size(); ++i) {
+    const auto& skin = scene.skins[i];
+    for (const auto joint : skin.joints) {
+      if (joint >= scene.nodes.size()) {
+        throw std::runtime_error{
+            fmt::format("Skin {} refers to a missing joint", i)};
+      }
+    }
+    if (!skin.inverse_bind_matrices) {
+      continue;
+    }
+    const auto accessor = *skin.inverse_bind_matrices;
+    if (accessor >= scene.accessors.size() ||
+        scene.accessors[accessor].type != GltfAccessorType::mat4 ||
+        scene.accessors[accessor].component_type != GltfComponentType::f32 ||
+        scene.accessors[accessor].count < skin.joints.size()) {
+      throw std::runtime_error{
+          fmt::format("Skin {} has invalid inverse bind matrices", i)};
+    }
+  }
+}
+
+// Keyframe outputs must hold one value per input, or three for cubic splines
+// whose tangents are stored alongside
+static auto is_valid_animation_sampler(const GltfScene& scene,
+                                       const GltfAnimationSampler& sampler,
+                                       GltfAnimationPath path) -> bool
+{
+  if (sampler.input >= scene.accessors.size() ||
+      sampler.output >= scene.accessors.size()) {
+    return false;
+  }
+  const auto& input = scene.accessors[sampler.input];
+  const auto& output = scene.accessors[sampler.output];
+  if (input.type != GltfAccessorType::scalar ||
+      input.component_type != GltfComponentType::f32 || input.count == 0) {
+    return false;
+  }
+  const std::size_t values_per_key =
+      sampler.interpolation == GltfInterpolation::cubic_spline ? 3 : 1;
+
+  switch (path) {
+  case GltfAnimationPath::translation:
+  case GltfAnimationPath::scale:
+    return output.type == GltfAccessorType::vec3 &&
+           output.component_type == GltfComponentType::f32 &&
+           output.count == input.count * values_per_key;
+  case GltfAnimationPath::rotation:
+    return output.type == GltfAccessorType::vec4 &&
+           (output.component_type == GltfComponentType::f32 ||
+            output.normalized) &&
+           output.count == input.count * values_per_key;
+  case GltfAnimationPath::weights:
+    // One weight per morph target and key
+    return output.type == GltfAccessorType::scalar &&
+           (output.component_type == GltfComponentType::f32 ||
+            output.normalized) &&
+           output.count % (input.count * values_per_key) == 0;
+  }
+  return false;
+}
+
+static auto check_animations(const GltfScene& scene) -> void
+{
+  for (std::size_t i = 0; i < scene.animations.size(); ++i) {
+    const auto& animation = scene.animations[i];
+    for (const auto& channel : animation.channels) {
+      if (channel.sampler >= animation.samplers.size() ||
+          (channel.node && *channel.node >= scene.nodes.size())) {
+        throw std::runtime_error{
+            fmt::format("Animation {} has an invalid channel", i)};
+      }
+      if (!is_valid_animation_sampler(
+              scene, animation.samplers[channel.sampler], channel.path)) {
+        throw std::runtime_error{
+            fmt::format("Animation {} has an invalid sampler", i)};
+      }
+    }
+  }
+}
+
+// Decodes every compressed buffer view into a buffer of its own and points the
+// view at it
+static auto decode_meshopt_views(ThreadPool* pool, GltfTables& tables,
+                                 GltfScene& scene) -> void
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  for (const auto& meshopt : tables.meshopt_views) {
+    if (meshopt.buffer >= scene.buffers.size() ||
+        meshopt.byte_offset + meshopt.byte_length >
+            scene.buffers[meshopt.buffer].size()) {
+      throw std::runtime_error{fmt::format(
+          "Compressed data of buffer view {} is out of bounds", meshopt.view)};
+    }
+  }
+
+  std::vector<std::future<AlignedBuffer>> futures;
+  for (const auto& meshopt : tables.meshopt_views) {
+    const auto source = scene.buffers[meshopt.buffer].subspan(
+        meshopt.byte_offset, meshopt.byte_length);
+    futures.push_back(spawn(pool, [&meshopt, source] {
+      return decode_meshopt_view(meshopt, source);
+    }));
+  }
+  auto decoded = get_all(pool, futures);
+
+  auto& stats = scene.meshopt_stats;
+  stats.decode_seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  for (std::size_t i = 0; i < decoded.size(); ++i) {
+    const auto& meshopt = tables.meshopt_views[i];
+    auto& view = tables.buffer_views[meshopt.view];
+    view.buffer = scene.buffers.size();
+    view.byte_offset = 0;
+    view.byte_length = decoded[i].size();
+
+    ++stats.view_count;
+    stats.compressed_bytes += meshopt.byte_length;
+    stats.decoded_bytes += decoded[i].size();
+
+    scene.buffers.push_back(decoded[i].bytes());
+    scene.decoded_buffers.push_back(std::move(decoded[i]));
+  }
+}
+
+// Returns the bytes of an image embedded in a buffer view
+static auto embedded_image_bytes(const GltfScene& scene,
+                                 const GltfImageDesc& image, std::size_t index)
+    -> std::span<const std::byte>
 {
-  rapidjson::Document document;
+  const auto view = image.buffer_view;
+  if (!view || *view >= scene.buffer_views.size()) {
+    throw std::runtime_error{
+        fmt::format("Image {} has neither uri nor buffer view", index)};
+  }
+  const auto& info = scene.buffer_views[*view];
+  return scene.buffers[info.buffer].subspan(info.byte_offset,
+                                            info.byte_length);
+}
+
+// Returns where an image embedded in a buffer view lies in the file backing
+// the buffer, given the sources of the buffers
+static auto embedded_image_source(
+    const GltfScene& scene, const std::vector<GltfImageSource>& buffer_sources,
+    const GltfImageDesc& image) -> GltfImageSource
+{
+  const auto& info = scene.buffer_views[*image.buffer_view];
+  // Views decoded from EXT_meshopt_compression live in buffers of their own
+  if (info.buffer >= buffer_sources.size() ||
+      buffer_sources[info.buffer].file.empty()) {
+    return {};
+  }
+  const auto& buffer = buffer_sources[info.buffer];
+  return {buffer.file, buffer.byte_offset + info.byte_offset,
+          info.byte_length};
+}
+
+static auto load_scene(std::string_view file_location, ThreadPool* pool,
+                       GltfLoadOptions options) -> GltfScene
+{
+  const fs::path path{file_location};
+  const fs::path base_path = path.parent_path();
+
+  GltfScene scene;
+  std::optional<std::span<const std::byte>> glb_bin;
+  const auto parse_json = [&](auto& json) {
+    try {
+      return parse_gltf_json(json, json_parse_mode);
+    } catch (const std::runtime_error& e) {
+      throw std::runtime_error{
+          fmt::format("Failed to parse {}: {}", file_location, e.what())};
+    }
+  };
+
+  GltfTables tables;
+  if (path.extension() == ".glb") {
+    // Both chunks are served from a single mapping of the file. The JSON is
+    // parsed directly from it and the BIN chunk backs buffer 0 without copies.
+    MappedFile file{file_location};
+    const auto chunks = parse_glb(file.bytes());
+    glb_bin = chunks.bin;
+    tables = parse_json(chunks.json);
+    scene.mapped_files.push_back(std::move(file));
+  } else {
+    auto json = read_file(file_location);
+    tables = parse_json(json);
+  }
+
+  if (!tables.version.starts_with("2.")) {
+    throw std::runtime_error{
+        fmt::format("Unsupported glTF version {}", tables.version)};
+  }
+  for (const auto& extension : tables.extensions_required) {
+    if (std::ranges::find(supported_extensions, extension) ==
+        supported_extensions.end()) {
+      throw std::runtime_error{
+          fmt::format("Unsupported required extension {}", extension)};
+    }
+  }
+
+  const auto& buffers = tables.buffers;
+  const auto& images = tables.images;
+
+  // Buffers and images stored in their own files or data uris do not depend
+  // on anything else and are all fetched concurrently
+  std::vector<std::future<LoadedBuffer>> buffer_futures;
+  for (std::size_t i = 0; i < buffers.size(); ++i) {
+    buffer_futures.push_back(spawn(pool, [&, i] {
+      return load_buffer(buffers[i], i, base_path, glb_bin);
+    }));
+  }
+
+  // Each image is decoded from the first image with the same uri or
+  // embedded bytes. Textures are redirected to it afterwards.
+  std::vector<std::size_t> image_sources(images.size());
+  std::vector<std::future<GltfImage>> image_futures(images.size());
+  scene.image_sources.resize(images.size());
+  std::unordered_map<std::string_view, std::size_t> image_uris;
+  for (std::size_t i = 0; i < images.size(); ++i) {
+    image_sources[i] = i;
+    const auto& uri = images[i].uri;
+    if (!uri || !options.decode_images) {
+      continue;
+    }
+    if (const auto [it, inserted] = image_uris.try_emplace(*uri, i);
+        !inserted) {
+      image_sources[i] = it->second;
+      continue;
+    }
+    image_futures[i] = spawn(
+        pool, [&uri, &base_path, &source = scene.image_sources[i]] {
+          return load_image_from_uri(*uri, base_path, source);
+        });
+  }
+
+  // Image tasks reference the tables, so they must finish before unwinding
+  try {
+    auto loaded_buffers = get_all(pool, buffer_futures);
+    // The files backing the buffers, where embedded images are found again
+    std::vector<GltfImageSource> buffer_sources(buffers.size());
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+      auto& buffer = loaded_buffers[i];
+      scene.buffers.push_back(buffer.bytes);
+      if (glb_bin && buffer.bytes.data() == glb_bin->data()) {
+        buffer_sources[i] = {
+            path.filename().string(),
+            static_cast<std::size_t>(buffer.bytes.data() -
+                                     scene.mapped_files.front().data()),
+            buffer.bytes.size()};
+      }
+      if (buffer.file.data() != nullptr) {
+        buffer_sources[i] = {*buffers[i].uri, 0, buffer.bytes.size()};
+        scene.buffer_files.push_back(*buffers[i].uri);
+        scene.mapped_files.push_back(std::move(buffer.file));
+      }
+      if (buffer.decoded.data() != nullptr) {
+        scene.decoded_buffers.push_back(std::move(buffer.decoded));
+      }
+    }
 
-  fs::path path{file_location};
-  const std::string file_name = path.filename().string();
-  const std::string file_path = path.remove_filename().string();
+    decode_meshopt_views(pool, tables, scene);
+    scene.buffer_views = std::move(tables.buffer_views);
+    check_buffer_views(scene);
 
-  document.Parse(read_file(file_location).data());
+    // Images embedded in buffer views can only be decoded once buffers exist.
+    // Identical bytes are found by hash and confirmed by comparison.
+    std::unordered_multimap<std::uint64_t, std::size_t> embedded_images;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+      if (images[i].uri || !options.decode_images) {
+        continue;
+      }
+      const auto bytes = embedded_image_bytes(scene, images[i], i);
+      const auto hash = xxhash64(bytes);
+      const auto [first, last] = embedded_images.equal_range(hash);
+      const auto duplicate = std::find_if(first, last, [&](const auto& entry) {
+        const auto other = embedded_image_bytes(scene, images[entry.second],
+                                                entry.second);
+        return std::ranges::equal(bytes, other);
+      });
+      if (duplicate != last) {
+        image_sources[i] = duplicate->second;
+        continue;
+      }
+      embedded_images.emplace(hash, i);
+      scene.image_sources[i] =
+          embedded_image_source(scene, buffer_sources, images[i]);
+      image_futures[i] =
+          spawn(pool, [bytes] { return decode_gltf_image(bytes); });
+    }
+
+    // The remaining tables are cheap to check and overlap with image decoding
+    scene.accessors = std::move(tables.accessors);
+    check_accessors(scene);
+    scene.samplers = std::move(tables.samplers);
+    scene.textures = std::move(tables.textures);
+    check_textures(scene, images.size());
+    for (auto& texture : scene.textures) {
+      if (texture.source) {
+        texture.source = image_sources[*texture.source];
+      }
+    }
+    scene.materials = std::move(tables.materials);
+    check_materials(scene);
+    scene.meshes = std::move(tables.meshes);
+    check_meshes(scene);
+    scene.nodes = std::move(tables.nodes);
+    scene.skins = std::move(tables.skins);
+    check_nodes(scene);
+    check_skins(scene);
+    scene.animations = std::move(tables.animations);
+    check_animations(scene);
+  } catch (...) {
+    wait_all(pool, image_futures);
+    throw;
+  }
 
-  const auto& buffers = document["buffers"].GetArray();
-  for (const auto& buffer : buffers) {
-    std::vector<std::byte> data;
-    data.reserve(static_cast<std::size_t>(buffer["byteLength"].GetInt()));
-    std::string_view uri{buffer["uri"].GetString()};
+  // Images that were not decoded stay empty
+  wait_all(pool, image_futures);
+  scene.images.resize(images.size());
+  for (std::size_t i = 0; i < images.size(); ++i) {
+    if (image_futures[i].valid()) {
+      scene.images[i] = image_futures[i].get();
+    }
+  }
+  return scene;
+}
+
+[[nodiscard]] auto load_gltf_scene(std::string_view file_location,
+                                   GltfLoadOptions options) -> GltfScene
+{
+  return load_scene(file_location, nullptr, options);
+}
+
+[[nodiscard]] auto load_gltf_scene_async(std::string_view file_location,
+                                         ThreadPool& pool,
+                                         GltfLoadOptions options)
+    -> std::future<GltfScene>
+{
+  return pool.submit([file = std::string{file_location}, &pool, options] {
+    return load_scene(file, &pool, options);
+  });
+}
 
-    constexpr std::string_view data_buffer_prefix{"data"};
-    if (uri.starts_with(data_buffer_prefix)) {
-      throw std::runtime_error{"Data Uri is currently not supported"};
+auto GltfScene::accessor_stride(std::size_t accessor) const -> std::size_t
+{
+  const auto& info = accessors.at(accessor);
+  if (info.buffer_view) {
+    const auto stride = buffer_views[*info.buffer_view].byte_stride;
+    if (stride != 0) {
+      return stride;
     }
   }
+  return info.element_size();
+}
 
-  return {};
+auto GltfScene::accessor_bytes(std::size_t accessor) const
+    -> std::span<const std::byte>
+{
+  const auto& info = accessors.at(accessor);
+  if (!info.buffer_view) {
+    throw std::runtime_error{
+        fmt::format("Accessor {} has no buffer view", accessor)};
+  }
+  if (info.count == 0) {
+    return {};
+  }
+
+  const auto& view = buffer_views[*info.buffer_view];
+  const auto size =
+      (info.count - 1) * accessor_stride(accessor) + info.element_size();
+  return buffers[view.buffer].subspan(view.byte_offset + info.byte_offset,
+                                      size);
+}
+
+auto GltfScene::check_element_size(std::size_t accessor,
+                                   std::size_t size) const -> void
+{
+  const auto element_size = accessors.at(accessor).element_size();
+  if (element_size != size) {
+    throw std::runtime_error{
+        fmt::format("Accessor {} has {}-byte elements, expected {}", accessor,
+                    element_size, size)};
+  }
+}
+
+auto GltfScene::throw_not_contiguous(std::size_t accessor) -> void
+{
+  throw std::runtime_error{
+      fmt::format("Accessor {} is interleaved", accessor)};
 }
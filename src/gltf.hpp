@@ -1,11 +1,409 @@
 #ifndef GLTF_HPP
 #define GLTF_HPP
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
+#include <vector>
+
+#include "aligned_buffer.hpp"
+#include "mapped_file.hpp"
+
+class ThreadPool;
+
+enum class GltfComponentType : std::uint32_t {
+  i8 = 5120,
+  u8 = 5121,
+  i16 = 5122,
+  u16 = 5123,
+  u32 = 5125,
+  f32 = 5126,
+};
+
+enum class GltfAccessorType : std::uint8_t {
+  scalar,
+  vec2,
+  vec3,
+  vec4,
+  mat2,
+  mat3,
+  mat4,
+};
+
+enum class GltfPrimitiveMode : std::uint32_t {
+  points = 0,
+  lines = 1,
+  line_loop = 2,
+  line_strip = 3,
+  triangles = 4,
+  triangle_strip = 5,
+  triangle_fan = 6,
+};
+
+[[nodiscard]] constexpr auto component_size(GltfComponentType type) noexcept
+    -> std::size_t
+{
+  switch (type) {
+  case GltfComponentType::i8:
+  case GltfComponentType::u8:
+    return 1;
+  case GltfComponentType::i16:
+  case GltfComponentType::u16:
+    return 2;
+  case GltfComponentType::u32:
+  case GltfComponentType::f32:
+    return 4;
+  }
+  return 0;
+}
+
+[[nodiscard]] constexpr auto component_count(GltfAccessorType type) noexcept
+    -> std::size_t
+{
+  switch (type) {
+  case GltfAccessorType::scalar:
+    return 1;
+  case GltfAccessorType::vec2:
+    return 2;
+  case GltfAccessorType::vec3:
+    return 3;
+  case GltfAccessorType::vec4:
+  case GltfAccessorType::mat2:
+    return 4;
+  case GltfAccessorType::mat3:
+    return 9;
+  case GltfAccessorType::mat4:
+    return 16;
+  }
+  return 0;
+}
+
+struct GltfBufferView {
+  std::size_t buffer = 0;
+  std::size_t byte_offset = 0;
+  std::size_t byte_length = 0;
+  // 0 means the elements are tightly packed
+  std::size_t byte_stride = 0;
+};
+
+struct GltfAccessor {
+  std::optional<std::size_t> buffer_view;
+  std::size_t byte_offset = 0;
+  GltfComponentType component_type = GltfComponentType::f32;
+  GltfAccessorType type = GltfAccessorType::scalar;
+  bool normalized = false;
+  std::size_t count = 0;
+
+  [[nodiscard]] auto element_size() const noexcept -> std::size_t
+  {
+    return component_size(component_type) * component_count(type);
+  }
+};
+
+// Displacements of the vertices of a primitive, as accessor indices. Only
+// positions are morphed.
+struct GltfMorphTarget {
+  std::optional<std::size_t> position;
+};
+
+// Each attribute is an index into GltfScene::accessors
+struct GltfPrimitive {
+  std::optional<std::size_t> position;
+  std::optional<std::size_t> normal;
+  std::optional<std::size_t> texcoord0;
+  std::optional<std::size_t> color0;
+  std::optional<std::size_t> joints0;
+  std::optional<std::size_t> weights0;
+  std::optional<std::size_t> indices;
+  std::optional<std::size_t> material;
+  GltfPrimitiveMode mode = GltfPrimitiveMode::triangles;
+  std::vector<GltfMorphTarget> targets;
+};
+
+struct GltfMesh {
+  std::string name;
+  std::vector<GltfPrimitive> primitives;
+  // Default morph target weights, one per target of every primitive
+  std::vector<float> weights;
+
+  // Every primitive of a mesh has the same number of morph targets
+  [[nodiscard]] auto target_count() const noexcept -> std::size_t
+  {
+    return primitives.empty() ? 0 : primitives.front().targets.size();
+  }
+};
+
+struct GltfNode {
+  std::optional<std::size_t> mesh;
+  // Index into GltfScene::skins. Only meaningful together with a mesh.
+  std::optional<std::size_t> skin;
+  std::vector<std::size_t> children;
+
+  // The local transform is given either as TRS or as a column-major matrix
+  std::array<float, 3> translation{0.0F, 0.0F, 0.0F};
+  // Quaternion in x, y, z, w order
+  std::array<float, 4> rotation{0.0F, 0.0F, 0.0F, 1.0F};
+  std::array<float, 3> scale{1.0F, 1.0F, 1.0F};
+  std::optional<std::array<float, 16>> matrix;
+  // Overrides the morph target weights of the mesh when not empty
+  std::vector<float> weights;
+};
+
+// Joints are indices into GltfScene::nodes
+struct GltfSkin {
+  // Accessor of one MAT4 per joint. Identity matrices when unset.
+  std::optional<std::size_t> inverse_bind_matrices;
+  std::optional<std::size_t> skeleton;
+  std::vector<std::size_t> joints;
+};
+
+enum class GltfInterpolation : std::uint8_t {
+  linear,
+  step,
+  cubic_spline,
+};
+
+enum class GltfAnimationPath : std::uint8_t {
+  translation,
+  rotation,
+  scale,
+  weights,
+};
+
+// Input and output are indices into GltfScene::accessors
+struct GltfAnimationSampler {
+  std::size_t input = 0;
+  std::size_t output = 0;
+  GltfInterpolation interpolation = GltfInterpolation::linear;
+};
+
+struct GltfAnimationChannel {
+  // Index into the samplers of the animation
+  std::size_t sampler = 0;
+  // Channels without a target node are ignored
+  std::optional<std::size_t> node;
+  GltfAnimationPath path = GltfAnimationPath::translation;
+};
+
+struct GltfAnimation {
+  std::string name;
+  std::vector<GltfAnimationChannel> channels;
+  std::vector<GltfAnimationSampler> samplers;
+};
+
+enum class GltfFilter : std::uint32_t {
+  nearest = 9728,
+  linear = 9729,
+  nearest_mipmap_nearest = 9984,
+  linear_mipmap_nearest = 9985,
+  nearest_mipmap_linear = 9986,
+  linear_mipmap_linear = 9987,
+};
+
+enum class GltfWrap : std::uint32_t {
+  clamp_to_edge = 33071,
+  mirrored_repeat = 33648,
+  repeat = 10497,
+};
+
+struct GltfSampler {
+  // Unset filters leave the choice to the renderer
+  std::optional<GltfFilter> mag_filter;
+  std::optional<GltfFilter> min_filter;
+  GltfWrap wrap_s = GltfWrap::repeat;
+  GltfWrap wrap_t = GltfWrap::repeat;
+
+  friend auto operator==(const GltfSampler&, const GltfSampler&)
+      -> bool = default;
+};
+
+struct GltfTexture {
+  std::optional<std::size_t> sampler;
+  std::optional<std::size_t> source;
+};
+
+enum class GltfAlphaMode : std::uint8_t {
+  opaque,
+  mask,
+  blend,
+};
+
+// Each texture is an index into GltfScene::textures. Only TEXCOORD_0 is
+// supported, so the texCoord of texture references is not kept.
+struct GltfMaterial {
+  std::array<float, 4> base_color_factor{1.0F, 1.0F, 1.0F, 1.0F};
+  std::optional<std::size_t> base_color_texture;
+  float metallic_factor = 1.0F;
+  float roughness_factor = 1.0F;
+  std::optional<std::size_t> metallic_roughness_texture;
+  std::optional<std::size_t> normal_texture;
+  std::optional<std::size_t> occlusion_texture;
+  std::optional<std::size_t> emissive_texture;
+  std::array<float, 3> emissive_factor{0.0F, 0.0F, 0.0F};
+  GltfAlphaMode alpha_mode = GltfAlphaMode::opaque;
+  float alpha_cutoff = 0.5F;
+  bool double_sided = false;
+};
+
+struct GltfImage {
+  struct PixelsDeleter {
+    void operator()(std::byte* pixels) const noexcept;
+  };
+
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+  // Decoded RGBA8 pixels. Null for images that were not decoded, see
+  // GltfScene::images.
+  std::unique_ptr<std::byte, PixelsDeleter> pixels;
+
+  [[nodiscard]] auto size_bytes() const noexcept -> std::size_t
+  {
+    return std::size_t{width} * height * 4;
+  }
+};
+
+// Where the encoded bytes of an image are stored, so that it can be decoded
+// again without parsing the glTF
+struct GltfImageSource {
+  // Path relative to the glTF file. Empty for images only held in memory,
+  // such as data uris and buffers that are not backed by a file.
+  std::string file;
+  std::size_t byte_offset = 0;
+  std::size_t byte_length = 0;
+};
+
+// A read-only view over accessor elements that may be interleaved with other
+// data. Elements are copied out, so no alignment is required.
+template <typename T> class GltfStridedView {
+public:
+  GltfStridedView(const std::byte* data, std::size_t count,
+                  std::size_t stride) noexcept
+      : data_{data}, count_{count}, stride_{stride}
+  {
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t
+  {
+    return count_;
+  }
+
+  [[nodiscard]] auto operator[](std::size_t i) const noexcept -> T
+  {
+    T result;
+    std::memcpy(&result, data_ + i * stride_, sizeof(T));
+    return result;
+  }
+
+private:
+  const std::byte* data_ = nullptr;
+  std::size_t count_ = 0;
+  std::size_t stride_ = 0;
+};
+
+// Totals of the EXT_meshopt_compression buffer views decoded during a load
+struct GltfMeshoptStats {
+  std::size_t view_count = 0;
+  std::size_t compressed_bytes = 0;
+  std::size_t decoded_bytes = 0;
+  // Wall time of all decode tasks, which run concurrently
+  double decode_seconds = 0;
+};
 
 struct GltfScene {
+  // Keep the memory mappings and decoded data uris alive that the buffers
+  // point into
+  std::vector<MappedFile> mapped_files;
+  std::vector<AlignedBuffer> decoded_buffers;
+
+  // Uris of the external files backing buffers, relative to the glTF file
+  std::vector<std::string> buffer_files;
+
+  std::vector<std::span<const std::byte>> buffers;
+  std::vector<GltfBufferView> buffer_views;
+  std::vector<GltfAccessor> accessors;
+  std::vector<GltfMesh> meshes;
+  std::vector<GltfNode> nodes;
+  std::vector<GltfSkin> skins;
+  std::vector<GltfAnimation> animations;
+  std::vector<GltfSampler> samplers;
+  std::vector<GltfTexture> textures;
+  std::vector<GltfMaterial> materials;
+  // An image that repeats the uri or embedded data of an earlier one is not
+  // decoded. Textures refer to the earlier image instead.
+  std::vector<GltfImage> images;
+  // One per image, set for the decoded ones
+  std::vector<GltfImageSource> image_sources;
+
+  GltfMeshoptStats meshopt_stats;
+
+  // Returns the distance in bytes between two consecutive elements
+  [[nodiscard]] auto accessor_stride(std::size_t accessor) const
+      -> std::size_t;
+
+  // Returns the bytes from the first to the last element of an accessor
+  [[nodiscard]] auto accessor_bytes(std::size_t accessor) const
+      -> std::span<const std::byte>;
+
+  // Returns the elements of a tightly packed accessor directly from the
+  // underlying buffer. Throws if the accessor is interleaved or its element
+  // size does not match T.
+  template <typename T>
+  [[nodiscard]] auto accessor_span(std::size_t accessor) const
+      -> std::span<const T>
+  {
+    check_element_size(accessor, sizeof(T));
+    if (accessor_stride(accessor) != sizeof(T)) {
+      throw_not_contiguous(accessor);
+    }
+    const auto bytes = accessor_bytes(accessor);
+    return {reinterpret_cast<const T*>(bytes.data()),
+            accessors[accessor].count};
+  }
+
+  template <typename T>
+  [[nodiscard]] auto accessor_view(std::size_t accessor) const
+      -> GltfStridedView<T>
+  {
+    check_element_size(accessor, sizeof(T));
+    return {accessor_bytes(accessor).data(), accessors[accessor].count,
+            accessor_stride(accessor)};
+  }
+
+private:
+  auto check_element_size(std::size_t accessor, std::size_t size) const
+      -> void;
+  [[noreturn]] static auto throw_not_contiguous(std::size_t accessor) -> void;
 };
 
-[[nodiscard]] auto load_gltf_scene(std::string_view filename) -> GltfScene;
+struct GltfLoadOptions {
+  // Without decoding, every image is left empty. Consumers that only need
+  // geometry save the work.
+  bool decode_images = true;
+};
+
+// Decodes a PNG or JPEG image to RGBA8 pixels
+[[nodiscard]] auto decode_gltf_image(std::span<const std::byte> encoded)
+    -> GltfImage;
+
+[[nodiscard]] auto load_gltf_scene(std::string_view filename,
+                                   GltfLoadOptions options = {}) -> GltfScene;
+
+/**
+ * @brief Loads a glTF scene on a thread pool.
+ *
+ * Buffers are fetched and images decoded as independent tasks, so the load
+ * scales with the number of workers. The pool must outlive the returned future.
+ */
+[[nodiscard]] auto load_gltf_scene_async(std::string_view filename,
+                                         ThreadPool& pool,
+                                         GltfLoadOptions options = {})
+    -> std::future<GltfScene>;
 
 #endif // GLTF_HPP
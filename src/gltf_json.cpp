@@ -0,0 +1,1146 @@
+#include "gltf_json.hpp"
+
+#include <rapidjson/document.h>
+#include <rapidjson/encodedstream.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include <array>
+#include <memory>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace {
+
+auto parse_accessor_type(std::string_view type) -> GltfAccessorType
+{
+  if (type == "SCALAR") {
+    return GltfAccessorType::scalar;
+  }
+  if (type == "VEC2") {
+    return GltfAccessorType::vec2;
+  }
+  if (type == "VEC3") {
+    return GltfAccessorType::vec3;
+  }
+  if (type == "VEC4") {
+    return GltfAccessorType::vec4;
+  }
+  if (type == "MAT2") {
+    return GltfAccessorType::mat2;
+  }
+  if (type == "MAT3") {
+    return GltfAccessorType::mat3;
+  }
+  if (type == "MAT4") {
+    return GltfAccessorType::mat4;
+  }
+  throw std::runtime_error{fmt::format("Unknown accessor type {}", type)};
+}
+
+auto parse_component_type(std::uint64_t type) -> GltfComponentType
+{
+  switch (static_cast<GltfComponentType>(type)) {
+  case GltfComponentType::i8:
+  case GltfComponentType::u8:
+  case GltfComponentType::i16:
+  case GltfComponentType::u16:
+  case GltfComponentType::u32:
+  case GltfComponentType::f32:
+    return static_cast<GltfComponentType>(type);
+  }
+  throw std::runtime_error{
+      fmt::format("Unknown accessor component type {}", type)};
+}
+
+auto parse_meshopt_mode(std::string_view mode) -> GltfMeshoptMode
+{
+  if (mode == "ATTRIBUTES") {
+    return GltfMeshoptMode::attributes;
+  }
+  if (mode == "TRIANGLES") {
+    return GltfMeshoptMode::triangles;
+  }
+  if (mode == "INDICES") {
+    return GltfMeshoptMode::indices;
+  }
+  throw std::runtime_error{fmt::format("Unknown meshopt mode {}", mode)};
+}
+
+auto parse_meshopt_filter(std::string_view filter) -> GltfMeshoptFilter
+{
+  if (filter == "NONE") {
+    return GltfMeshoptFilter::none;
+  }
+  if (filter == "OCTAHEDRAL") {
+    return GltfMeshoptFilter::octahedral;
+  }
+  if (filter == "QUATERNION") {
+    return GltfMeshoptFilter::quaternion;
+  }
+  if (filter == "EXPONENTIAL") {
+    return GltfMeshoptFilter::exponential;
+  }
+  throw std::runtime_error{fmt::format("Unknown meshopt filter {}", filter)};
+}
+
+auto parse_filter(std::uint64_t filter) -> GltfFilter
+{
+  switch (static_cast<GltfFilter>(filter)) {
+  case GltfFilter::nearest:
+  case GltfFilter::linear:
+  case GltfFilter::nearest_mipmap_nearest:
+  case GltfFilter::linear_mipmap_nearest:
+  case GltfFilter::nearest_mipmap_linear:
+  case GltfFilter::linear_mipmap_linear:
+    return static_cast<GltfFilter>(filter);
+  }
+  throw std::runtime_error{fmt::format("Unknown sampler filter {}", filter)};
+}
+
+auto parse_wrap(std::uint64_t wrap) -> GltfWrap
+{
+  switch (static_cast<GltfWrap>(wrap)) {
+  case GltfWrap::clamp_to_edge:
+  case GltfWrap::mirrored_repeat:
+  case GltfWrap::repeat:
+    return static_cast<GltfWrap>(wrap);
+  }
+  throw std::runtime_error{fmt::format("Unknown sampler wrap mode {}", wrap)};
+}
+
+auto parse_alpha_mode(std::string_view mode) -> GltfAlphaMode
+{
+  if (mode == "OPAQUE") {
+    return GltfAlphaMode::opaque;
+  }
+  if (mode == "MASK") {
+    return GltfAlphaMode::mask;
+  }
+  if (mode == "BLEND") {
+    return GltfAlphaMode::blend;
+  }
+  throw std::runtime_error{fmt::format("Unknown alpha mode {}", mode)};
+}
+
+auto parse_interpolation(std::string_view interpolation) -> GltfInterpolation
+{
+  if (interpolation == "LINEAR") {
+    return GltfInterpolation::linear;
+  }
+  if (interpolation == "STEP") {
+    return GltfInterpolation::step;
+  }
+  if (interpolation == "CUBICSPLINE") {
+    return GltfInterpolation::cubic_spline;
+  }
+  throw std::runtime_error{
+      fmt::format("Unknown animation interpolation {}", interpolation)};
+}
+
+auto parse_animation_path(std::string_view path) -> GltfAnimationPath
+{
+  if (path == "translation") {
+    return GltfAnimationPath::translation;
+  }
+  if (path == "rotation") {
+    return GltfAnimationPath::rotation;
+  }
+  if (path == "scale") {
+    return GltfAnimationPath::scale;
+  }
+  if (path == "weights") {
+    return GltfAnimationPath::weights;
+  }
+  throw std::runtime_error{fmt::format("Unknown animation path {}", path)};
+}
+
+constexpr const char* meshopt_extension = "EXT_meshopt_compression";
+
+// DOM path
+
+auto get_index(const rapidjson::Value& object, const char* key)
+    -> std::optional<std::size_t>
+{
+  const auto member = object.FindMember(key);
+  if (member == object.MemberEnd()) {
+    return std::nullopt;
+  }
+  return static_cast<std::size_t>(member->value.GetUint64());
+}
+
+auto get_size(const rapidjson::Value& object, const char* key,
+              std::size_t default_value) -> std::size_t
+{
+  return get_index(object, key).value_or(default_value);
+}
+
+auto get_string(const rapidjson::Value& object, const char* key)
+    -> std::optional<std::string>
+{
+  const auto member = object.FindMember(key);
+  if (member == object.MemberEnd()) {
+    return std::nullopt;
+  }
+  return std::string{member->value.GetString(),
+                     member->value.GetStringLength()};
+}
+
+auto get_float(const rapidjson::Value& object, const char* key,
+               float default_value) -> float
+{
+  const auto member = object.FindMember(key);
+  return member == object.MemberEnd()
+             ? default_value
+             : static_cast<float>(member->value.GetDouble());
+}
+
+auto get_bool(const rapidjson::Value& object, const char* key) -> bool
+{
+  const auto member = object.FindMember(key);
+  return member != object.MemberEnd() && member->value.GetBool();
+}
+
+// Returns the texture index of a textureInfo member
+auto get_texture(const rapidjson::Value& object, const char* key)
+    -> std::optional<std::size_t>
+{
+  const auto member = object.FindMember(key);
+  if (member == object.MemberEnd()) {
+    return std::nullopt;
+  }
+  return get_index(member->value, "index");
+}
+
+auto get_array(const rapidjson::Value& object, const char* key)
+    -> rapidjson::Value::ConstArray
+{
+  static const rapidjson::Value empty_array{rapidjson::kArrayType};
+  const auto member = object.FindMember(key);
+  return member == object.MemberEnd() ? empty_array.GetArray()
+                                      : member->value.GetArray();
+}
+
+auto find_extension(const rapidjson::Value& object, const char* name)
+    -> const rapidjson::Value*
+{
+  const auto extensions = object.FindMember("extensions");
+  if (extensions == object.MemberEnd()) {
+    return nullptr;
+  }
+  const auto extension = extensions->value.FindMember(name);
+  return extension == extensions->value.MemberEnd() ? nullptr
+                                                     : &extension->value;
+}
+
+auto read_meshopt_view(const rapidjson::Value& extension, std::size_t view)
+    -> GltfMeshoptView
+{
+  GltfMeshoptView result;
+  result.view = view;
+  result.buffer = get_size(extension, "buffer", 0);
+  result.byte_offset = get_size(extension, "byteOffset", 0);
+  result.byte_length = get_size(extension, "byteLength", 0);
+  result.byte_stride = get_size(extension, "byteStride", 0);
+  result.count = get_size(extension, "count", 0);
+  result.mode = parse_meshopt_mode(extension["mode"].GetString());
+  if (const auto filter = get_string(extension, "filter"); filter) {
+    result.filter = parse_meshopt_filter(*filter);
+  }
+  return result;
+}
+
+auto read_accessor(const rapidjson::Value& accessor) -> GltfAccessor
+{
+  if (accessor.HasMember("sparse")) {
+    throw std::runtime_error{"Sparse accessors are not supported"};
+  }
+
+  GltfAccessor result;
+  result.buffer_view = get_index(accessor, "bufferView");
+  result.byte_offset = get_size(accessor, "byteOffset", 0);
+  result.component_type =
+      parse_component_type(accessor["componentType"].GetUint());
+  result.type = parse_accessor_type(accessor["type"].GetString());
+  result.count = get_size(accessor, "count", 0);
+
+  result.normalized = get_bool(accessor, "normalized");
+  return result;
+}
+
+// Reads an array of numbers of any length, empty if the member is missing
+auto read_float_list(const rapidjson::Value& object, const char* key)
+    -> std::vector<float>
+{
+  std::vector<float> result;
+  for (const auto& value : get_array(object, key)) {
+    result.push_back(static_cast<float>(value.GetDouble()));
+  }
+  return result;
+}
+
+auto read_mesh(const rapidjson::Value& mesh) -> GltfMesh
+{
+  GltfMesh result;
+  result.name = get_string(mesh, "name").value_or("");
+
+  for (const auto& primitive : mesh["primitives"].GetArray()) {
+    const auto& attributes = primitive["attributes"];
+
+    GltfPrimitive prim;
+    prim.position = get_index(attributes, "POSITION");
+    prim.normal = get_index(attributes, "NORMAL");
+    prim.texcoord0 = get_index(attributes, "TEXCOORD_0");
+    prim.color0 = get_index(attributes, "COLOR_0");
+    prim.joints0 = get_index(attributes, "JOINTS_0");
+    prim.weights0 = get_index(attributes, "WEIGHTS_0");
+    prim.indices = get_index(primitive, "indices");
+    prim.material = get_index(primitive, "material");
+    prim.mode = static_cast<GltfPrimitiveMode>(
+        get_size(primitive, "mode",
+                 static_cast<std::size_t>(GltfPrimitiveMode::triangles)));
+    for (const auto& target : get_array(primitive, "targets")) {
+      prim.targets.push_back({.position = get_index(target, "POSITION")});
+    }
+    result.primitives.push_back(prim);
+  }
+  result.weights = read_float_list(mesh, "weights");
+  return result;
+}
+
+// Reads a fixed-size array of numbers if the member exists
+template <std::size_t N>
+auto read_floats(const rapidjson::Value& object, const char* key)
+    -> std::optional<std::array<float, N>>
+{
+  const auto member = object.FindMember(key);
+  if (member == object.MemberEnd()) {
+    return std::nullopt;
+  }
+  const auto& values = member->value;
+  if (values.Size() != N) {
+    throw std::runtime_error{
+        fmt::format("Member {} must have {} elements", key, N)};
+  }
+  std::array<float, N> result{};
+  for (rapidjson::SizeType i = 0; i < N; ++i) {
+    result[i] = static_cast<float>(values[i].GetDouble());
+  }
+  return result;
+}
+
+auto read_node(const rapidjson::Value& node) -> GltfNode
+{
+  GltfNode result;
+  result.mesh = get_index(node, "mesh");
+  result.skin = get_index(node, "skin");
+  for (const auto& child : get_array(node, "children")) {
+    result.children.push_back(static_cast<std::size_t>(child.GetUint64()));
+  }
+
+  result.matrix = read_floats<16>(node, "matrix");
+  if (const auto translation = read_floats<3>(node, "translation");
+      translation) {
+    result.translation = *translation;
+  }
+  if (const auto rotation = read_floats<4>(node, "rotation"); rotation) {
+    result.rotation = *rotation;
+  }
+  if (const auto scale = read_floats<3>(node, "scale"); scale) {
+    result.scale = *scale;
+  }
+  result.weights = read_float_list(node, "weights");
+  return result;
+}
+
+auto read_skin(const rapidjson::Value& skin) -> GltfSkin
+{
+  GltfSkin result;
+  result.inverse_bind_matrices = get_index(skin, "inverseBindMatrices");
+  result.skeleton = get_index(skin, "skeleton");
+  for (const auto& joint : skin["joints"].GetArray()) {
+    result.joints.push_back(static_cast<std::size_t>(joint.GetUint64()));
+  }
+  return result;
+}
+
+auto read_animation(const rapidjson::Value& animation) -> GltfAnimation
+{
+  GltfAnimation result;
+  result.name = get_string(animation, "name").value_or("");
+  for (const auto& channel : animation["channels"].GetArray()) {
+    const auto& target = channel["target"];
+    result.channels.push_back(
+        {.sampler = get_size(channel, "sampler", 0),
+         .node = get_index(target, "node"),
+         .path = parse_animation_path(target["path"].GetString())});
+  }
+  for (const auto& sampler : animation["samplers"].GetArray()) {
+    GltfAnimationSampler result_sampler;
+    result_sampler.input = get_size(sampler, "input", 0);
+    result_sampler.output = get_size(sampler, "output", 0);
+    if (const auto interpolation = get_string(sampler, "interpolation");
+        interpolation) {
+      result_sampler.interpolation = parse_interpolation(*interpolation);
+    }
+    result.samplers.push_back(result_sampler);
+  }
+  return result;
+}
+
+auto read_sampler(const rapidjson::Value& sampler) -> GltfSampler
+{
+  GltfSampler result;
+  if (const auto filter = get_index(sampler, "magFilter"); filter) {
+    result.mag_filter = parse_filter(*filter);
+  }
+  if (const auto filter = get_index(sampler, "minFilter"); filter) {
+    result.min_filter = parse_filter(*filter);
+  }
+  result.wrap_s = parse_wrap(
+      get_size(sampler, "wrapS", static_cast<std::size_t>(result.wrap_s)));
+  result.wrap_t = parse_wrap(
+      get_size(sampler, "wrapT", static_cast<std::size_t>(result.wrap_t)));
+  return result;
+}
+
+auto read_material(const rapidjson::Value& material) -> GltfMaterial
+{
+  GltfMaterial result;
+  if (const auto pbr = material.FindMember("pbrMetallicRoughness");
+      pbr != material.MemberEnd()) {
+    const auto& values = pbr->value;
+    result.base_color_factor = read_floats<4>(values, "baseColorFactor")
+                                   .value_or(result.base_color_factor);
+    result.base_color_texture = get_texture(values, "baseColorTexture");
+    result.metallic_factor =
+        get_float(values, "metallicFactor", result.metallic_factor);
+    result.roughness_factor =
+        get_float(values, "roughnessFactor", result.roughness_factor);
+    result.metallic_roughness_texture =
+        get_texture(values, "metallicRoughnessTexture");
+  }
+
+  result.normal_texture = get_texture(material, "normalTexture");
+  result.occlusion_texture = get_texture(material, "occlusionTexture");
+  result.emissive_texture = get_texture(material, "emissiveTexture");
+  result.emissive_factor = read_floats<3>(material, "emissiveFactor")
+                               .value_or(result.emissive_factor);
+  if (const auto mode = get_string(material, "alphaMode"); mode) {
+    result.alpha_mode = parse_alpha_mode(*mode);
+  }
+  result.alpha_cutoff =
+      get_float(material, "alphaCutoff", result.alpha_cutoff);
+  result.double_sided = get_bool(material, "doubleSided");
+  return result;
+}
+
+auto read_tables(const rapidjson::Document& document) -> GltfTables
+{
+  GltfTables tables;
+  tables.version = document["asset"]["version"].GetString();
+
+  for (const auto& extension : get_array(document, "extensionsRequired")) {
+    tables.extensions_required.emplace_back(extension.GetString(),
+                                            extension.GetStringLength());
+  }
+
+  for (const auto& buffer : get_array(document, "buffers")) {
+    const auto* meshopt = find_extension(buffer, meshopt_extension);
+    tables.buffers.push_back(
+        {.uri = get_string(buffer, "uri"),
+         .byte_length = get_size(buffer, "byteLength", 0),
+         .meshopt_fallback =
+             meshopt != nullptr && get_bool(*meshopt, "fallback")});
+  }
+
+  for (const auto& view : get_array(document, "bufferViews")) {
+    GltfBufferView result;
+    result.buffer = get_size(view, "buffer", 0);
+    result.byte_offset = get_size(view, "byteOffset", 0);
+    result.byte_length = get_size(view, "byteLength", 0);
+    result.byte_stride = get_size(view, "byteStride", 0);
+    if (const auto* meshopt = find_extension(view, meshopt_extension);
+        meshopt != nullptr) {
+      tables.meshopt_views.push_back(
+          read_meshopt_view(*meshopt, tables.buffer_views.size()));
+    }
+    tables.buffer_views.push_back(result);
+  }
+
+  for (const auto& accessor : get_array(document, "accessors")) {
+    tables.accessors.push_back(read_accessor(accessor));
+  }
+
+  for (const auto& mesh : get_array(document, "meshes")) {
+    tables.meshes.push_back(read_mesh(mesh));
+  }
+
+  for (const auto& node : get_array(document, "nodes")) {
+    tables.nodes.push_back(read_node(node));
+  }
+
+  for (const auto& skin : get_array(document, "skins")) {
+    tables.skins.push_back(read_skin(skin));
+  }
+
+  for (const auto& animation : get_array(document, "animations")) {
+    tables.animations.push_back(read_animation(animation));
+  }
+
+  for (const auto& sampler : get_array(document, "samplers")) {
+    tables.samplers.push_back(read_sampler(sampler));
+  }
+
+  for (const auto& texture : get_array(document, "textures")) {
+    tables.textures.push_back({.sampler = get_index(texture, "sampler"),
+                               .source = get_index(texture, "source")});
+  }
+
+  for (const auto& material : get_array(document, "materials")) {
+    tables.materials.push_back(read_material(material));
+  }
+
+  for (const auto& image : get_array(document, "images")) {
+    tables.images.push_back({.uri = get_string(image, "uri"),
+                             .buffer_view = get_index(image, "bufferView")});
+  }
+  return tables;
+}
+
+// Backing memory for the first chunk of the DOM allocator. It grows to the
+// largest document parsed on its thread, so later documents of a similar size
+// parse without any heap allocation for values and strings.
+struct JsonArena {
+  static constexpr std::size_t initial_capacity = 64 * 1024;
+
+  std::unique_ptr<char[]> storage = std::make_unique<char[]>(initial_capacity);
+  std::size_t capacity = initial_capacity;
+};
+
+thread_local JsonArena json_arena;
+
+template <typename Parse>
+auto parse_dom(Parse&& parse) -> GltfTables
+{
+  GltfTables tables;
+  std::size_t used_capacity = 0;
+  {
+    rapidjson::MemoryPoolAllocator<> allocator{json_arena.storage.get(),
+                                               json_arena.capacity};
+    rapidjson::Document document{&allocator};
+    parse(document);
+    if (document.HasParseError()) {
+      throw std::runtime_error{fmt::format(
+          "JSON parse error at offset {}: {}", document.GetErrorOffset(),
+          rapidjson::GetParseError_En(document.GetParseError()))};
+    }
+    tables = read_tables(document);
+    used_capacity = allocator.Capacity();
+  }
+
+  // The allocator must be gone before its first chunk is replaced
+  if (used_capacity > json_arena.capacity) {
+    json_arena.storage = std::make_unique<char[]>(used_capacity);
+    json_arena.capacity = used_capacity;
+  }
+  return tables;
+}
+
+// SAX path
+
+/**
+ * @brief Fills GltfTables from the events of a rapidjson::Reader.
+ *
+ * Only the members that the DOM path reads are recorded. Everything else,
+ * including extensions and extras, is skipped without being stored.
+ */
+class GltfSaxHandler
+    : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, GltfSaxHandler> {
+public:
+  explicit GltfSaxHandler(GltfTables& tables) noexcept : tables_{tables} {}
+
+  auto Null() -> bool
+  {
+    return true;
+  }
+
+  auto Bool(bool value) -> bool
+  {
+    if (in_element("accessors") && key() == "normalized") {
+      tables_.accessors.back().normalized = value;
+    } else if (in_element("materials") && key() == "doubleSided") {
+      tables_.materials.back().double_sided = value;
+    } else if (in_extension("buffers", meshopt_extension) &&
+               key() == "fallback") {
+      tables_.buffers.back().meshopt_fallback = value;
+    }
+    return true;
+  }
+
+  auto Int(int value) -> bool
+  {
+    return Int64(value);
+  }
+
+  auto Uint(unsigned value) -> bool
+  {
+    return Uint64(value);
+  }
+
+  auto Int64(std::int64_t value) -> bool
+  {
+    if (set_float(static_cast<double>(value))) {
+      return true;
+    }
+    if (value < 0) {
+      if (in_element("buffers") || in_element("bufferViews") ||
+          in_element("accessors") || in_element("images") ||
+          in_element("nodes") || in_element("samplers") ||
+          in_element("textures") || in_element("skins") || in_skin_joints() ||
+          in_animation_member("channels") ||
+          in_animation_member("samplers") || in_channel_target() ||
+          in_extension("bufferViews", meshopt_extension) || in_primitive() ||
+          in_attributes() || in_morph_target()) {
+        throw std::runtime_error{
+            fmt::format("Negative value for {} in glTF", key())};
+      }
+      return true;
+    }
+    return Uint64(static_cast<std::uint64_t>(value));
+  }
+
+  auto Uint64(std::uint64_t value) -> bool
+  {
+    if (!set_float(static_cast<double>(value))) {
+      set_number(value);
+    }
+    return true;
+  }
+
+  // Floating point values are only read for node transforms, morph target
+  // weights and materials. Others, such as accessor bounds, are skipped.
+  auto Double(double value) -> bool
+  {
+    set_float(value);
+    return true;
+  }
+
+  auto String(const char* str, rapidjson::SizeType length, bool /*copy*/)
+      -> bool
+  {
+    set_string({str, length});
+    return true;
+  }
+
+  auto StartObject() -> bool
+  {
+    start_element();
+    stack_.push_back({.array = false, .key = {}});
+    return true;
+  }
+
+  auto Key(const char* str, rapidjson::SizeType length, bool /*copy*/) -> bool
+  {
+    stack_.back().key.assign(str, length);
+    return true;
+  }
+
+  auto EndObject(rapidjson::SizeType /*member_count*/) -> bool
+  {
+    stack_.pop_back();
+    return true;
+  }
+
+  auto StartArray() -> bool
+  {
+    component_ = 0;
+    if (in_element("nodes") && key() == "matrix") {
+      tables_.nodes.back().matrix.emplace();
+    }
+    stack_.push_back({.array = true, .key = {}});
+    return true;
+  }
+
+  auto EndArray(rapidjson::SizeType /*element_count*/) -> bool
+  {
+    stack_.pop_back();
+    return true;
+  }
+
+private:
+  struct Frame {
+    bool array = false;
+    // The member currently being read when the frame is an object
+    std::string key;
+  };
+
+  GltfTables& tables_;
+  std::vector<Frame> stack_;
+  // The number of values read so far from the innermost array
+  std::size_t component_ = 0;
+
+  [[nodiscard]] auto key() const -> std::string_view
+  {
+    return stack_.back().key;
+  }
+
+  [[nodiscard]] auto is_object(std::size_t depth, std::string_view key) const
+      -> bool
+  {
+    return !stack_[depth].array && stack_[depth].key == key;
+  }
+
+  // Whether values currently land in an element of a top-level array
+  [[nodiscard]] auto in_element(std::string_view section) const -> bool
+  {
+    return stack_.size() == 3 && is_object(0, section) && stack_[1].array &&
+           !stack_[2].array;
+  }
+
+  [[nodiscard]] auto is_extension(std::string_view section,
+                                  std::string_view extension) const -> bool
+  {
+    return stack_.size() >= 4 && is_object(0, section) && stack_[1].array &&
+           is_object(2, "extensions") && is_object(3, extension);
+  }
+
+  // Whether values currently land in an extension of a table element
+  [[nodiscard]] auto in_extension(std::string_view section,
+                                  std::string_view extension) const -> bool
+  {
+    return stack_.size() == 5 && is_extension(section, extension) &&
+           !stack_[4].array;
+  }
+
+  // Whether values currently land in an array member of a node
+  [[nodiscard]] auto in_node_array() const -> bool
+  {
+    return stack_.size() == 4 && is_object(0, "nodes") && stack_[1].array &&
+           !stack_[2].array && stack_[3].array;
+  }
+
+  [[nodiscard]] auto in_skin_joints() const -> bool
+  {
+    return stack_.size() == 4 && is_object(0, "skins") && stack_[1].array &&
+           is_object(2, "joints") && stack_[3].array;
+  }
+
+  // Whether values currently land in a channel or sampler of an animation
+  [[nodiscard]] auto in_animation_member(std::string_view member) const
+      -> bool
+  {
+    return stack_.size() == 5 && is_object(0, "animations") &&
+           stack_[1].array && is_object(2, member) && stack_[3].array &&
+           !stack_[4].array;
+  }
+
+  [[nodiscard]] auto in_channel_target() const -> bool
+  {
+    return stack_.size() == 6 && is_object(0, "animations") &&
+           stack_[1].array && is_object(2, "channels") && stack_[3].array &&
+           is_object(4, "target") && !stack_[5].array;
+  }
+
+  [[nodiscard]] auto in_primitive() const -> bool
+  {
+    return stack_.size() == 5 && is_object(0, "meshes") && stack_[1].array &&
+           is_object(2, "primitives") && stack_[3].array && !stack_[4].array;
+  }
+
+  [[nodiscard]] auto in_attributes() const -> bool
+  {
+    return stack_.size() == 6 && is_object(0, "meshes") && stack_[1].array &&
+           is_object(2, "primitives") && stack_[3].array &&
+           is_object(4, "attributes") && !stack_[5].array;
+  }
+
+  [[nodiscard]] auto in_morph_target() const -> bool
+  {
+    return stack_.size() == 7 && is_object(0, "meshes") && stack_[1].array &&
+           is_object(2, "primitives") && stack_[3].array &&
+           is_object(4, "targets") && stack_[5].array && !stack_[6].array;
+  }
+
+  // Whether values currently land in the weights of a mesh
+  [[nodiscard]] auto in_mesh_weights() const -> bool
+  {
+    return stack_.size() == 4 && is_object(0, "meshes") && stack_[1].array &&
+           is_object(2, "weights") && stack_[3].array;
+  }
+
+  // Appends a new table entry when an object starts an element of a table
+  auto start_element() -> void
+  {
+    if (stack_.size() == 2 && !stack_[0].array && stack_[1].array) {
+      const std::string_view section = stack_[0].key;
+      if (section == "buffers") {
+        tables_.buffers.emplace_back();
+      } else if (section == "bufferViews") {
+        tables_.buffer_views.emplace_back();
+      } else if (section == "accessors") {
+        tables_.accessors.emplace_back();
+      } else if (section == "meshes") {
+        tables_.meshes.emplace_back();
+      } else if (section == "nodes") {
+        tables_.nodes.emplace_back();
+      } else if (section == "skins") {
+        tables_.skins.emplace_back();
+      } else if (section == "animations") {
+        tables_.animations.emplace_back();
+      } else if (section == "samplers") {
+        tables_.samplers.emplace_back();
+      } else if (section == "textures") {
+        tables_.textures.emplace_back();
+      } else if (section == "materials") {
+        tables_.materials.emplace_back();
+      } else if (section == "images") {
+        tables_.images.emplace_back();
+      }
+    } else if (stack_.size() == 4 && is_object(0, "meshes") &&
+               stack_[1].array && is_object(2, "primitives") &&
+               stack_[3].array) {
+      tables_.meshes.back().primitives.emplace_back();
+    } else if (stack_.size() == 6 && is_object(0, "meshes") &&
+               stack_[1].array && is_object(2, "primitives") &&
+               stack_[3].array && is_object(4, "targets") && stack_[5].array) {
+      tables_.meshes.back().primitives.back().targets.emplace_back();
+    } else if (stack_.size() == 4 && is_object(0, "animations") &&
+               stack_[1].array && stack_[3].array) {
+      if (is_object(2, "channels")) {
+        tables_.animations.back().channels.emplace_back();
+      } else if (is_object(2, "samplers")) {
+        tables_.animations.back().samplers.emplace_back();
+      }
+    } else if (stack_.size() == 4 &&
+               is_extension("bufferViews", meshopt_extension)) {
+      tables_.meshopt_views.push_back(
+          {.view = tables_.buffer_views.size() - 1});
+    } else if (in_element("accessors") && key() == "sparse") {
+      throw std::runtime_error{"Sparse accessors are not supported"};
+    }
+  }
+
+  auto set_number(std::uint64_t value) -> void
+  {
+    const auto n = static_cast<std::size_t>(value);
+    const auto field = key();
+
+    if (in_element("bufferViews")) {
+      auto& view = tables_.buffer_views.back();
+      if (field == "buffer") {
+        view.buffer = n;
+      } else if (field == "byteOffset") {
+        view.byte_offset = n;
+      } else if (field == "byteLength") {
+        view.byte_length = n;
+      } else if (field == "byteStride") {
+        view.byte_stride = n;
+      }
+    } else if (in_element("accessors")) {
+      auto& accessor = tables_.accessors.back();
+      if (field == "bufferView") {
+        accessor.buffer_view = n;
+      } else if (field == "byteOffset") {
+        accessor.byte_offset = n;
+      } else if (field == "componentType") {
+        accessor.component_type = parse_component_type(value);
+      } else if (field == "count") {
+        accessor.count = n;
+      }
+    } else if (in_extension("bufferViews", meshopt_extension)) {
+      auto& meshopt = tables_.meshopt_views.back();
+      if (field == "buffer") {
+        meshopt.buffer = n;
+      } else if (field == "byteOffset") {
+        meshopt.byte_offset = n;
+      } else if (field == "byteLength") {
+        meshopt.byte_length = n;
+      } else if (field == "byteStride") {
+        meshopt.byte_stride = n;
+      } else if (field == "count") {
+        meshopt.count = n;
+      }
+    } else if (in_attributes()) {
+      auto& primitive = tables_.meshes.back().primitives.back();
+      if (field == "POSITION") {
+        primitive.position = n;
+      } else if (field == "NORMAL") {
+        primitive.normal = n;
+      } else if (field == "TEXCOORD_0") {
+        primitive.texcoord0 = n;
+      } else if (field == "COLOR_0") {
+        primitive.color0 = n;
+      } else if (field == "JOINTS_0") {
+        primitive.joints0 = n;
+      } else if (field == "WEIGHTS_0") {
+        primitive.weights0 = n;
+      }
+    } else if (in_morph_target()) {
+      if (field == "POSITION") {
+        tables_.meshes.back().primitives.back().targets.back().position = n;
+      }
+    } else if (in_primitive()) {
+      auto& primitive = tables_.meshes.back().primitives.back();
+      if (field == "indices") {
+        primitive.indices = n;
+      } else if (field == "material") {
+        primitive.material = n;
+      } else if (field == "mode") {
+        primitive.mode = static_cast<GltfPrimitiveMode>(n);
+      }
+    } else if (in_element("buffers")) {
+      if (field == "byteLength") {
+        tables_.buffers.back().byte_length = n;
+      }
+    } else if (in_element("nodes")) {
+      if (field == "mesh") {
+        tables_.nodes.back().mesh = n;
+      } else if (field == "skin") {
+        tables_.nodes.back().skin = n;
+      }
+    } else if (in_element("skins")) {
+      if (field == "inverseBindMatrices") {
+        tables_.skins.back().inverse_bind_matrices = n;
+      } else if (field == "skeleton") {
+        tables_.skins.back().skeleton = n;
+      }
+    } else if (in_skin_joints()) {
+      tables_.skins.back().joints.push_back(n);
+    } else if (in_animation_member("channels")) {
+      if (field == "sampler") {
+        tables_.animations.back().channels.back().sampler = n;
+      }
+    } else if (in_channel_target()) {
+      if (field == "node") {
+        tables_.animations.back().channels.back().node = n;
+      }
+    } else if (in_animation_member("samplers")) {
+      auto& sampler = tables_.animations.back().samplers.back();
+      if (field == "input") {
+        sampler.input = n;
+      } else if (field == "output") {
+        sampler.output = n;
+      }
+    } else if (in_element("images")) {
+      if (field == "bufferView") {
+        tables_.images.back().buffer_view = n;
+      }
+    } else if (in_element("textures")) {
+      if (field == "sampler") {
+        tables_.textures.back().sampler = n;
+      } else if (field == "source") {
+        tables_.textures.back().source = n;
+      }
+    } else if (in_element("samplers")) {
+      auto& sampler = tables_.samplers.back();
+      if (field == "magFilter") {
+        sampler.mag_filter = parse_filter(value);
+      } else if (field == "minFilter") {
+        sampler.min_filter = parse_filter(value);
+      } else if (field == "wrapS") {
+        sampler.wrap_s = parse_wrap(value);
+      } else if (field == "wrapT") {
+        sampler.wrap_t = parse_wrap(value);
+      }
+    }
+  }
+
+  // Stores the next value of the innermost array into components
+  template <std::size_t N>
+  auto set_component(std::array<float, N>& components, double value) -> void
+  {
+    const auto i = component_++;
+    if (i >= N) {
+      throw std::runtime_error{fmt::format("Member {} must have {} elements",
+                                           stack_[stack_.size() - 2].key, N)};
+    }
+    components[i] = static_cast<float>(value);
+  }
+
+  // Handles the numbers that are read as floating point, whatever their JSON
+  // representation. Returns false for all other numbers.
+  auto set_float(double value) -> bool
+  {
+    if (in_node_array()) {
+      set_node_component(value);
+      return true;
+    }
+    if (in_mesh_weights()) {
+      tables_.meshes.back().weights.push_back(static_cast<float>(value));
+      return true;
+    }
+    if (stack_.size() >= 3 && is_object(0, "materials") && stack_[1].array &&
+        !stack_[2].array) {
+      set_material_number(value);
+      return true;
+    }
+    return false;
+  }
+
+  auto set_node_component(double value) -> void
+  {
+    auto& node = tables_.nodes.back();
+    const std::string_view field = stack_[2].key;
+
+    if (field == "children") {
+      if (value < 0) {
+        throw std::runtime_error{"Negative node child index in glTF"};
+      }
+      node.children.push_back(static_cast<std::size_t>(value));
+    } else if (field == "translation") {
+      set_component(node.translation, value);
+    } else if (field == "rotation") {
+      set_component(node.rotation, value);
+    } else if (field == "scale") {
+      set_component(node.scale, value);
+    } else if (field == "matrix") {
+      set_component(*node.matrix, value);
+    } else if (field == "weights") {
+      node.weights.push_back(static_cast<float>(value));
+    }
+  }
+
+  // Handles every number inside a material. Members of pbrMetallicRoughness
+  // are treated like those of the material itself.
+  auto set_material_number(double value) -> void
+  {
+    auto& material = tables_.materials.back();
+    std::size_t depth = 2;
+    if (stack_[2].key == "pbrMetallicRoughness" && stack_.size() > 3 &&
+        !stack_[3].array) {
+      depth = 3;
+    }
+    const std::string_view member = stack_[depth].key;
+
+    if (stack_.size() == depth + 1) {
+      if (member == "metallicFactor") {
+        material.metallic_factor = static_cast<float>(value);
+      } else if (member == "roughnessFactor") {
+        material.roughness_factor = static_cast<float>(value);
+      } else if (member == "alphaCutoff") {
+        material.alpha_cutoff = static_cast<float>(value);
+      }
+    } else if (stack_.size() == depth + 2 && stack_[depth + 1].array) {
+      if (member == "baseColorFactor") {
+        set_component(material.base_color_factor, value);
+      } else if (member == "emissiveFactor") {
+        set_component(material.emissive_factor, value);
+      }
+    } else if (stack_.size() == depth + 2 && key() == "index") {
+      if (value < 0) {
+        throw std::runtime_error{"Negative texture index in glTF"};
+      }
+      const auto index = static_cast<std::size_t>(value);
+      if (member == "baseColorTexture") {
+        material.base_color_texture = index;
+      } else if (member == "metallicRoughnessTexture") {
+        material.metallic_roughness_texture = index;
+      } else if (member == "normalTexture") {
+        material.normal_texture = index;
+      } else if (member == "occlusionTexture") {
+        material.occlusion_texture = index;
+      } else if (member == "emissiveTexture") {
+        material.emissive_texture = index;
+      }
+    }
+  }
+
+  auto set_string(std::string_view value) -> void
+  {
+    const auto field = key();
+
+    if (in_element("accessors")) {
+      if (field == "type") {
+        tables_.accessors.back().type = parse_accessor_type(value);
+      }
+    } else if (in_extension("bufferViews", meshopt_extension)) {
+      if (field == "mode") {
+        tables_.meshopt_views.back().mode = parse_meshopt_mode(value);
+      } else if (field == "filter") {
+        tables_.meshopt_views.back().filter = parse_meshopt_filter(value);
+      }
+    } else if (in_element("buffers")) {
+      if (field == "uri") {
+        tables_.buffers.back().uri = std::string{value};
+      }
+    } else if (in_element("images")) {
+      if (field == "uri") {
+        tables_.images.back().uri = std::string{value};
+      }
+    } else if (in_element("meshes")) {
+      if (field == "name") {
+        tables_.meshes.back().name = value;
+      }
+    } else if (in_element("animations")) {
+      if (field == "name") {
+        tables_.animations.back().name = value;
+      }
+    } else if (in_channel_target()) {
+      if (field == "path") {
+        tables_.animations.back().channels.back().path =
+            parse_animation_path(value);
+      }
+    } else if (in_animation_member("samplers")) {
+      if (field == "interpolation") {
+        tables_.animations.back().samplers.back().interpolation =
+            parse_interpolation(value);
+      }
+    } else if (in_element("materials")) {
+      if (field == "alphaMode") {
+        tables_.materials.back().alpha_mode = parse_alpha_mode(value);
+      }
+    } else if (stack_.size() == 2 && is_object(0, "asset") &&
+               !stack_[1].array && field == "version") {
+      tables_.version = value;
+    } else if (stack_.size() == 2 && is_object(0, "extensionsRequired") &&
+               stack_[1].array) {
+      tables_.extensions_required.emplace_back(value);
+    }
+  }
+};
+
+auto parse_sax(std::string_view json) -> GltfTables
+{
+  GltfTables tables;
+  GltfSaxHandler handler{tables};
+
+  rapidjson::MemoryStream memory{json.data(), json.size()};
+  rapidjson::EncodedInputStream<rapidjson::UTF8<>, rapidjson::MemoryStream>
+      stream{memory};
+  rapidjson::Reader reader;
+  const auto result = reader.Parse(stream, handler);
+  if (result.IsError()) {
+    throw std::runtime_error{
+        fmt::format("JSON parse error at offset {}: {}", result.Offset(),
+                    rapidjson::GetParseError_En(result.Code()))};
+  }
+  return tables;
+}
+
+} // namespace
+
+[[nodiscard]] auto parse_gltf_json(std::string_view json, GltfParseMode mode)
+    -> GltfTables
+{
+  if (mode == GltfParseMode::sax) {
+    return parse_sax(json);
+  }
+  return parse_dom([json](rapidjson::Document& document) {
+    document.Parse(json.data(), json.size());
+  });
+}
+
+[[nodiscard]] auto parse_gltf_json(std::string& json, GltfParseMode mode)
+    -> GltfTables
+{
+  if (mode != GltfParseMode::insitu) {
+    return parse_gltf_json(std::string_view{json}, mode);
+  }
+  // Strings in the DOM point into json, which has to outlive read_tables()
+  return parse_dom([&json](rapidjson::Document& document) {
+    document.ParseInsitu(json.data());
+  });
+}
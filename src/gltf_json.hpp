@@ -0,0 +1,98 @@
+#ifndef GLTF_JSON_HPP
+#define GLTF_JSON_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gltf.hpp"
+
+enum class GltfParseMode : std::uint8_t {
+  // Builds a rapidjson DOM that owns copies of all strings
+  dom,
+  // Builds a DOM whose strings point into the modified source text
+  insitu,
+  // Streams the text through a SAX handler without building a DOM
+  sax,
+};
+
+struct GltfBufferDesc {
+  std::optional<std::string> uri;
+  std::size_t byte_length = 0;
+  // Only referenced by EXT_meshopt_compression views, which are decoded
+  // from another buffer, so it does not need to be loaded
+  bool meshopt_fallback = false;
+};
+
+enum class GltfMeshoptMode : std::uint8_t {
+  attributes,
+  triangles,
+  indices,
+};
+
+enum class GltfMeshoptFilter : std::uint8_t {
+  none,
+  octahedral,
+  quaternion,
+  exponential,
+};
+
+// The EXT_meshopt_compression extension of a buffer view
+struct GltfMeshoptView {
+  // The buffer view that holds the decoded data
+  std::size_t view = 0;
+  std::size_t buffer = 0;
+  std::size_t byte_offset = 0;
+  std::size_t byte_length = 0;
+  std::size_t byte_stride = 0;
+  std::size_t count = 0;
+  GltfMeshoptMode mode = GltfMeshoptMode::attributes;
+  GltfMeshoptFilter filter = GltfMeshoptFilter::none;
+};
+
+struct GltfImageDesc {
+  std::optional<std::string> uri;
+  std::optional<std::size_t> buffer_view;
+};
+
+/**
+ * @brief The tables of a glTF document as written in the JSON.
+ *
+ * Indices between tables are not validated yet, since buffers must be loaded
+ * before buffer views and accessors can be checked against them.
+ */
+struct GltfTables {
+  std::string version;
+  std::vector<std::string> extensions_required;
+  std::vector<GltfBufferDesc> buffers;
+  std::vector<GltfBufferView> buffer_views;
+  std::vector<GltfMeshoptView> meshopt_views;
+  std::vector<GltfAccessor> accessors;
+  std::vector<GltfMesh> meshes;
+  std::vector<GltfNode> nodes;
+  std::vector<GltfSkin> skins;
+  std::vector<GltfAnimation> animations;
+  std::vector<GltfSampler> samplers;
+  std::vector<GltfTexture> textures;
+  std::vector<GltfMaterial> materials;
+  std::vector<GltfImageDesc> images;
+};
+
+/**
+ * @brief Parses the JSON text of a glTF document.
+ *
+ * GltfParseMode::insitu writes into json, so it requires a mutable buffer and
+ * falls back to a DOM parse for read-only text. The DOM modes allocate from a
+ * per-thread arena that is reused between documents.
+ *
+ * @throw std::runtime_error on malformed JSON or unsupported features
+ */
+[[nodiscard]] auto parse_gltf_json(std::string_view json, GltfParseMode mode)
+    -> GltfTables;
+[[nodiscard]] auto parse_gltf_json(std::string& json, GltfParseMode mode)
+    -> GltfTables;
+
+#endif // GLTF_JSON_HPP
@@ -4,13 +4,16 @@
 namespace vulkan {
 
 [[nodiscard]] auto create_graphics_pipeline_layout(
-    vk::Device device, vk::DescriptorSetLayout descriptor_set_layout) noexcept
+    vk::Device device, vk::DescriptorSetLayout descriptor_set_layout,
+    std::span<const vk::PushConstantRange> push_constant_ranges) noexcept
     -> vk::UniquePipelineLayout
 {
   vk::PipelineLayoutCreateInfo pipeline_layout_create_info;
   pipeline_layout_create_info.setSetLayoutCount(1)
       .setPSetLayouts(&descriptor_set_layout)
-      .setPushConstantRangeCount(0);
+      .setPushConstantRangeCount(
+          static_cast<std::uint32_t>(push_constant_ranges.size()))
+      .setPPushConstantRanges(push_constant_ranges.data());
 
   return device.createPipelineLayoutUnique(pipeline_layout_create_info);
 }
@@ -86,7 +89,8 @@ namespace vulkan {
   vk::PipelineShaderStageCreateInfo frag_shader_stage_info;
   frag_shader_stage_info.setStage(vk::ShaderStageFlagBits::eFragment)
       .setModule(shaders.fragment)
-      .setPName("main");
+      .setPName("main")
+      .setPSpecializationInfo(shaders.fragment_specialization);
   shader_stages.push_back(frag_shader_stage_info);
 
   if (shaders.tess) {
@@ -2,6 +2,7 @@
 #define GRAPHICS_PIPELINE_HPP
 
 #include <optional>
+#include <span>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
@@ -21,10 +22,13 @@ struct GraphicsPipelineShaders {
   vk::ShaderModule vertex;
   vk::ShaderModule fragment;
   std::optional<TessShaders> tess;
+  // Specialization constants of the fragment shader, if any
+  const vk::SpecializationInfo* fragment_specialization = nullptr;
 };
 
 [[nodiscard]] auto create_graphics_pipeline_layout(
-    vk::Device device, vk::DescriptorSetLayout descriptor_set_layout) noexcept
+    vk::Device device, vk::DescriptorSetLayout descriptor_set_layout,
+    std::span<const vk::PushConstantRange> push_constant_ranges = {}) noexcept
     -> vk::UniquePipelineLayout;
 
 [[nodiscard]] auto create_graphics_pipeline(
@@ -0,0 +1,99 @@
+#include "hash.hpp"
+
+#include <bit>
+#include <cstring>
+
+namespace {
+
+constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+[[nodiscard]] auto read64(const std::byte* p) noexcept -> std::uint64_t
+{
+  std::uint64_t result;
+  std::memcpy(&result, p, sizeof(result));
+  return result;
+}
+
+[[nodiscard]] auto read32(const std::byte* p) noexcept -> std::uint32_t
+{
+  std::uint32_t result;
+  std::memcpy(&result, p, sizeof(result));
+  return result;
+}
+
+[[nodiscard]] auto round(std::uint64_t acc, std::uint64_t input) noexcept
+    -> std::uint64_t
+{
+  acc += input * prime2;
+  acc = std::rotl(acc, 31);
+  return acc * prime1;
+}
+
+[[nodiscard]] auto merge_round(std::uint64_t acc, std::uint64_t value) noexcept
+    -> std::uint64_t
+{
+  acc ^= round(0, value);
+  return acc * prime1 + prime4;
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto xxhash64(std::span<const std::byte> data,
+                            std::uint64_t seed) noexcept -> std::uint64_t
+{
+  const std::byte* p = data.data();
+  const std::byte* const end = p + data.size();
+  std::uint64_t hash;
+
+  if (data.size() >= 32) {
+    std::uint64_t v1 = seed + prime1 + prime2;
+    std::uint64_t v2 = seed + prime2;
+    std::uint64_t v3 = seed;
+    std::uint64_t v4 = seed - prime1;
+
+    const std::byte* const limit = end - 32;
+    do {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) +
+           std::rotl(v4, 18);
+    hash = merge_round(hash, v1);
+    hash = merge_round(hash, v2);
+    hash = merge_round(hash, v3);
+    hash = merge_round(hash, v4);
+  } else {
+    hash = seed + prime5;
+  }
+
+  hash += data.size();
+
+  for (; p + 8 <= end; p += 8) {
+    hash ^= round(0, read64(p));
+    hash = std::rotl(hash, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    hash ^= read32(p) * prime1;
+    hash = std::rotl(hash, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= std::to_integer<std::uint64_t>(*p) * prime5;
+    hash = std::rotl(hash, 11) * prime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
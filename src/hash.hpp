@@ -0,0 +1,12 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// The 64-bit xxHash of data. Fast enough to fingerprint whole asset files.
+[[nodiscard]] auto xxhash64(std::span<const std::byte> data,
+                            std::uint64_t seed = 0) noexcept -> std::uint64_t;
+
+#endif // HASH_HPP
@@ -0,0 +1,225 @@
+#include "image_state.hpp"
+
+#include <fmt/format.h>
+
+#include <cassert>
+#include <stdexcept>
+
+namespace vulkan {
+
+namespace {
+
+const vk::AccessFlags write_access =
+    vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite;
+
+} // anonymous namespace
+
+auto ImageStateTracker::add(vk::Image image, vk::ImageAspectFlags aspect,
+                            std::uint32_t mip_levels,
+                            std::uint32_t array_layers) -> void
+{
+  images_[static_cast<VkImage>(image)] = {
+      aspect, mip_levels, array_layers,
+      std::vector<Subresource>(std::size_t{mip_levels} * array_layers)};
+}
+
+auto ImageStateTracker::remove(vk::Image image) -> void
+{
+  images_.erase(static_cast<VkImage>(image));
+}
+
+auto ImageStateTracker::use(vk::Image image, const ImageAccess& access)
+    -> void
+{
+  use(image,
+      {find(image).aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+       VK_REMAINING_ARRAY_LAYERS},
+      access);
+}
+
+auto ImageStateTracker::use(vk::Image image,
+                            const vk::ImageSubresourceRange& range,
+                            const ImageAccess& access) -> void
+{
+  queue_barriers(image, range, access, Ownership::kept,
+                 VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+}
+
+auto ImageStateTracker::release(vk::Image image, const ImageAccess& access,
+                                std::uint32_t src_family,
+                                std::uint32_t dst_family) -> void
+{
+  queue_barriers(image,
+                 {find(image).aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                  VK_REMAINING_ARRAY_LAYERS},
+                 access, Ownership::released, src_family, dst_family);
+}
+
+auto ImageStateTracker::acquire(vk::Image image, const ImageAccess& access,
+                                std::uint32_t src_family,
+                                std::uint32_t dst_family) -> void
+{
+  queue_barriers(image,
+                 {find(image).aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                  VK_REMAINING_ARRAY_LAYERS},
+                 access, Ownership::acquired, src_family, dst_family);
+}
+
+auto ImageStateTracker::find(vk::Image image) -> Image&
+{
+  const auto found = images_.find(static_cast<VkImage>(image));
+  if (found == images_.end()) {
+    throw std::runtime_error{"image state is not tracked"};
+  }
+  return found->second;
+}
+
+auto ImageStateTracker::queue_barriers(vk::Image image,
+                                       const vk::ImageSubresourceRange& range,
+                                       const ImageAccess& access,
+                                       Ownership ownership,
+                                       std::uint32_t src_family,
+                                       std::uint32_t dst_family) -> void
+{
+  auto& tracked = find(image);
+  const auto level_count = range.levelCount == VK_REMAINING_MIP_LEVELS
+                               ? tracked.mip_levels - range.baseMipLevel
+                               : range.levelCount;
+  const auto layer_count = range.layerCount == VK_REMAINING_ARRAY_LAYERS
+                               ? tracked.array_layers - range.baseArrayLayer
+                               : range.layerCount;
+  if (range.baseMipLevel + level_count > tracked.mip_levels ||
+      range.baseArrayLayer + layer_count > tracked.array_layers) {
+    throw std::runtime_error{fmt::format(
+        "subresources beyond the {} mip levels and {} layers of the image",
+        tracked.mip_levels, tracked.array_layers)};
+  }
+
+  for (auto layer = range.baseArrayLayer;
+       layer < range.baseArrayLayer + layer_count; ++layer) {
+    // The barrier of the previous mip level, if it can be extended
+    vk::ImageMemoryBarrier* run = nullptr;
+    for (auto level = range.baseMipLevel;
+         level < range.baseMipLevel + level_count; ++level) {
+      auto& state =
+          tracked.subresources[std::size_t{layer} * tracked.mip_levels +
+                               level];
+      assert(state.queued_for != flush_count_);
+
+      const auto transition = state.layout != access.layout;
+      auto src_access = state.access & write_access;
+      auto src_stages = state.stages;
+      auto dst_access = access.access;
+      auto dst_stages = access.stages;
+      if (ownership == Ownership::kept && !transition && !src_access &&
+          !(access.access & write_access)) {
+        // Reads after reads in the same layout are not ordered
+        state.stages |= access.stages;
+        state.access |= access.access;
+        run = nullptr;
+        continue;
+      }
+      if (ownership == Ownership::released) {
+        // The acquire makes the writes visible on the other family
+        dst_access = {};
+        dst_stages = {};
+      } else if (ownership == Ownership::acquired) {
+        // The semaphore already waits for the release
+        src_access = {};
+        src_stages = {};
+      } else if (!transition && !src_access) {
+        // Writes after reads only have to wait for the reads to execute
+        dst_access = {};
+      }
+
+      if (run != nullptr && run->oldLayout == state.layout &&
+          run->srcAccessMask == src_access &&
+          run->dstAccessMask == dst_access) {
+        ++run->subresourceRange.levelCount;
+      } else {
+        vk::ImageMemoryBarrier barrier;
+        barrier.setSrcAccessMask(src_access)
+            .setDstAccessMask(dst_access)
+            .setOldLayout(state.layout)
+            .setNewLayout(access.layout)
+            .setSrcQueueFamilyIndex(src_family)
+            .setDstQueueFamilyIndex(dst_family)
+            .setImage(image)
+            .setSubresourceRange({range.aspectMask, level, 1, layer, 1});
+        barriers_.push_back(barrier);
+        run = &barriers_.back();
+      }
+      src_stages_ |= src_stages;
+      dst_stages_ |= dst_stages;
+
+      if (ownership == Ownership::released) {
+        state = {access.layout, {}, {}, flush_count_};
+      } else {
+        state = {access.layout, access.stages, access.access, flush_count_};
+      }
+    }
+  }
+}
+
+auto ImageStateTracker::add_memory_barrier(vk::PipelineStageFlags src_stages,
+                                           vk::AccessFlags src_access,
+                                           vk::PipelineStageFlags dst_stages,
+                                           vk::AccessFlags dst_access) -> void
+{
+  memory_barrier_.srcAccessMask |= src_access;
+  memory_barrier_.dstAccessMask |= dst_access;
+  src_stages_ |= src_stages;
+  dst_stages_ |= dst_stages;
+}
+
+auto ImageStateTracker::add_buffer_barrier(
+    const vk::BufferMemoryBarrier& barrier, vk::PipelineStageFlags src_stages,
+    vk::PipelineStageFlags dst_stages) -> void
+{
+  buffer_barriers_.push_back(barrier);
+  src_stages_ |= src_stages;
+  dst_stages_ |= dst_stages;
+}
+
+auto ImageStateTracker::flush(vk::CommandBuffer command_buffer) -> void
+{
+  const auto has_memory_barrier = memory_barrier_.srcAccessMask ||
+                                  memory_barrier_.dstAccessMask;
+  if (barriers_.empty() && buffer_barriers_.empty() && !has_memory_barrier &&
+      !src_stages_) {
+    return;
+  }
+
+  // Subresources nothing accessed yet, releases and acquires leave some of
+  // the stages empty
+  command_buffer.pipelineBarrier(
+      src_stages_ ? src_stages_ : vk::PipelineStageFlagBits::eTopOfPipe,
+      dst_stages_ ? dst_stages_ : vk::PipelineStageFlagBits::eBottomOfPipe,
+      {}, has_memory_barrier ? 1 : 0, &memory_barrier_,
+      static_cast<std::uint32_t>(buffer_barriers_.size()),
+      buffer_barriers_.data(), static_cast<std::uint32_t>(barriers_.size()),
+      barriers_.data());
+
+  barriers_.clear();
+  buffer_barriers_.clear();
+  memory_barrier_ = vk::MemoryBarrier{};
+  src_stages_ = {};
+  dst_stages_ = {};
+  ++flush_count_;
+}
+
+auto ImageStateTracker::layout(vk::Image image, std::uint32_t mip_level,
+                               std::uint32_t array_layer) const
+    -> vk::ImageLayout
+{
+  const auto& tracked = images_.at(static_cast<VkImage>(image));
+  return tracked
+      .subresources[std::size_t{array_layer} * tracked.mip_levels + mip_level]
+      .layout;
+}
+
+} // namespace vulkan
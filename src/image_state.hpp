@@ -0,0 +1,125 @@
+#ifndef IMAGE_STATE_HPP
+#define IMAGE_STATE_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vulkan {
+
+// How the next commands access an image
+struct ImageAccess {
+  vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+  vk::PipelineStageFlags stages;
+  vk::AccessFlags access;
+};
+
+inline const ImageAccess transfer_source_access{
+    vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer,
+    vk::AccessFlagBits::eTransferRead};
+inline const ImageAccess transfer_destination_access{
+    vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer,
+    vk::AccessFlagBits::eTransferWrite};
+inline const ImageAccess fragment_shader_read_access{
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::PipelineStageFlagBits::eFragmentShader,
+    vk::AccessFlagBits::eShaderRead};
+
+/**
+ * @brief Knows the layout of every subresource of the images it tracks and
+ * how they were last accessed, and derives the barriers between accesses.
+ *
+ * Each barrier waits for the stages that accessed a subresource since its
+ * last barrier and only makes earlier writes available, so reads following
+ * reads in the same layout need none and writes following reads only need an
+ * execution dependency. Barriers are queued by use() and recorded together
+ * by flush(), one pipelineBarrier per flush, with adjacent mip levels in the
+ * same state sharing a barrier.
+ *
+ * The tracker follows recording order, so the command buffers have to be
+ * submitted in the order their barriers were flushed. Images that change
+ * queue family go through a release() flushed on the old family followed by
+ * an acquire() flushed on the new one.
+ */
+class ImageStateTracker {
+public:
+  // Starts tracking every subresource of image in the undefined layout,
+  // forgetting any previous image with the same handle
+  auto add(vk::Image image, vk::ImageAspectFlags aspect,
+           std::uint32_t mip_levels = 1, std::uint32_t array_layers = 1)
+      -> void;
+  auto remove(vk::Image image) -> void;
+
+  // Queues the barriers the next commands need to access range of image.
+  // The ranges used between two flushes must not overlap.
+  auto use(vk::Image image, const vk::ImageSubresourceRange& range,
+           const ImageAccess& access) -> void;
+  // Uses every subresource of image
+  auto use(vk::Image image, const ImageAccess& access) -> void;
+
+  // Queues the release of every subresource of image by src_family to
+  // dst_family, moving it to the layout of access
+  auto release(vk::Image image, const ImageAccess& access,
+               std::uint32_t src_family, std::uint32_t dst_family) -> void;
+  // Queues the matching acquire, whose command buffer has to wait for the
+  // release through a semaphore
+  auto acquire(vk::Image image, const ImageAccess& access,
+               std::uint32_t src_family, std::uint32_t dst_family) -> void;
+
+  // Queues a global memory dependency to record along with the barriers
+  auto add_memory_barrier(vk::PipelineStageFlags src_stages,
+                          vk::AccessFlags src_access,
+                          vk::PipelineStageFlags dst_stages,
+                          vk::AccessFlags dst_access) -> void;
+  // Queues a barrier of a buffer, whose state is not tracked
+  auto add_buffer_barrier(const vk::BufferMemoryBarrier& barrier,
+                          vk::PipelineStageFlags src_stages,
+                          vk::PipelineStageFlags dst_stages) -> void;
+
+  // Records the queued barriers, if any
+  auto flush(vk::CommandBuffer command_buffer) -> void;
+
+  [[nodiscard]] auto layout(vk::Image image, std::uint32_t mip_level,
+                            std::uint32_t array_layer) const
+      -> vk::ImageLayout;
+
+private:
+  enum class Ownership { kept, released, acquired };
+
+  struct Subresource {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    // Accesses since the last barrier
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+    // The flush that records its queued barrier
+    std::uint64_t queued_for = 0;
+  };
+
+  struct Image {
+    vk::ImageAspectFlags aspect;
+    std::uint32_t mip_levels = 1;
+    std::uint32_t array_layers = 1;
+    // Mip levels of the first layer, then of the second and so on
+    std::vector<Subresource> subresources;
+  };
+
+  std::unordered_map<VkImage, Image> images_;
+  std::vector<vk::ImageMemoryBarrier> barriers_;
+  std::vector<vk::BufferMemoryBarrier> buffer_barriers_;
+  vk::MemoryBarrier memory_barrier_;
+  vk::PipelineStageFlags src_stages_;
+  vk::PipelineStageFlags dst_stages_;
+  std::uint64_t flush_count_ = 1;
+
+  [[nodiscard]] auto find(vk::Image image) -> Image&;
+  auto queue_barriers(vk::Image image, const vk::ImageSubresourceRange& range,
+                      const ImageAccess& access, Ownership ownership,
+                      std::uint32_t src_family, std::uint32_t dst_family)
+      -> void;
+};
+
+} // namespace vulkan
+
+#endif // IMAGE_STATE_HPP
@@ -9,21 +9,43 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <set>
+#include <span>
 #include <stdexcept>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "animation.hpp"
 #include "buffer_utils.hpp"
 #include "camera.hpp"
-#include "gltf.hpp"
+#include "compute_pipeline.hpp"
 #include "graphics_pipeline.hpp"
+#include "image_state.hpp"
+#include "material.hpp"
+#include "material_cache.hpp"
+#include "memory_allocator.hpp"
+#include "mesh_cache.hpp"
+#include "morph.hpp"
+#include "residency.hpp"
+#include "scene_graph.hpp"
 #include "shader_module.hpp"
+#include "skin.hpp"
+#include "staging_ring.hpp"
+#include "thread_pool.hpp"
+#include "timeline_queue.hpp"
+#include "uniform_ring.hpp"
+#include "vertex.hpp"
 #include "window.hpp"
 
 constexpr std::array validation_layers = {"VK_LAYER_KHRONOS_validation"};
@@ -36,53 +58,171 @@ constexpr bool vk_enable_validation_layers = true;
 
 constexpr std::array device_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+// Enabled when the device supports it, for the allocator to track the
+// memory budget
+constexpr const char* memory_budget_extension =
+    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+
 constexpr std::size_t frames_in_flight = 2;
 
 constexpr vk::Format depth_format = vk::Format::eD32Sfloat;
 
-struct Vertex {
-  glm::vec3 pos;
-  glm::vec3 color;
-  glm::vec2 texCoord;
+// Render from the first frame on and show the assets as their uploads
+// complete, instead of blocking the constructor until everything is loaded
+constexpr bool stream_assets = true;
+
+// Room for the uniforms of one frame in the uniform ring
+constexpr vk::DeviceSize uniform_bytes_per_frame = vk::DeviceSize{64} << 10U;
+
+// Every upload is staged through a ring of this size. Larger uploads are
+// split into chunks of half the ring.
+constexpr vk::DeviceSize staging_ring_size = vk::DeviceSize{64} << 20U;
+
+// Once a heap uses more than this share of its budget, the least recently
+// used material textures are halved in size until it is back below
+constexpr double memory_high_water_mark = 0.9;
+// Textures are not halved below this width and height
+constexpr std::uint32_t min_evicted_texture_size = 64;
+
+// Defragmentation copies about as many bytes per frame as uploads transfer
+// in this time
+constexpr double defragmentation_milliseconds_per_frame = 1.0;
+// Bytes copied per frame until the upload throughput is known
+constexpr vk::DeviceSize default_defragmentation_bytes = vk::DeviceSize{8}
+                                                         << 20U;
+// Defragmentation only starts once at least this share of the free memory
+// lies outside the largest free range
+constexpr double min_defragmentation_fragmentation = 0.5;
+// and at least this many bytes are free, as less is not worth the copies
+constexpr vk::DeviceSize min_defragmentation_free_bytes = vk::DeviceSize{16}
+                                                          << 20U;
+
+// Grey checkerboard drawn until the materials are uploaded
+constexpr std::array<std::uint32_t, 4> placeholder_texture_pixels = {
+    0xFF80'8080, 0xFFC0'C0C0, 0xFFC0'C0C0, 0xFF80'8080};
+constexpr std::uint32_t placeholder_texture_size = 2;
+
+// Must match local_size_x of shaders/skinning.comp
+constexpr std::uint32_t skinning_group_size = 64;
+// Must match local_size_x of shaders/morph.comp
+constexpr std::uint32_t morph_group_size = 64;
 
-  // Returns the vulkan binding description of a vertex
-  [[nodiscard]] static auto binding_description()
-      -> vk::VertexInputBindingDescription
-  {
-    return {0, sizeof(Vertex), vk::VertexInputRate::eVertex};
-  }
+struct UniformBufferObject {
+  alignas(16) glm::mat4 model;
+  alignas(16) glm::mat4 view;
+  alignas(16) glm::mat4 proj;
+};
 
-  [[nodiscard]] static auto attributes_descriptions()
-      -> std::vector<vk::VertexInputAttributeDescription>
-  {
-    return {
-        vk::VertexInputAttributeDescription{0, 0, vk::Format::eR32G32B32Sfloat,
-                                            offsetof(Vertex, pos)},
-        vk::VertexInputAttributeDescription{1, 0, vk::Format::eR32G32B32Sfloat,
-                                            offsetof(Vertex, color)},
-        vk::VertexInputAttributeDescription{2, 0, vk::Format::eR32G32Sfloat,
-                                            offsetof(Vertex, texCoord)},
-    };
-  }
+// Location of the geometry of one DrawRange in the shared vertex and index
+// buffers
+struct GpuPrimitive {
+  std::uint32_t first_vertex = 0;
+  std::uint32_t vertex_count = 0;
+
+  std::uint32_t first_index = 0;
+  // 0 for non-indexed primitives
+  std::uint32_t index_count = 0;
+  vk::IndexType index_type = vk::IndexType::eUint16;
+
+  // Index into Application::graphics_pipelines_ matching the vertex layout
+  std::size_t pipeline = 0;
+  // Index into GltfScene::materials or DrawRange::no_material
+  std::uint32_t material = DrawRange::no_material;
 };
 
-const std::array vertices = {
-    Vertex{{-0.5F, -0.5F, 0.0F}, {1.0F, 0.0F, 0.0F}, {1.0f, 0.0f}},
-    Vertex{{0.5f, -0.5F, 0.0F}, {0.0F, 1.0F, 0.0F}, {0.0f, 0.0f}},
-    Vertex{{0.5F, 0.5F, 0.0F}, {0.0F, 0.0F, 1.0F}, {0.0f, 1.0f}},
-    Vertex{{-0.5F, 0.5F, 0.0F}, {1.0F, 1.0F, 1.0F}, {1.0f, 1.0f}},
+// One instance of a primitive, placed by the world matrix of a scene node
+struct NodeDraw {
+  std::uint32_t primitive = 0;
+  std::uint32_t node = 0;
+  // Skinned and morphed draws read their vertices from the deformed vertex
+  // buffer, starting at first_vertex
+  bool deformed = false;
+  std::uint32_t first_vertex = 0;
+};
 
-    Vertex{{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-    Vertex{{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {2.0f, 0.0f}},
-    Vertex{{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {2.0f, 2.0f}},
-    Vertex{{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 2.0f}}};
+// Skins one instance of a primitive, matching the push constants of
+// shaders/skinning.comp
+struct SkinningDispatch {
+  std::uint32_t first_skin_vertex = 0;
+  std::uint32_t vertex_count = 0;
+  std::uint32_t first_joint = 0;
+  std::uint32_t joint_count = 0;
+  // Position of the first vertex in the deformed vertex buffer and the
+  // distance between vertices, in floats
+  std::uint32_t first_output = 0;
+  std::uint32_t output_stride = 0;
+};
 
-const std::array<uint16_t, 12> indices{0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4};
+// Writes the unmorphed positions of one instance of a primitive or adds one
+// of its targets, matching the push constants of shaders/morph.comp
+struct MorphDispatch {
+  static constexpr std::uint32_t no_blend = 0xFFFF'FFFF;
+
+  std::uint32_t first_morph_vertex = 0;
+  std::uint32_t vertex_count = 0;
+  // Position of the first vertex in the output buffer and the distance
+  // between vertices, in floats
+  std::uint32_t first_output = 0;
+  std::uint32_t output_stride = 0;
+  // Index into the blend buffer of the target to add, or no_blend
+  std::uint32_t blend = no_blend;
+};
 
-struct UniformBufferObject {
-  alignas(16) glm::mat4 model;
-  alignas(16) glm::mat4 view;
-  alignas(16) glm::mat4 proj;
+// A morph target with non-zero weight, matching the MorphBlend struct of
+// shaders/morph.comp
+struct MorphBlend {
+  std::uint32_t first_delta = 0;
+  std::uint32_t delta_count = 0;
+  float weight = 0.0F;
+  std::uint32_t padding = 0;
+};
+static_assert(sizeof(MorphBlend) == 16);
+
+struct MorphInstance {
+  MorphDispatch dispatch;
+  // Only dispatched in frames where the weights of the node changed
+  std::uint32_t node = 0;
+  // Index into the morph weights and MeshData::morph_offsets of the first
+  // target
+  std::uint32_t first_weight = 0;
+  std::uint32_t first_target = 0;
+  std::uint32_t target_count = 0;
+  // Skinned instances are morphed into their skin vertices, all others into
+  // the deformed vertex buffer
+  bool skinned = false;
+};
+
+// A device local buffer that defragmentation may move, with what it takes
+// to create a copy of it
+struct MovableBuffer {
+  vk::UniqueBuffer* buffer = nullptr;
+  vulkan::Allocation* memory = nullptr;
+  vk::DeviceSize size = 0;
+  vk::BufferUsageFlags usages;
+};
+
+// Resources replaced while a transfer or the frames in flight still use
+// them, destroyed once both are done
+struct RetiredResources {
+  vulkan::UploadToken token;
+  // The graphics queue timeline value of the last frame that may use them
+  std::uint64_t graphics_value = 0;
+  // Declared first to be freed last
+  std::vector<vulkan::Allocation> memory;
+  std::vector<vk::UniqueImage> images;
+  std::vector<vk::UniqueBuffer> buffers;
+  std::vector<vk::UniqueImageView> image_views;
+  std::vector<vk::UniqueDescriptorPool> descriptor_pools;
+  // Allocated from the command pool, which frees them on release
+  std::vector<vk::CommandBuffer> command_buffers;
+  // Material images whose previous version is among the images
+  std::vector<std::uint32_t> halved_material_images;
+};
+
+// Per-draw indices read by both shaders
+struct DrawPushConstants {
+  std::uint32_t node = 0;
+  std::uint32_t material = 0;
 };
 
 struct SwapChainSupportDetails {
@@ -165,6 +305,8 @@ choose_swap_extent(const vk::SurfaceCapabilitiesKHR& capabilities,
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphics_family;
   std::optional<uint32_t> present_family;
+  // A family that can only transfer, for uploads to run beside rendering
+  std::optional<uint32_t> transfer_family;
 
   bool is_complete()
   {
@@ -194,6 +336,14 @@ public:
       : window_{1440, 900, "Vulkan Renderer"}, instance_{create_instance()},
         dldy_{create_dynamic_loader()}
   {
+    // Asset loading does not depend on Vulkan, so it runs on the workers while
+    // the device and swapchain are set up
+    mesh_future_ = thread_pool_.submit(
+        [this] { return load_mesh_data("models/Box.gltf", thread_pool_); });
+    material_future_ = thread_pool_.submit([this] {
+      return load_material_data("models/Box.gltf", thread_pool_);
+    });
+
     glfwSetFramebufferSizeCallback(window_.window(),
                                    framebuffer_resize_callback);
     glfwSetWindowUserPointer(window_.window(), this);
@@ -203,10 +353,27 @@ public:
     physical_device_ = pick_physical_device();
     queue_family_indices_ = find_queue_families(physical_device_);
     device_ = create_logical_device();
-    graphics_queue_ =
-        device_->getQueue(queue_family_indices_.graphics_family.value(), 0);
+    allocator_ = std::make_unique<vulkan::MemoryAllocator>(
+        physical_device_, *device_, memory_budget_supported_);
+    graphics_queue_ = vulkan::TimelineQueue{
+        *device_,
+        device_->getQueue(queue_family_indices_.graphics_family.value(), 0)};
     present_queue_ =
         device_->getQueue(queue_family_indices_.present_family.value(), 0);
+    const vulkan::DeviceQueue graphics{
+        &graphics_queue_, queue_family_indices_.graphics_family.value()};
+    auto transfer = graphics;
+    if (queue_family_indices_.transfer_family) {
+      const auto family = *queue_family_indices_.transfer_family;
+      transfer_queue_ =
+          vulkan::TimelineQueue{*device_, device_->getQueue(family, 0)};
+      transfer = {&transfer_queue_, family,
+                  physical_device_.getQueueFamilyProperties()[family]
+                      .minImageTransferGranularity};
+    }
+    staging_ring_ = std::make_unique<vulkan::StagingRing>(
+        *allocator_, image_states_, *device_, graphics, transfer,
+        staging_ring_size);
 
     create_swap_chain();
     create_swapchain_image_views();
@@ -218,24 +385,39 @@ public:
     frag_shader_ = vulkan::create_shader_module_from_file(
         "shaders/shader.frag.spv", *device_);
 
-    pipeline_layout_ = vulkan::create_graphics_pipeline_layout(
-        *device_, *descriptor_set_layout_);
+    create_pipeline_layout();
+    create_skinning_pipeline();
+    create_morph_pipeline();
 
-    create_graphics_pipelines();
+    // Everything the first frame needs goes to the device in one submission
+    vulkan::UploadBatch startup_uploads{*staging_ring_};
     create_command_pool();
     create_depth_resource();
     create_frame_buffers();
-    create_texture_image();
+    std::tie(texture_image_, texture_image_memory_) =
+        create_texture_image(placeholder_texture_size, placeholder_texture_size,
+                             placeholder_texture_pixels.data());
     create_texture_image_view();
     create_texture_sampler();
-    load_model();
-    create_vertex_buffer();
-    create_index_buffer();
+    create_placeholder_material();
     create_uniform_buffers();
+    create_node_buffers();
     create_descriptor_pool();
     create_descriptor_sets();
     create_command_buffers();
     create_sync_objects();
+
+    if constexpr (!stream_assets) {
+      thread_pool_.wait(mesh_future_);
+      thread_pool_.wait(material_future_);
+      upload_ready_assets();
+    }
+    startup_uploads.submit();
+    fmt::print("Startup took {:.1f} ms and {} submissions{}\n",
+               milliseconds_since_start(), staging_ring_->submission_count(),
+               queue_family_indices_.transfer_family
+                   ? " through the transfer queue"
+                   : "");
   }
 
   ~Application() = default;
@@ -248,13 +430,31 @@ public:
   {
     while (!window_.should_close()) {
       window_.poll_events();
+      upload_ready_assets();
+      enforce_memory_budget();
+      defragment_memory();
+      release_retired_resources();
       render();
     }
 
     device_->waitIdle();
+    staging_ring_->finish();
+    const auto& stats = staging_ring_->stats();
+    fmt::print("Uploaded {:.1f} MB at {:.0f} MB/s\n",
+               static_cast<double>(stats.bytes) / 1e6,
+               stats.megabytes_per_second());
   }
 
 private:
+  // Declared first so that it is destroyed last, after every member its
+  // tasks may refer to
+  ThreadPool thread_pool_;
+  std::chrono::steady_clock::time_point start_time_ =
+      std::chrono::steady_clock::now();
+  bool first_frame_presented_ = false;
+  std::future<MeshData> mesh_future_;
+  std::future<MaterialData> material_future_;
+
   Window window_;
   vk::UniqueInstance instance_;
   vk::DispatchLoaderDynamic dldy_;
@@ -262,10 +462,21 @@ private:
       debug_messenger_;
   vk::UniqueHandle<vk::SurfaceKHR, vk::DispatchLoaderDynamic> surface_;
   vk::PhysicalDevice physical_device_;
+  bool memory_budget_supported_ = false;
+  // Layouts of the images, which the transfers keep up to date
+  vulkan::ImageStateTracker image_states_;
   vk::UniqueDevice device_;
+  // Declared right after the device, so that every allocation is returned
+  // before the allocator goes away
+  std::unique_ptr<vulkan::MemoryAllocator> allocator_;
+  // Every submission signals the timeline of its queue, which the staging
+  // ring waits on until it goes away
+  vulkan::TimelineQueue graphics_queue_;
+  // Unused without a transfer only family
+  vulkan::TimelineQueue transfer_queue_;
+  std::unique_ptr<vulkan::StagingRing> staging_ring_;
 
   QueueFamilyIndices queue_family_indices_;
-  vk::Queue graphics_queue_;
   vk::Queue present_queue_;
   vk::UniqueSwapchainKHR swapchain_;
   std::vector<vk::Image> swapchain_images_;
@@ -274,7 +485,7 @@ private:
   std::vector<vk::UniqueImageView> swapchain_image_views_;
 
   vk::UniqueImage depth_image_;
-  vk::UniqueDeviceMemory depth_image_memory_;
+  vulkan::Allocation depth_image_memory_;
   vk::UniqueImageView depth_image_view_;
 
   vk::UniqueRenderPass render_pass_;
@@ -284,7 +495,9 @@ private:
 
   vk::UniqueDescriptorSetLayout descriptor_set_layout_;
   vk::UniquePipelineLayout pipeline_layout_;
-  vk::UniquePipeline graphics_pipeline_;
+  // One pipeline per distinct vertex layout of the loaded meshes
+  std::vector<VertexLayout> vertex_layouts_;
+  std::vector<vk::UniquePipeline> graphics_pipelines_;
 
   std::vector<vk::UniqueFramebuffer> swapchain_framebuffers_;
 
@@ -294,25 +507,132 @@ private:
   vk::UniqueCommandPool command_pool_;
   std::vector<vk::CommandBuffer> command_buffers_;
 
+  // Presentation only takes binary semaphores
   std::array<vk::UniqueSemaphore, 2> image_available_semaphores;
   std::array<vk::UniqueSemaphore, 2> render_finished_semaphores;
-  std::array<vk::UniqueFence, 2> in_flight_fences;
+  // The graphics queue timeline value of each frame in flight
+  std::array<std::uint64_t, 2> in_flight_values{};
+  // The value of the frame that last rendered to each swapchain image, which
+  // has to be reached before the per-image buffers are written again
+  std::vector<std::uint64_t> images_in_flight;
   size_t current_frame = 0;
 
+  MeshData mesh_;
+  std::vector<GpuPrimitive> primitives_;
+  // The geometry of every primitive in the scene
   vk::UniqueBuffer vertex_buffer_;
-  vk::UniqueDeviceMemory vertex_buffer_memory_;
-
+  vulkan::Allocation vertex_buffer_memory_;
   vk::UniqueBuffer index_buffer_;
-  vk::UniqueDeviceMemory index_buffer_memory_;
-
-  std::vector<vk::UniqueBuffer> uniform_buffers_;
-  std::vector<vk::UniqueDeviceMemory> uniform_buffers_memory_;
-
+  vulkan::Allocation index_buffer_memory_;
+  SceneGraph scene_graph_;
+  // Plays the first animation of the scene, if any
+  AnimationSampler animation_;
+  // Sorted by pipeline
+  std::vector<NodeDraw> draws_;
+
+  // Skinning runs once per frame in a compute pass. It writes the positions
+  // of every skinned instance into the deformed vertex buffer, from which all
+  // later passes draw without skinning again.
+  vk::UniqueShaderModule skinning_shader_;
+  vk::UniqueDescriptorSetLayout skinning_descriptor_set_layout_;
+  vk::UniquePipelineLayout skinning_pipeline_layout_;
+  vk::UniquePipeline skinning_pipeline_;
+  vk::UniqueDescriptorPool skinning_descriptor_pool_;
+  std::vector<vk::DescriptorSet> skinning_descriptor_sets_;
+  JointPalette joint_palette_;
+  std::vector<SkinningDispatch> skinning_dispatches_;
+  std::vector<std::byte> deformed_vertices_;
+  // The skin vertices of the scene, followed by a copy for every skinned
+  // instance with morph targets
+  std::vector<SkinVertex> skin_vertices_;
+  vk::UniqueBuffer skin_vertex_buffer_;
+  vulkan::Allocation skin_vertex_buffer_memory_;
+  vk::UniqueBuffer deformed_vertex_buffer_;
+  vulkan::Allocation deformed_vertex_buffer_memory_;
+
+  // Morph targets are blended in a compute pass ahead of skinning, which
+  // writes the unmorphed positions of every instance and then adds one
+  // weighted target per instance and round. Each image has an indirect
+  // buffer with the workgroup count of every dispatch and a blend buffer
+  // with the target of every round. Only rounds up to the number of targets
+  // with non-zero weight get workgroups, and only for instances whose
+  // weights changed, so that neither unchanged meshes nor targets without
+  // weight cost anything without re-recording the command buffers.
+  vk::UniqueShaderModule morph_shader_;
+  vk::UniqueDescriptorSetLayout morph_descriptor_set_layout_;
+  vk::UniquePipelineLayout morph_pipeline_layout_;
+  vk::UniquePipeline morph_pipeline_;
+  vk::UniqueDescriptorPool morph_descriptor_pool_;
+  // Per image, the set writing to the deformed vertex buffer and the set
+  // writing to the skin vertex buffer
+  std::vector<std::array<vk::DescriptorSet, 2>> morph_descriptor_sets_;
+  MorphWeights morph_weights_;
+  // Sorted by skinned
+  std::vector<MorphInstance> morph_instances_;
+  // The most targets with deltas of any instance, which bounds the rounds
+  std::uint32_t morph_rounds_ = 0;
+  vk::UniqueBuffer morph_position_buffer_;
+  vulkan::Allocation morph_position_buffer_memory_;
+  vk::UniqueBuffer morph_delta_buffer_;
+  vulkan::Allocation morph_delta_buffer_memory_;
+  std::vector<vk::UniqueBuffer> morph_blend_buffers_;
+  std::vector<vulkan::Allocation> morph_blend_buffers_memory_;
+  std::vector<vk::UniqueBuffer> morph_indirect_buffers_;
+  std::vector<vulkan::Allocation> morph_indirect_buffers_memory_;
+  // Whether the indirect buffer of an image still holds workgroups from the
+  // last change
+  std::vector<std::uint8_t> morph_indirect_pending_;
+
+  // One region per swapchain image, as the command buffers of each image
+  // are recorded with the dynamic offset of its region
+  vulkan::UniformRing uniform_ring_;
+
+  // World matrices of every node followed by an identity matrix for skinned
+  // draws, and the joint matrices of every skin. One buffer each per
+  // swapchain image, only rewritten when its version is behind the scene
+  // graph.
+  std::vector<vk::UniqueBuffer> node_buffers_;
+  std::vector<vulkan::Allocation> node_buffers_memory_;
+  std::vector<vk::UniqueBuffer> joint_buffers_;
+  std::vector<vulkan::Allocation> joint_buffers_memory_;
+  std::vector<std::uint64_t> node_buffer_versions_;
+  std::uint64_t node_matrices_version_ = 0;
+
+  // Bound in place of the material textures until they are uploaded, and
+  // for scenes without any
   vk::UniqueImage texture_image_;
-  vk::UniqueDeviceMemory texture_image_memory_;
+  vulkan::Allocation texture_image_memory_;
   vk::UniqueImageView texture_image_view_;
   vk::UniqueSampler texture_sampler_;
 
+  // The material table and the deduplicated images and samplers it refers to.
+  // The last material is the default one.
+  std::vector<vk::UniqueImage> material_images_;
+  std::vector<vulkan::Allocation> material_images_memory_;
+  std::vector<vk::UniqueImageView> material_image_views_;
+  std::vector<vk::Extent2D> material_image_extents_;
+  std::vector<vk::UniqueSampler> material_samplers_;
+  std::vector<MaterialTexture> material_textures_;
+  std::vector<GpuMaterial> materials_;
+  // Material images by the timeline value of the last frame that sampled
+  // them
+  ResidencyLru material_image_residency_;
+  // The material images the recorded draws sample
+  std::vector<std::uint32_t> drawn_material_images_;
+
+  // Along with the material images, the resources that defragmentation
+  // moves
+  std::vector<MovableBuffer> movable_buffers_;
+  bool defragmenting_ = false;
+  // Free space of the blocks when defragmentation last ended, so that it
+  // only starts again once allocations changed
+  vulkan::FragmentationStats defragmented_stats_;
+  // Oldest first
+  std::deque<RetiredResources> retired_resources_;
+  vk::UniqueBuffer material_buffer_;
+  vulkan::Allocation material_buffer_memory_;
+  std::uint32_t material_count_ = 0;
+
   [[nodiscard]] auto create_instance() -> vk::UniqueInstance
   {
     if (vk_enable_validation_layers) {
@@ -320,7 +640,7 @@ private:
     }
 
     vk::ApplicationInfo app_info;
-    app_info.setApiVersion(VK_API_VERSION_1_1);
+    app_info.setApiVersion(VK_API_VERSION_1_2);
 
     const auto extensions = get_required_extensions();
 
@@ -389,6 +709,9 @@ private:
     std::set<uint32_t> unique_queue_families = {
         queue_family_indices_.graphics_family.value(),
         queue_family_indices_.present_family.value()};
+    if (queue_family_indices_.transfer_family) {
+      unique_queue_families.insert(*queue_family_indices_.transfer_family);
+    }
 
     const auto queue_family_properties =
         physical_device_.getQueueFamilyProperties();
@@ -409,15 +732,32 @@ private:
 
     vk::PhysicalDeviceFeatures device_features;
     device_features.samplerAnisotropy = true;
+    // Materials select their textures from an array by index
+    device_features.shaderSampledImageArrayDynamicIndexing = true;
+    vk::PhysicalDeviceVulkan12Features vulkan12_features;
+    vulkan12_features.timelineSemaphore = true;
+
+    std::vector<const char*> extensions(device_extensions.begin(),
+                                        device_extensions.end());
+    const auto available_extensions =
+        physical_device_.enumerateDeviceExtensionProperties();
+    memory_budget_supported_ = std::ranges::any_of(
+        available_extensions, [](const vk::ExtensionProperties& extension) {
+          return std::string_view{static_cast<const char*>(
+                     extension.extensionName)} == memory_budget_extension;
+        });
+    if (memory_budget_supported_) {
+      extensions.push_back(memory_budget_extension);
+    }
 
     vk::DeviceCreateInfo create_info;
-    create_info.setPQueueCreateInfos(queue_create_infos.data())
+    create_info.setPNext(&vulkan12_features)
+        .setPQueueCreateInfos(queue_create_infos.data())
         .setQueueCreateInfoCount(
             static_cast<uint32_t>(queue_create_infos.size()))
         .setPEnabledFeatures(&device_features)
-        .setEnabledExtensionCount(
-            static_cast<uint32_t>(device_extensions.size()))
-        .setPpEnabledExtensionNames(device_extensions.data());
+        .setEnabledExtensionCount(static_cast<uint32_t>(extensions.size()))
+        .setPpEnabledExtensionNames(extensions.data());
 
     if (vk_enable_validation_layers) {
       create_info
@@ -532,14 +872,19 @@ private:
         .setPColorAttachments(&color_attachment_ref)
         .setPDepthStencilAttachment(&depth_attachment_ref);
 
+    // The depth image is shared by the frames in flight, so clearing it has
+    // to wait for the depth tests of the previous frame
     vk::SubpassDependency dependency{};
     dependency.setSrcSubpass(VK_SUBPASS_EXTERNAL)
         .setDstSubpass(0)
-        .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-        .setSrcAccessMask(vk::AccessFlags{})
-        .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                         vk::PipelineStageFlagBits::eLateFragmentTests)
+        .setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+        .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                         vk::PipelineStageFlagBits::eEarlyFragmentTests)
         .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead |
-                          vk::AccessFlagBits::eColorAttachmentWrite);
+                          vk::AccessFlagBits::eColorAttachmentWrite |
+                          vk::AccessFlagBits::eDepthStencilAttachmentWrite);
 
     std::array attachments{color_attachment, depth_attachment};
     vk::RenderPassCreateInfo render_pass_create_info;
@@ -557,14 +902,23 @@ private:
   auto create_descriptor_set_layout() -> void
   {
     const vk::DescriptorSetLayoutBinding ubo_layout_binding{
-        0, vk::DescriptorType::eUniformBuffer, 1,
+        0, vk::DescriptorType::eUniformBufferDynamic, 1,
         vk::ShaderStageFlagBits::eVertex, nullptr};
 
     const vk::DescriptorSetLayoutBinding sampler_layout_binding{
-        1, vk::DescriptorType::eCombinedImageSampler, 1,
+        1, vk::DescriptorType::eCombinedImageSampler, texture_slot_count(),
         vk::ShaderStageFlagBits::eFragment, nullptr};
 
-    std::array bindings = {ubo_layout_binding, sampler_layout_binding};
+    const vk::DescriptorSetLayoutBinding node_layout_binding{
+        2, vk::DescriptorType::eStorageBuffer, 1,
+        vk::ShaderStageFlagBits::eVertex, nullptr};
+
+    const vk::DescriptorSetLayoutBinding material_layout_binding{
+        3, vk::DescriptorType::eStorageBuffer, 1,
+        vk::ShaderStageFlagBits::eFragment, nullptr};
+
+    std::array bindings = {ubo_layout_binding, sampler_layout_binding,
+                           node_layout_binding, material_layout_binding};
 
     const vk::DescriptorSetLayoutCreateInfo create_info{
         {}, static_cast<std::uint32_t>(bindings.size()), bindings.data()};
@@ -573,6 +927,53 @@ private:
         device_->createDescriptorSetLayoutUnique(create_info);
   }
 
+  auto create_pipeline_layout() -> void
+  {
+    // The vertex shader reads the world matrix of the drawn node and the
+    // fragment shader its material
+    const vk::PushConstantRange draw_push_constant{
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0, sizeof(DrawPushConstants)};
+    pipeline_layout_ = vulkan::create_graphics_pipeline_layout(
+        *device_, *descriptor_set_layout_, {&draw_push_constant, 1});
+  }
+
+  auto create_skinning_pipeline() -> void
+  {
+    skinning_shader_ = vulkan::create_shader_module_from_file(
+        "shaders/skinning.comp.spv", *device_);
+
+    skinning_descriptor_set_layout_ = create_compute_descriptor_set_layout(3);
+
+    const vk::PushConstantRange push_constant{
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(SkinningDispatch)};
+    skinning_pipeline_layout_ = vulkan::create_graphics_pipeline_layout(
+        *device_, *skinning_descriptor_set_layout_, {&push_constant, 1});
+    skinning_pipeline_ = vulkan::create_compute_pipeline(
+        *device_, *skinning_pipeline_layout_, *skinning_shader_);
+  }
+
+  auto create_morph_pipeline() -> void
+  {
+    morph_shader_ = vulkan::create_shader_module_from_file(
+        "shaders/morph.comp.spv", *device_);
+    morph_descriptor_set_layout_ = create_compute_descriptor_set_layout(4);
+
+    const vk::PushConstantRange push_constant{
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(MorphDispatch)};
+    morph_pipeline_layout_ = vulkan::create_graphics_pipeline_layout(
+        *device_, *morph_descriptor_set_layout_, {&push_constant, 1});
+    morph_pipeline_ = vulkan::create_compute_pipeline(
+        *device_, *morph_pipeline_layout_, *morph_shader_);
+  }
+
+  // Size of the texture array, which cannot be empty
+  [[nodiscard]] auto texture_slot_count() const noexcept -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(
+        std::max<std::size_t>(material_textures_.size(), 1));
+  }
+
   auto create_graphics_pipelines() -> void
   {
     const vk::Viewport viewport{
@@ -586,14 +987,28 @@ private:
     // Draw to the entire framebuffer
     const vk::Rect2D scissor{vk::Offset2D{0, 0}, swapchain_extent_};
 
-    const vulkan::VertexInputInfo vertex_input_info{
-        Vertex::binding_description(), Vertex::attributes_descriptions()};
-
-    graphics_pipeline_ = vulkan::create_graphics_pipeline(
-        *device_, *render_pass_, vk::PrimitiveTopology::eTriangleList,
-        *pipeline_layout_, viewport, scissor,
-        {.vertex = *vertex_shader_, .fragment = *frag_shader_, .tess = {}},
-        vertex_input_info);
+    // The texture array of the fragment shader is sized by a specialization
+    // constant
+    const auto texture_count = texture_slot_count();
+    const vk::SpecializationMapEntry texture_count_entry{
+        0, 0, sizeof(texture_count)};
+    const vk::SpecializationInfo fragment_specialization{
+        1, &texture_count_entry, sizeof(texture_count), &texture_count};
+
+    graphics_pipelines_.clear();
+    for (const auto& layout : vertex_layouts_) {
+      const vulkan::VertexInputInfo vertex_input_info{
+          layout.binding_description(), layout.attributes_descriptions()};
+
+      graphics_pipelines_.push_back(vulkan::create_graphics_pipeline(
+          *device_, *render_pass_, vk::PrimitiveTopology::eTriangleList,
+          *pipeline_layout_, viewport, scissor,
+          {.vertex = *vertex_shader_,
+           .fragment = *frag_shader_,
+           .tess = {},
+           .fragment_specialization = &fragment_specialization},
+          vertex_input_info));
+    }
   }
 
   auto create_frame_buffers() -> void
@@ -649,65 +1064,32 @@ private:
   {
     const auto format = depth_format;
     std::tie(depth_image_, depth_image_memory_) = vulkan::create_image(
-        physical_device_, *device_, swapchain_extent_.width,
+        *allocator_, *device_, swapchain_extent_.width,
         swapchain_extent_.height, format, vk::ImageTiling::eOptimal,
         vk::ImageUsageFlagBits::eDepthStencilAttachment,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
 
+    // The render pass moves the image out of the undefined layout
     depth_image_view_ = vulkan::create_image_view(
         *device_, *depth_image_, format, vk::ImageAspectFlagBits::eDepth);
-
-    vulkan::transition_image_layout(
-        *device_, graphics_queue_, *command_pool_, *depth_image_, format,
-        vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eDepthStencilAttachmentOptimal);
   }
 
-  auto create_texture_image() -> void
+  // Uploads RGBA8 pixels
+  [[nodiscard]] auto create_texture_image(std::uint32_t tex_width,
+                                          std::uint32_t tex_height,
+                                          const void* pixels)
+      -> std::tuple<vk::UniqueImage, vulkan::Allocation>
   {
-    int tex_width, tex_height, tex_channels;
-    stbi_uc* pixels = stbi_load("textures/texture.jpg", &tex_width, &tex_height,
-                                &tex_channels, STBI_rgb_alpha);
-    if (!pixels) {
-      throw std::runtime_error("failed to load texture image!");
-    }
-
-    const auto image_size =
-        static_cast<vk::DeviceSize>(tex_width * tex_height * 4);
-
-    const auto [staging_buffer, staging_buffer_memory] =
-        vulkan::create_buffer(physical_device_, *device_, image_size,
-                              vk::BufferUsageFlagBits::eTransferSrc,
-                              vk::MemoryPropertyFlagBits::eHostVisible |
-                                  vk::MemoryPropertyFlagBits::eHostCoherent);
-
-    void* data = device_->mapMemory(*staging_buffer_memory, 0, image_size);
-    memcpy(data, pixels, static_cast<size_t>(image_size));
-    device_->unmapMemory(*staging_buffer_memory);
-
-    stbi_image_free(pixels);
-
-    std::tie(texture_image_, texture_image_memory_) = vulkan::create_image(
-        physical_device_, *device_, static_cast<std::uint32_t>(tex_width),
-        static_cast<std::uint32_t>(tex_height), vk::Format::eR8G8B8A8Unorm,
-        vk::ImageTiling::eOptimal,
-        vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+    auto [image, image_memory] = vulkan::create_image(
+        *allocator_, *device_, tex_width, tex_height,
+        vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst |
+            vk::ImageUsageFlagBits::eSampled,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-    vulkan::transition_image_layout(*device_, graphics_queue_, *command_pool_,
-                                    *texture_image_, vk::Format::eR8G8B8A8Unorm,
-                                    vk::ImageLayout::eUndefined,
-                                    vk::ImageLayout::eTransferDstOptimal);
-
-    vulkan::copy_buffer_to_image(*device_, graphics_queue_, *command_pool_,
-                                 *staging_buffer, *texture_image_,
-                                 static_cast<std::uint32_t>(tex_width),
-                                 static_cast<std::uint32_t>(tex_height));
-
-    vulkan::transition_image_layout(*device_, graphics_queue_, *command_pool_,
-                                    *texture_image_, vk::Format::eR8G8B8A8Unorm,
-                                    vk::ImageLayout::eTransferDstOptimal,
-                                    vk::ImageLayout::eShaderReadOnlyOptimal);
+    staging_ring_->upload(*image, tex_width, tex_height, 4, pixels);
+    return {std::move(image), std::move(image_memory)};
   }
 
   auto create_texture_image_view() -> void
@@ -739,39 +1121,900 @@ private:
     texture_sampler_ = device_->createSamplerUnique(create_info);
   }
 
+  // A default material that samples the placeholder texture
+  auto create_placeholder_material() -> void
+  {
+    GpuMaterial placeholder;
+    placeholder.base_color_texture = 0;
+    create_material_buffer({&placeholder, 1});
+  }
+
+  auto create_material_buffer(std::span<const GpuMaterial> materials) -> void
+  {
+    create_movable_buffer(material_buffer_, material_buffer_memory_,
+                          vk::BufferUsageFlagBits::eStorageBuffer,
+                          materials.data(), materials.size_bytes());
+    material_count_ = static_cast<std::uint32_t>(materials.size());
+  }
+
+  // Uploads every unique image and sampler once, however many materials
+  // share them
+  auto create_materials(const MaterialData& data) -> void
+  {
+    for (const auto& image : material_images_) {
+      image_states_.remove(*image);
+    }
+    material_images_.clear();
+    material_images_memory_.clear();
+    material_image_views_.clear();
+    material_image_extents_.clear();
+    material_image_residency_.reset(data.images.size());
+    for (const auto& image : data.images) {
+      auto [texture, texture_memory] =
+          create_texture_image(image.width, image.height, image.pixels.get());
+      allocator_->set_movable(texture_memory);
+      material_image_views_.push_back(vulkan::create_image_view(
+          *device_, *texture, vk::Format::eR8G8B8A8Unorm,
+          vk::ImageAspectFlagBits::eColor));
+      material_images_.push_back(std::move(texture));
+      material_images_memory_.push_back(std::move(texture_memory));
+      material_image_extents_.push_back({image.width, image.height});
+    }
+
+    material_samplers_.clear();
+    for (const auto& sampler : data.samplers) {
+      material_samplers_.push_back(
+          device_->createSamplerUnique(sampler_create_info(sampler)));
+    }
+
+    material_textures_ = data.textures;
+    materials_ = data.materials;
+    create_material_buffer(data.materials);
+  }
+
+  // Creates a device local buffer from data that defragmentation may move
+  auto create_movable_buffer(vk::UniqueBuffer& buffer,
+                             vulkan::Allocation& memory,
+                             vk::BufferUsageFlags usages, const void* data,
+                             vk::DeviceSize size) -> void
+  {
+    // Moves copy from the old buffer to the new one
+    usages |= vk::BufferUsageFlagBits::eTransferSrc |
+              vk::BufferUsageFlagBits::eTransferDst;
+    // A defragmentation copy on the graphics queue may still write the old
+    // buffer
+    if (buffer) {
+      auto& retired = retire_until();
+      retired.buffers.push_back(std::move(buffer));
+      retired.memory.push_back(std::move(memory));
+    }
+    std::tie(buffer, memory) = vulkan::create_buffer_from_data(
+        *allocator_, *device_, *staging_ring_, usages, data, size);
+    allocator_->set_movable(memory);
+
+    const MovableBuffer movable{&buffer, &memory, size, usages};
+    const auto found =
+        std::ranges::find(movable_buffers_, &buffer, &MovableBuffer::buffer);
+    if (found == movable_buffers_.end()) {
+      movable_buffers_.push_back(movable);
+    } else {
+      *found = movable;
+    }
+  }
+
+  // Collects the material images the recorded draws sample, which every
+  // frame submitting the command buffers uses
+  auto collect_drawn_material_images() -> void
+  {
+    std::vector<std::uint8_t> drawn(material_images_.size());
+    for (const auto& draw : draws_) {
+      const auto material = draw_material(primitives_[draw.primitive].material);
+      if (material >= materials_.size()) {
+        continue;
+      }
+      const auto& textures = materials_[material];
+      for (const auto texture :
+           {textures.base_color_texture, textures.metallic_roughness_texture,
+            textures.normal_texture, textures.occlusion_texture,
+            textures.emissive_texture}) {
+        if (texture != GpuMaterial::no_texture) {
+          drawn[material_textures_[texture].image] = 1;
+        }
+      }
+    }
+    drawn_material_images_.clear();
+    for (std::uint32_t image = 0; image < drawn.size(); ++image) {
+      if (drawn[image] != 0) {
+        drawn_material_images_.push_back(image);
+      }
+    }
+  }
+
+  // Replaces a material image with a copy of half its width and height
+  auto evict_material_image(std::uint32_t index) -> void
+  {
+    const auto extent = material_image_extents_[index];
+    const vk::Extent2D half{std::max(extent.width / 2, 1U),
+                            std::max(extent.height / 2, 1U)};
+    auto [image, image_memory] = vulkan::create_image(
+        *allocator_, *device_, half.width, half.height,
+        vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst |
+            vk::ImageUsageFlagBits::eSampled,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    allocator_->set_movable(image_memory);
+    const auto token =
+        staging_ring_->submit([&](vk::CommandBuffer command_buffer) {
+          vulkan::use_for_image_copy(image_states_, *material_images_[index],
+                                     *image);
+          image_states_.flush(command_buffer);
+          vulkan::record_downsample(command_buffer, *material_images_[index],
+                                    extent, *image, half);
+          image_states_.use(*image, vulkan::fragment_shader_read_access);
+        });
+
+    // The descriptor sets of frames in flight refer to the old image and
+    // view, so they live on until those frames complete as well
+    auto& retired = retire_until(token);
+    retired.image_views.push_back(std::exchange(
+        material_image_views_[index],
+        vulkan::create_image_view(*device_, *image, vk::Format::eR8G8B8A8Unorm,
+                                  vk::ImageAspectFlagBits::eColor)));
+    retired.images.push_back(
+        std::exchange(material_images_[index], std::move(image)));
+    retired.memory.push_back(
+        std::exchange(material_images_memory_[index], std::move(image_memory)));
+    retired.halved_material_images.push_back(index);
+    material_image_extents_[index] = half;
+  }
+
+  // Returns where to put resources that have to live until token completes
+  // and the frames submitted so far are done with them. The default token
+  // only waits for the frames.
+  auto retire_until(vulkan::UploadToken token = {}) -> RetiredResources&
+  {
+    if (retired_resources_.empty() ||
+        retired_resources_.back().token != token) {
+      retired_resources_.push_back({token});
+    }
+    auto& retired = retired_resources_.back();
+    retired.graphics_value = graphics_queue_.last_submitted();
+    return retired;
+  }
+
+  auto retire_descriptor_pool(vk::UniqueDescriptorPool& pool) -> void
+  {
+    if (pool) {
+      retire_until().descriptor_pools.push_back(std::move(pool));
+    }
+  }
+
+  auto release_retired_resources() -> void
+  {
+    while (!retired_resources_.empty()) {
+      auto& retired = retired_resources_.front();
+      if (!staging_ring_->is_complete(retired.token) ||
+          !graphics_queue_.is_complete(retired.graphics_value)) {
+        break;
+      }
+      for (const auto& image : retired.images) {
+        image_states_.remove(*image);
+      }
+      if (!retired.command_buffers.empty()) {
+        device_->freeCommandBuffers(
+            *command_pool_,
+            static_cast<std::uint32_t>(retired.command_buffers.size()),
+            retired.command_buffers.data());
+      }
+      retired_resources_.pop_front();
+    }
+  }
+
+  auto print_fragmentation(std::string_view when,
+                           const vulkan::FragmentationStats& stats) -> void
+  {
+    fmt::print("{} defragmentation: {} blocks, {:.1f} MB free, largest free "
+               "range {:.1f} MB, {:.0f}% fragmented\n",
+               when, stats.block_count,
+               static_cast<double>(stats.free_bytes) / 1e6,
+               static_cast<double>(stats.largest_free_range) / 1e6,
+               stats.fragmentation() * 100.0);
+  }
+
+  // Bytes to copy this frame, estimated to take the time budget
+  [[nodiscard]] auto defragmentation_bytes() const -> vk::DeviceSize
+  {
+    const auto throughput = staging_ring_->stats().megabytes_per_second();
+    if (throughput <= 0.0) {
+      return default_defragmentation_bytes;
+    }
+    return static_cast<vk::DeviceSize>(
+        throughput * 1e3 * defragmentation_milliseconds_per_frame);
+  }
+
+  // Moves device local buffers and material images out of the blocks the
+  // allocator is emptying, spread over as many frames as the copy budget
+  // requires. Descriptor sets and command buffers are rebuilt after every
+  // step, as they refer to the moved resources, while the old ones are
+  // retired until the frames in flight are done with them.
+  auto defragment_memory() -> void
+  {
+    if (!defragmenting_) {
+      const auto stats = allocator_->fragmentation_stats();
+      if (stats == defragmented_stats_) {
+        return;
+      }
+      defragmented_stats_ = stats;
+      if (stats.fragmentation() < min_defragmentation_fragmentation ||
+          stats.free_bytes < min_defragmentation_free_bytes ||
+          !allocator_->begin_defragmentation()) {
+        return;
+      }
+      print_fragmentation("Before", stats);
+      defragmenting_ = true;
+    }
+
+    struct BufferMove {
+      MovableBuffer* target = nullptr;
+      vk::UniqueBuffer buffer;
+      vulkan::Allocation memory;
+    };
+    struct ImageMove {
+      std::uint32_t index = 0;
+      vk::UniqueImage image;
+      vulkan::Allocation memory;
+    };
+    std::vector<BufferMove> buffer_moves;
+    std::vector<ImageMove> image_moves;
+
+    // Resources without room elsewhere stay where they are
+    const auto budget = defragmentation_bytes();
+    vk::DeviceSize copied = 0;
+    auto finished = true;
+    for (auto& movable : movable_buffers_) {
+      if (!*movable.memory || !allocator_->is_evacuating(*movable.memory)) {
+        continue;
+      }
+      if (copied >= budget) {
+        finished = false;
+        break;
+      }
+      auto [buffer, memory] = vulkan::relocate_buffer(
+          *allocator_, *device_, *movable.memory, movable.size,
+          movable.usages);
+      if (memory) {
+        copied += movable.size;
+        buffer_moves.push_back(
+            {&movable, std::move(buffer), std::move(memory)});
+      }
+    }
+    for (std::uint32_t i = 0; finished && i < material_images_.size(); ++i) {
+      if (!allocator_->is_evacuating(material_images_memory_[i])) {
+        continue;
+      }
+      if (copied >= budget) {
+        finished = false;
+        break;
+      }
+      const auto extent = material_image_extents_[i];
+      auto [image, memory] = vulkan::relocate_image(
+          *allocator_, *device_, material_images_memory_[i], extent.width,
+          extent.height, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
+          vk::ImageUsageFlagBits::eTransferSrc |
+              vk::ImageUsageFlagBits::eTransferDst |
+              vk::ImageUsageFlagBits::eSampled);
+      if (memory) {
+        copied += material_images_memory_[i].size();
+        image_moves.push_back({i, std::move(image), std::move(memory)});
+      }
+    }
+
+    if (!buffer_moves.empty() || !image_moves.empty()) {
+      // The copies follow the frames in flight on the graphics queue, and the
+      // old resources live on until both complete, which the host does not
+      // wait for
+      const auto token = staging_ring_->submit(
+          [&](vk::CommandBuffer command_buffer) {
+            for (const auto& move : image_moves) {
+              vulkan::use_for_image_copy(
+                  image_states_, *material_images_[move.index], *move.image);
+            }
+            // Compute passes write some of the buffers
+            image_states_.add_memory_barrier(
+                vk::PipelineStageFlagBits::eAllCommands,
+                vk::AccessFlagBits::eMemoryWrite,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::AccessFlagBits::eTransferRead);
+            image_states_.flush(command_buffer);
+            for (const auto& move : buffer_moves) {
+              const vk::BufferCopy region{0, 0, move.target->size};
+              command_buffer.copyBuffer(**move.target->buffer, *move.buffer,
+                                        1, &region);
+            }
+            for (const auto& move : image_moves) {
+              vulkan::record_image_copy(
+                  command_buffer, *material_images_[move.index], *move.image,
+                  material_image_extents_[move.index]);
+              image_states_.use(*move.image,
+                                vulkan::fragment_shader_read_access);
+            }
+          });
+
+      auto& retired = retire_until(token);
+      for (auto& move : buffer_moves) {
+        retired.buffers.push_back(
+            std::exchange(*move.target->buffer, std::move(move.buffer)));
+        retired.memory.push_back(
+            std::exchange(*move.target->memory, std::move(move.memory)));
+      }
+      for (auto& move : image_moves) {
+        retired.image_views.push_back(std::exchange(
+            material_image_views_[move.index],
+            vulkan::create_image_view(*device_, *move.image,
+                                      vk::Format::eR8G8B8A8Unorm,
+                                      vk::ImageAspectFlagBits::eColor)));
+        retired.images.push_back(std::exchange(material_images_[move.index],
+                                               std::move(move.image)));
+        retired.memory.push_back(std::exchange(
+            material_images_memory_[move.index], std::move(move.memory)));
+      }
+      create_skinning_descriptor_sets();
+      create_morph_descriptor_sets();
+      create_descriptor_pool();
+      create_descriptor_sets();
+      create_command_buffers();
+    }
+
+    if (finished) {
+      allocator_->end_defragmentation();
+      defragmenting_ = false;
+      defragmented_stats_ = allocator_->fragmentation_stats();
+      print_fragmentation("After", defragmented_stats_);
+    }
+  }
+
+  // Halves the least recently used material images while their heap is
+  // above the high-water mark of its budget. Each image is halved at most
+  // once per call, so a heap that stays above the mark keeps shrinking its
+  // textures over the next frames.
+  auto enforce_memory_budget() -> void
+  {
+    auto heaps = allocator_->heap_budgets();
+    const auto above_mark = [&heaps](std::uint32_t heap) {
+      return static_cast<double>(heaps[heap].usage) >
+             memory_high_water_mark * static_cast<double>(heaps[heap].budget);
+    };
+
+    // Retired memory is as good as freed, and an image is only halved again
+    // once its previous version is gone, so that a heap waiting for the
+    // release of halved images does not halve them once more
+    std::vector<std::uint8_t> halving(material_images_.size());
+    for (const auto& retired : retired_resources_) {
+      for (const auto& memory : retired.memory) {
+        auto& usage = heaps[memory.heap()].usage;
+        usage -= std::min(usage, memory.size());
+      }
+      for (const auto image : retired.halved_material_images) {
+        if (image < halving.size()) {
+          halving[image] = 1;
+        }
+      }
+    }
+
+    std::vector<std::uint32_t> evicted;
+    for (const auto image : material_image_residency_.order()) {
+      const auto heap = material_images_memory_[image].heap();
+      const auto extent = material_image_extents_[image];
+      if (halving[image] != 0 || !above_mark(heap) ||
+          std::max(extent.width, extent.height) <= min_evicted_texture_size) {
+        continue;
+      }
+      evicted.push_back(image);
+      // Half the size takes about a quarter of the memory
+      const auto freed = material_images_memory_[image].size() / 4 * 3;
+      heaps[heap].usage -= std::min(heaps[heap].usage, freed);
+    }
+    if (evicted.empty()) {
+      return;
+    }
+
+    for (const auto image : evicted) {
+      evict_material_image(image);
+    }
+    create_descriptor_pool();
+    create_descriptor_sets();
+    create_command_buffers();
+    fmt::print("Halved {} textures to stay within the memory budget\n",
+               evicted.size());
+  }
+
+  // Primitives without a material, or drawn before the materials are loaded,
+  // use the default material
+  [[nodiscard]] auto draw_material(std::uint32_t material) const noexcept
+      -> std::uint32_t
+  {
+    const auto default_material = material_count_ - 1;
+    return material < default_material ? material : default_material;
+  }
+
   auto load_model() -> void
   {
-    GltfScene scene = load_gltf_scene("models/Box.gltf");
+    mesh_ = mesh_future_.get();
+
+    primitives_.clear();
+    primitives_.resize(mesh_.ranges.size());
+
+    vertex_layouts_.clear();
+    for (std::size_t i = 0; i < primitives_.size(); ++i) {
+      const auto& range = mesh_.ranges[i];
+      auto& primitive = primitives_[i];
+      primitive.first_vertex = range.first_vertex();
+      primitive.vertex_count = range.vertex_count;
+      primitive.material = range.material;
+      if (range.index_count != 0) {
+        primitive.first_index = range.first_index();
+        primitive.index_count = range.index_count;
+        primitive.index_type = range.index_size == 4 ? vk::IndexType::eUint32
+                                                     : vk::IndexType::eUint16;
+      }
+
+      const auto it = std::ranges::find(vertex_layouts_, range.layout);
+      primitive.pipeline =
+          static_cast<std::size_t>(it - vertex_layouts_.begin());
+      if (it == vertex_layouts_.end()) {
+        vertex_layouts_.push_back(range.layout);
+      }
+    }
+
+    scene_graph_ = SceneGraph{mesh_.nodes};
+    joint_palette_ = JointPalette{mesh_.joints};
+    if (!mesh_.animations.empty()) {
+      animation_ =
+          AnimationSampler{mesh_.animations[0], mesh_.animation_channels,
+                           mesh_.keyframe_times, mesh_.keyframe_values};
+    }
+    morph_weights_ = MorphWeights{mesh_.nodes.size(), mesh_.morph_weight_ranges,
+                                  mesh_.morph_weights};
+    draws_.clear();
+    skinning_dispatches_.clear();
+    morph_instances_.clear();
+    morph_rounds_ = 0;
+    deformed_vertices_.clear();
+    skin_vertices_.assign(mesh_.skin_vertices.begin(),
+                          mesh_.skin_vertices.end());
+    for (std::size_t node = 0; node < mesh_.nodes.size(); ++node) {
+      const auto& scene_node = mesh_.nodes[node];
+      if (scene_node.mesh == SceneNode::none) {
+        continue;
+      }
+      for (std::size_t i = 0; i < mesh_.ranges.size(); ++i) {
+        const auto& range = mesh_.ranges[i];
+        if (range.mesh != scene_node.mesh) {
+          continue;
+        }
+        NodeDraw draw{static_cast<std::uint32_t>(i),
+                      static_cast<std::uint32_t>(node)};
+        if ((range.skinned() && scene_node.skin != SceneNode::none) ||
+            (range.morphed() &&
+             morph_weights_.first_weight(node) != MorphWeights::none)) {
+          add_deformed_instance(range, scene_node, draw);
+        }
+        draws_.push_back(draw);
+      }
+    }
+    // Grouping by vertex buffer and index type as well keeps rebinds to the
+    // minimum
+    std::ranges::stable_sort(draws_, {}, [this](const NodeDraw& draw) {
+      const auto& primitive = primitives_[draw.primitive];
+      return std::tuple{primitive.pipeline, draw.deformed,
+                        primitive.index_type};
+    });
+    std::ranges::stable_sort(morph_instances_, {}, &MorphInstance::skinned);
+  }
+
+  // Gives the draw its own copy of the vertices, whose positions the morph
+  // and skinning passes overwrite. A skinned instance with morph targets also
+  // gets its own copy of the skin vertices, which the morph pass writes and
+  // the skinning pass reads.
+  auto add_deformed_instance(const DrawRange& range, const SceneNode& node,
+                             NodeDraw& draw) -> void
+  {
+    const auto stride = range.layout.stride();
+    const auto offset =
+        (deformed_vertices_.size() + stride - 1) / stride * stride;
+    const auto vertices =
+        mesh_.vertices.subspan(range.vertex_byte_offset, range.vertex_bytes());
+    deformed_vertices_.resize(offset);
+    deformed_vertices_.insert(deformed_vertices_.end(), vertices.begin(),
+                              vertices.end());
+    draw.deformed = true;
+    draw.first_vertex = static_cast<std::uint32_t>(offset / stride);
+
+    const auto skinned = range.skinned() && node.skin != SceneNode::none;
+    auto first_skin_vertex = range.first_skin_vertex;
+    const auto first_weight = morph_weights_.first_weight(draw.node);
+    if (range.morphed() && first_weight != MorphWeights::none) {
+      MorphInstance morph;
+      morph.node = draw.node;
+      morph.skinned = skinned;
+      morph.first_weight = first_weight;
+      morph.first_target = range.first_morph_target;
+      morph.target_count = range.morph_target_count;
+      morph.dispatch.first_morph_vertex = range.first_morph_vertex;
+      morph.dispatch.vertex_count = range.vertex_count;
+      if (skinned) {
+        first_skin_vertex = static_cast<std::uint32_t>(skin_vertices_.size());
+        const auto bind_pose =
+            mesh_.skin_vertices.subspan(range.first_skin_vertex,
+                                        range.vertex_count);
+        skin_vertices_.insert(skin_vertices_.end(), bind_pose.begin(),
+                              bind_pose.end());
+        constexpr auto skin_vertex_floats = sizeof(SkinVertex) / sizeof(float);
+        morph.dispatch.first_output = first_skin_vertex * skin_vertex_floats;
+        morph.dispatch.output_stride = skin_vertex_floats;
+      } else {
+        morph.dispatch.first_output =
+            static_cast<std::uint32_t>(offset / sizeof(float));
+        morph.dispatch.output_stride =
+            static_cast<std::uint32_t>(stride / sizeof(float));
+      }
+      morph_instances_.push_back(morph);
+      std::uint32_t moving_targets = 0;
+      for (std::uint32_t k = 0; k < morph.target_count; ++k) {
+        if (morph_delta_count(morph.first_target + k) != 0) {
+          ++moving_targets;
+        }
+      }
+      morph_rounds_ = std::max(morph_rounds_, moving_targets);
+    }
+
+    if (skinned) {
+      const auto& skin = mesh_.skins[node.skin];
+      SkinningDispatch dispatch;
+      dispatch.first_skin_vertex = first_skin_vertex;
+      dispatch.vertex_count = range.vertex_count;
+      dispatch.first_joint = skin.first_joint;
+      dispatch.joint_count = skin.joint_count;
+      dispatch.first_output =
+          static_cast<std::uint32_t>(offset / sizeof(float));
+      dispatch.output_stride =
+          static_cast<std::uint32_t>(stride / sizeof(float));
+      skinning_dispatches_.push_back(dispatch);
+      // The joint matrices already place the vertices in the world
+      draw.node = identity_node();
+    }
   }
 
-  auto create_vertex_buffer() -> void
+  [[nodiscard]] auto morph_delta_count(std::uint32_t target) const noexcept
+      -> std::uint32_t
+  {
+    return mesh_.morph_offsets[target + 1] - mesh_.morph_offsets[target];
+  }
+
+  [[nodiscard]] auto identity_node() const noexcept -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(scene_graph_.size());
+  }
+
+  auto create_deformation_buffers() -> void
+  {
+    if (deformed_vertices_.empty()) {
+      return;
+    }
+    create_movable_buffer(deformed_vertex_buffer_,
+                          deformed_vertex_buffer_memory_,
+                          vk::BufferUsageFlagBits::eVertexBuffer |
+                              vk::BufferUsageFlagBits::eStorageBuffer,
+                          deformed_vertices_.data(), deformed_vertices_.size());
+    if (!skinning_dispatches_.empty()) {
+      create_movable_buffer(skin_vertex_buffer_, skin_vertex_buffer_memory_,
+                            vk::BufferUsageFlagBits::eStorageBuffer,
+                            skin_vertices_.data(),
+                            skin_vertices_.size() * sizeof(SkinVertex));
+    }
+    if (morph_instances_.empty()) {
+      return;
+    }
+
+    create_movable_buffer(
+        morph_position_buffer_, morph_position_buffer_memory_,
+        vk::BufferUsageFlagBits::eStorageBuffer, mesh_.morph_positions.data(),
+        mesh_.morph_positions.size_bytes());
+    // Storage buffers cannot be empty, even if every delta is zero
+    const MorphDelta no_delta;
+    const auto deltas = mesh_.morph_deltas.empty()
+                            ? std::span{&no_delta, 1}
+                            : mesh_.morph_deltas;
+    create_movable_buffer(morph_delta_buffer_, morph_delta_buffer_memory_,
+                          vk::BufferUsageFlagBits::eStorageBuffer,
+                          deltas.data(), deltas.size_bytes());
+  }
+
+  // Creates a layout of binding_count storage buffers for a compute shader
+  [[nodiscard]] auto
+  create_compute_descriptor_set_layout(std::uint32_t binding_count) const
+      -> vk::UniqueDescriptorSetLayout
+  {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings(binding_count);
+    for (std::uint32_t i = 0; i < binding_count; ++i) {
+      bindings[i] = {i, vk::DescriptorType::eStorageBuffer, 1,
+                     vk::ShaderStageFlagBits::eCompute, nullptr};
+    }
+    const vk::DescriptorSetLayoutCreateInfo create_info{
+        {}, binding_count, bindings.data()};
+    return device_->createDescriptorSetLayoutUnique(create_info);
+  }
+
+  // Writes buffers to the consecutive bindings of a descriptor set
+  auto write_storage_buffers(vk::DescriptorSet descriptor_set,
+                             std::span<const vk::Buffer> buffers) -> void
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    for (const auto buffer : buffers) {
+      buffer_infos.emplace_back(buffer, 0, VK_WHOLE_SIZE);
+    }
+    const vk::WriteDescriptorSet write{
+        descriptor_set,
+        0,
+        0,
+        static_cast<std::uint32_t>(buffer_infos.size()),
+        vk::DescriptorType::eStorageBuffer,
+        nullptr,
+        buffer_infos.data(),
+        nullptr};
+    device_->updateDescriptorSets(1, &write, 0, nullptr);
+  }
+
+  // Needs the joint buffers, so it follows create_node_buffers()
+  auto create_skinning_descriptor_sets() -> void
+  {
+    skinning_descriptor_sets_.clear();
+    retire_descriptor_pool(skinning_descriptor_pool_);
+    if (skinning_dispatches_.empty()) {
+      return;
+    }
+
+    const auto images_count = static_cast<uint32_t>(swapchain_images_.size());
+    const vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageBuffer,
+                                           images_count * 3};
+    skinning_descriptor_pool_ = device_->createDescriptorPoolUnique(
+        {{}, images_count, 1, &pool_size});
+
+    const std::vector<vk::DescriptorSetLayout> layouts(
+        images_count, *skinning_descriptor_set_layout_);
+    skinning_descriptor_sets_ = device_->allocateDescriptorSets(
+        {*skinning_descriptor_pool_, images_count, layouts.data()});
+
+    for (std::size_t i = 0; i < skinning_descriptor_sets_.size(); ++i) {
+      const std::array<vk::Buffer, 3> buffers{
+          *skin_vertex_buffer_, *joint_buffers_[i], *deformed_vertex_buffer_};
+      write_storage_buffers(skinning_descriptor_sets_[i], buffers);
+    }
+  }
+
+  // Needs the morph blend buffers, so it follows create_node_buffers(). Each
+  // image gets one set per buffer the morph pass writes to.
+  auto create_morph_descriptor_sets() -> void
+  {
+    morph_descriptor_sets_.clear();
+    retire_descriptor_pool(morph_descriptor_pool_);
+    if (morph_instances_.empty()) {
+      return;
+    }
+
+    const auto images_count = static_cast<uint32_t>(swapchain_images_.size());
+    const vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageBuffer,
+                                           images_count * 2 * 4};
+    morph_descriptor_pool_ = device_->createDescriptorPoolUnique(
+        {{}, images_count * 2, 1, &pool_size});
+
+    morph_descriptor_sets_.resize(images_count);
+    for (std::size_t i = 0; i < morph_descriptor_sets_.size(); ++i) {
+      const std::array outputs{*deformed_vertex_buffer_, *skin_vertex_buffer_};
+      for (std::size_t output = 0; output < outputs.size(); ++output) {
+        if (!outputs[output]) {
+          continue;
+        }
+        auto& descriptor_set = morph_descriptor_sets_[i][output];
+        descriptor_set = device_->allocateDescriptorSets(
+            {*morph_descriptor_pool_, 1,
+             &morph_descriptor_set_layout_.get()})[0];
+        const std::array<vk::Buffer, 4> buffers{
+            *morph_position_buffer_, *morph_delta_buffer_,
+            *morph_blend_buffers_[i], outputs[output]};
+        write_storage_buffers(descriptor_set, buffers);
+      }
+    }
+  }
+
+  // Blends the morph targets of every instance whose weights changed. The
+  // workgroup counts come from the indirect buffer of the image, laid out
+  // round by round, which holds zero for all other dispatches. Targets add
+  // to the same vertices, so each round waits for the one before.
+  auto record_morphing(vk::CommandBuffer command_buffer, std::size_t image)
+      -> void
+  {
+    // The previous frame may still read the vertices about to be overwritten
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0, nullptr,
+        0, nullptr);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *morph_pipeline_);
+    const vk::MemoryBarrier round_barrier{
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+    const auto instance_count = morph_instances_.size();
+    std::optional<bool> bound_skinned;
+    for (std::size_t round = 0; round <= morph_rounds_; ++round) {
+      if (round > 0) {
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eComputeShader, {}, 1, &round_barrier,
+            0, nullptr, 0, nullptr);
+      }
+      for (std::size_t i = 0; i < instance_count; ++i) {
+        const auto& instance = morph_instances_[i];
+        if (bound_skinned != instance.skinned) {
+          command_buffer.bindDescriptorSets(
+              vk::PipelineBindPoint::eCompute, *morph_pipeline_layout_, 0, 1,
+              &morph_descriptor_sets_[image][instance.skinned ? 1 : 0], 0,
+              nullptr);
+          bound_skinned = instance.skinned;
+        }
+        // Round 0 writes the unmorphed positions, every later round adds the
+        // target in its slot of the blend buffer
+        auto dispatch = instance.dispatch;
+        if (round > 0) {
+          dispatch.blend =
+              static_cast<std::uint32_t>((round - 1) * instance_count + i);
+        }
+        command_buffer.pushConstants(*morph_pipeline_layout_,
+                                     vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(dispatch), &dispatch);
+        command_buffer.dispatchIndirect(
+            *morph_indirect_buffers_[image],
+            (round * instance_count + i) * sizeof(vk::DispatchIndirectCommand));
+      }
+    }
+
+    // Skinning reads the morphed skin vertices, drawing the morphed vertices
+    const vk::MemoryBarrier barrier{
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eVertexAttributeRead};
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader |
+                                       vk::PipelineStageFlagBits::eVertexInput,
+                                   {}, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+
+  // Only instances whose weights changed since the last frame get
+  // workgroups, and only for their targets with non-zero weight, which fill
+  // the rounds in order. All others keep the vertices an earlier frame
+  // blended.
+  auto update_morph_dispatches(std::uint32_t image) -> void
+  {
+    auto& pending = morph_indirect_pending_[image];
+    if (morph_instances_.empty() ||
+        (!morph_weights_.any_changed() && pending == 0)) {
+      return;
+    }
+
+    const auto instance_count = morph_instances_.size();
+    const auto groups = [](std::uint32_t count) {
+      return (count + morph_group_size - 1) / morph_group_size;
+    };
+    std::vector<vk::DispatchIndirectCommand> commands(
+        (morph_rounds_ + 1) * instance_count, {0, 1, 1});
+    std::vector<MorphBlend> blends(morph_rounds_ * instance_count);
+    const auto weights = morph_weights_.values();
+    for (std::size_t i = 0; i < instance_count; ++i) {
+      const auto& instance = morph_instances_[i];
+      if (!morph_weights_.changed(instance.node)) {
+        continue;
+      }
+      commands[i].x = groups(instance.dispatch.vertex_count);
+      std::size_t round = 0;
+      for (std::uint32_t k = 0; k < instance.target_count; ++k) {
+        const auto target = instance.first_target + k;
+        const auto weight = weights[instance.first_weight + k];
+        const auto delta_count = morph_delta_count(target);
+        if (weight == 0.0F || delta_count == 0) {
+          continue;
+        }
+        const auto slot = round * instance_count + i;
+        blends[slot] = {mesh_.morph_offsets[target], delta_count, weight};
+        commands[instance_count + slot].x = groups(delta_count);
+        ++round;
+      }
+    }
+    if (morph_weights_.any_changed() && !blends.empty()) {
+      memcpy(morph_blend_buffers_memory_[image].mapped(), blends.data(),
+             blends.size() * sizeof(MorphBlend));
+    }
+    const auto size = commands.size() * sizeof(vk::DispatchIndirectCommand);
+    memcpy(morph_indirect_buffers_memory_[image].mapped(), commands.data(),
+           size);
+
+    pending = morph_weights_.any_changed() ? 1 : 0;
+    morph_weights_.clear_changes();
+  }
+
+  // Skins every instance into the deformed vertex buffer
+  auto record_skinning(vk::CommandBuffer command_buffer, std::size_t image)
+      -> void
   {
-    const auto size = sizeof(vertices[0]) * vertices.size();
+    // The previous frame may still read the vertices about to be overwritten
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   {}, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *skinning_pipeline_);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *skinning_pipeline_layout_, 0, 1,
+        &skinning_descriptor_sets_[image], 0, nullptr);
+    for (const auto& dispatch : skinning_dispatches_) {
+      command_buffer.pushConstants(*skinning_pipeline_layout_,
+                                   vk::ShaderStageFlagBits::eCompute, 0,
+                                   sizeof(dispatch), &dispatch);
+      command_buffer.dispatch(
+          (dispatch.vertex_count + skinning_group_size - 1) /
+              skinning_group_size,
+          1, 1);
+    }
 
-    std::tie(vertex_buffer_, vertex_buffer_memory_) =
-        vulkan::create_buffer_from_data(
-            physical_device_, *device_, graphics_queue_, *command_pool_,
-            vk::BufferUsageFlagBits::eVertexBuffer, vertices.data(), size);
+    const vk::BufferMemoryBarrier barrier{
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eVertexAttributeRead,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        *deformed_vertex_buffer_,
+        0,
+        VK_WHOLE_SIZE};
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eVertexInput,
+                                   {}, 0, nullptr, 1, &barrier, 0, nullptr);
+  }
+
+  auto create_vertex_buffer() -> void
+  {
+    if (mesh_.vertices.empty()) {
+      return;
+    }
+    create_movable_buffer(vertex_buffer_, vertex_buffer_memory_,
+                          vk::BufferUsageFlagBits::eVertexBuffer,
+                          mesh_.vertices.data(), mesh_.vertices.size());
   }
 
   auto create_index_buffer() -> void
   {
-    const auto size = sizeof(indices[0]) * indices.size();
-    std::tie(index_buffer_, index_buffer_memory_) =
-        vulkan::create_buffer_from_data(
-            physical_device_, *device_, graphics_queue_, *command_pool_,
-            vk::BufferUsageFlagBits::eIndexBuffer, indices.data(), size);
+    if (mesh_.indices.empty()) {
+      return;
+    }
+    create_movable_buffer(index_buffer_, index_buffer_memory_,
+                          vk::BufferUsageFlagBits::eIndexBuffer,
+                          mesh_.indices.data(), mesh_.indices.size());
   }
 
   auto create_descriptor_pool() -> void
   {
-    std::array<vk::DescriptorPoolSize, 2> pool_sizes;
+    const auto images_count = static_cast<uint32_t>(swapchain_images_.size());
+    std::array<vk::DescriptorPoolSize, 3> pool_sizes;
     pool_sizes[0]
-        .setType(vk::DescriptorType::eUniformBuffer)
-        .setDescriptorCount(static_cast<uint32_t>(swapchain_images_.size()));
+        .setType(vk::DescriptorType::eUniformBufferDynamic)
+        .setDescriptorCount(images_count);
     pool_sizes[1]
         .setType(vk::DescriptorType::eCombinedImageSampler)
-        .setDescriptorCount(static_cast<uint32_t>(swapchain_images_.size()));
+        .setDescriptorCount(images_count * texture_slot_count());
+    // Node transforms and materials
+    pool_sizes[2]
+        .setType(vk::DescriptorType::eStorageBuffer)
+        .setDescriptorCount(images_count * 2);
 
     const vk::DescriptorPoolCreateInfo create_info{
         {},
@@ -779,6 +2022,7 @@ private:
         static_cast<uint32_t>(pool_sizes.size()),
         pool_sizes.data()};
 
+    retire_descriptor_pool(descriptor_pool_);
     descriptor_pool_ = device_->createDescriptorPoolUnique(create_info);
   }
 
@@ -793,23 +2037,44 @@ private:
 
     descriptor_sets_ = device_->allocateDescriptorSets(alloc_info);
 
+    std::vector<vk::DescriptorImageInfo> image_infos;
+    for (const auto& texture : material_textures_) {
+      image_infos.emplace_back(*material_samplers_[texture.sampler],
+                               *material_image_views_[texture.image],
+                               vk::ImageLayout::eShaderReadOnlyOptimal);
+    }
+    if (image_infos.empty()) {
+      image_infos.emplace_back(*texture_sampler_, *texture_image_view_,
+                               vk::ImageLayout::eShaderReadOnlyOptimal);
+    }
+
+    const vk::DescriptorBufferInfo material_buffer_info{*material_buffer_, 0,
+                                                        VK_WHOLE_SIZE};
+
+    // Dynamic offsets select the region, the range is one slice
+    const vk::DescriptorBufferInfo buffer_info{uniform_ring_.buffer(), 0,
+                                               sizeof(UniformBufferObject)};
+
     for (std::size_t i = 0; i < descriptor_sets_.size(); ++i) {
-      const vk::DescriptorBufferInfo buffer_info{*uniform_buffers_[i], 0,
-                                                 VK_WHOLE_SIZE};
 
-      const vk::DescriptorImageInfo image_info{
-          *texture_sampler_, *texture_image_view_,
-          vk::ImageLayout::eShaderReadOnlyOptimal};
+      const vk::DescriptorBufferInfo node_buffer_info{*node_buffers_[i], 0,
+                                                      VK_WHOLE_SIZE};
 
       std::array writes{
           vk::WriteDescriptorSet{descriptor_sets_[i], 0, 0, 1,
-                                 vk::DescriptorType::eUniformBuffer, nullptr,
-                                 &buffer_info, nullptr},
-          vk::WriteDescriptorSet{descriptor_sets_[i], 1, 0, 1,
-                                 vk::DescriptorType::eCombinedImageSampler,
-                                 &image_info, nullptr, nullptr}
-
-      };
+                                 vk::DescriptorType::eUniformBufferDynamic,
+                                 nullptr, &buffer_info, nullptr},
+          vk::WriteDescriptorSet{
+              descriptor_sets_[i], 1, 0,
+              static_cast<std::uint32_t>(image_infos.size()),
+              vk::DescriptorType::eCombinedImageSampler, image_infos.data(),
+              nullptr, nullptr},
+          vk::WriteDescriptorSet{descriptor_sets_[i], 2, 0, 1,
+                                 vk::DescriptorType::eStorageBuffer, nullptr,
+                                 &node_buffer_info, nullptr},
+          vk::WriteDescriptorSet{descriptor_sets_[i], 3, 0, 1,
+                                 vk::DescriptorType::eStorageBuffer, nullptr,
+                                 &material_buffer_info, nullptr}};
 
       device_->updateDescriptorSets(static_cast<uint32_t>(writes.size()),
                                     writes.data(), 0, nullptr);
@@ -818,19 +2083,77 @@ private:
 
   auto create_uniform_buffers() -> void
   {
-    vk::DeviceSize buffer_size = sizeof(UniformBufferObject);
+    const auto alignment =
+        physical_device_.getProperties().limits.minUniformBufferOffsetAlignment;
+    uniform_ring_ =
+        vulkan::UniformRing{*allocator_, *device_, alignment,
+                            uniform_bytes_per_frame, swapchain_images_.size()};
+  }
 
+  auto create_node_buffers() -> void
+  {
     const auto images_count = swapchain_images_.size();
-    uniform_buffers_.resize(images_count);
-    uniform_buffers_memory_.resize(images_count);
+
+    // Storage buffers cannot be empty, even before the scene is loaded
+    const vk::DeviceSize node_buffer_size =
+        (vk::DeviceSize{scene_graph_.size()} + 1) * sizeof(glm::mat4);
+    const vk::DeviceSize joint_buffer_size =
+        std::max<vk::DeviceSize>(joint_palette_.size(), 1) * sizeof(glm::mat4);
+    node_buffers_.resize(images_count);
+    node_buffers_memory_.resize(images_count);
+    joint_buffers_.resize(images_count);
+    joint_buffers_memory_.resize(images_count);
+    node_buffer_versions_.assign(images_count, 0);
 
     for (std::size_t i = 0; i < images_count; ++i) {
-      std::tie(uniform_buffers_[i], uniform_buffers_memory_[i]) =
-          vulkan::create_buffer(physical_device_, *device_, buffer_size,
-                                vk::BufferUsageFlagBits::eUniformBuffer,
+      std::tie(node_buffers_[i], node_buffers_memory_[i]) =
+          vulkan::create_buffer(*allocator_, *device_, node_buffer_size,
+                                vk::BufferUsageFlagBits::eStorageBuffer,
+                                vk::MemoryPropertyFlagBits::eHostVisible |
+                                    vk::MemoryPropertyFlagBits::eHostCoherent);
+      std::tie(joint_buffers_[i], joint_buffers_memory_[i]) =
+          vulkan::create_buffer(*allocator_, *device_, joint_buffer_size,
+                                vk::BufferUsageFlagBits::eStorageBuffer,
                                 vk::MemoryPropertyFlagBits::eHostVisible |
                                     vk::MemoryPropertyFlagBits::eHostCoherent);
     }
+    create_morph_buffers();
+  }
+
+  // The blends of an image are only written in frames that change them, and
+  // its indirect buffer starts out without workgroups. The deformed vertices
+  // keep the last blend across swapchain recreation.
+  auto create_morph_buffers() -> void
+  {
+    const auto images_count = swapchain_images_.size();
+    const auto instance_count =
+        std::max<vk::DeviceSize>(morph_instances_.size(), 1);
+    const vk::DeviceSize blend_buffer_size =
+        std::max<vk::DeviceSize>(morph_rounds_, 1) * instance_count *
+        sizeof(MorphBlend);
+    const vk::DeviceSize indirect_buffer_size =
+        (morph_rounds_ + 1) * instance_count *
+        sizeof(vk::DispatchIndirectCommand);
+    morph_blend_buffers_.resize(images_count);
+    morph_blend_buffers_memory_.resize(images_count);
+    morph_indirect_buffers_.resize(images_count);
+    morph_indirect_buffers_memory_.resize(images_count);
+    morph_indirect_pending_.assign(images_count, 0);
+
+    for (std::size_t i = 0; i < images_count; ++i) {
+      std::tie(morph_blend_buffers_[i], morph_blend_buffers_memory_[i]) =
+          vulkan::create_buffer(*allocator_, *device_, blend_buffer_size,
+                                vk::BufferUsageFlagBits::eStorageBuffer,
+                                vk::MemoryPropertyFlagBits::eHostVisible |
+                                    vk::MemoryPropertyFlagBits::eHostCoherent);
+      std::tie(morph_indirect_buffers_[i], morph_indirect_buffers_memory_[i]) =
+          vulkan::create_buffer(*allocator_, *device_, indirect_buffer_size,
+                                vk::BufferUsageFlagBits::eIndirectBuffer,
+                                vk::MemoryPropertyFlagBits::eHostVisible |
+                                    vk::MemoryPropertyFlagBits::eHostCoherent);
+      memset(morph_indirect_buffers_memory_[i].mapped(), 0,
+             indirect_buffer_size);
+    }
   }
 
   auto create_command_buffers() -> void
@@ -843,7 +2166,15 @@ private:
         .setCommandBufferCount(
             static_cast<std::uint32_t>(command_buffers_count));
 
+    // Frames in flight may still execute the old command buffers
+    auto& retired = retire_until();
+    retired.command_buffers.insert(retired.command_buffers.end(),
+                                   command_buffers_.begin(),
+                                   command_buffers_.end());
     command_buffers_ = device_->allocateCommandBuffers(alloc_info);
+    // Frames in flight may still read the per-image buffers
+    images_in_flight.resize(command_buffers_count, 0);
+    collect_drawn_material_images();
 
     for (size_t i = 0; i < command_buffers_count; ++i) {
       const auto& command_buffer = command_buffers_[i];
@@ -853,6 +2184,13 @@ private:
 
       command_buffer.begin(&command_buffer_begin_info);
 
+      if (!morph_instances_.empty()) {
+        record_morphing(command_buffer, i);
+      }
+      if (!skinning_dispatches_.empty()) {
+        record_skinning(command_buffer, i);
+      }
+
       vk::RenderPassBeginInfo render_pass_begin_info;
       render_pass_begin_info.setRenderPass(*render_pass_)
           .setFramebuffer(*swapchain_framebuffers_[i])
@@ -869,18 +2207,56 @@ private:
       command_buffer.beginRenderPass(&render_pass_begin_info,
                                      vk::SubpassContents::eInline);
 
-      command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                                  *graphics_pipeline_);
-
-      vk::DeviceSize offset{0};
-      command_buffer.bindVertexBuffers(0, 1, &vertex_buffer_.get(), &offset);
-      command_buffer.bindIndexBuffer(*index_buffer_, 0, vk::IndexType::eUint16);
-
+      // All pipelines share the layout, so the sets stay bound across them
+      const auto uniform_offset = uniform_ring_.region_offset(i);
       command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
                                         *pipeline_layout_, 0, 1,
-                                        &descriptor_sets_[i], 0, nullptr);
-      command_buffer.drawIndexed(static_cast<uint32_t>(indices.size()), 1, 0, 0,
-                                 0);
+                                        &descriptor_sets_[i], 1,
+                                        &uniform_offset);
+
+      // Every primitive lives in the same buffers, apart from the deformed
+      // ones. Only the index type can force the index buffer to be bound
+      // again.
+      std::optional<std::size_t> bound_pipeline;
+      std::optional<bool> bound_deformed;
+      std::optional<vk::IndexType> bound_index_type;
+      for (const auto& draw : draws_) {
+        const auto& primitive = primitives_[draw.primitive];
+        if (bound_pipeline != primitive.pipeline) {
+          command_buffer.bindPipeline(
+              vk::PipelineBindPoint::eGraphics,
+              *graphics_pipelines_[primitive.pipeline]);
+          bound_pipeline = primitive.pipeline;
+        }
+        if (bound_deformed != draw.deformed) {
+          const auto& buffer =
+              draw.deformed ? deformed_vertex_buffer_ : vertex_buffer_;
+          const vk::DeviceSize offset{0};
+          command_buffer.bindVertexBuffers(0, 1, &buffer.get(), &offset);
+          bound_deformed = draw.deformed;
+        }
+        const auto first_vertex =
+            draw.deformed ? draw.first_vertex : primitive.first_vertex;
+        const DrawPushConstants push_constants{
+            draw.node, draw_material(primitive.material)};
+        command_buffer.pushConstants(
+            *pipeline_layout_,
+            vk::ShaderStageFlagBits::eVertex |
+                vk::ShaderStageFlagBits::eFragment,
+            0, sizeof(push_constants), &push_constants);
+        if (primitive.index_count == 0) {
+          command_buffer.draw(primitive.vertex_count, 1, first_vertex, 0);
+          continue;
+        }
+        if (bound_index_type != primitive.index_type) {
+          command_buffer.bindIndexBuffer(*index_buffer_, 0,
+                                         primitive.index_type);
+          bound_index_type = primitive.index_type;
+        }
+        command_buffer.drawIndexed(primitive.index_count, 1,
+                                   primitive.first_index,
+                                   static_cast<std::int32_t>(first_vertex), 0);
+      }
 
       command_buffer.endRenderPass();
 
@@ -891,14 +2267,11 @@ private:
   auto create_sync_objects() -> void
   {
     const vk::SemaphoreCreateInfo semaphore_create_info;
-    const vk::FenceCreateInfo fence_create_info{
-        vk::FenceCreateFlagBits::eSignaled};
     for (size_t i = 0; i < frames_in_flight; ++i) {
       image_available_semaphores[i] =
           device_->createSemaphoreUnique(semaphore_create_info);
       render_finished_semaphores[i] =
           device_->createSemaphoreUnique(semaphore_create_info);
-      in_flight_fences[i] = device_->createFenceUnique(fence_create_info);
     }
   }
 
@@ -923,6 +2296,64 @@ private:
     create_depth_resource();
     create_frame_buffers();
     create_uniform_buffers();
+    create_node_buffers();
+    create_descriptor_pool();
+    create_descriptor_sets();
+    create_skinning_descriptor_sets();
+    create_morph_descriptor_sets();
+    create_command_buffers();
+  }
+
+  [[nodiscard]] auto milliseconds_since_start() const -> double
+  {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start_time_)
+        .count();
+  }
+
+  // Uploads the assets whose loading has finished since the last call. Until
+  // then frames are drawn without the mesh and with the placeholder material.
+  auto upload_ready_assets() -> void
+  {
+    const auto is_ready = [](const auto& future) {
+      return future.valid() && future.wait_for(std::chrono::seconds{0}) ==
+                                   std::future_status::ready;
+    };
+    const auto mesh_ready = is_ready(mesh_future_);
+    const auto materials_ready = is_ready(material_future_);
+    if (!mesh_ready && !materials_ready) {
+      return;
+    }
+
+    // The pipelines, layouts and material images of frames in flight are
+    // about to be replaced. Waiting for the frames alone lets the acquires of
+    // uploads still on the transfer queue carry on.
+    graphics_queue_.wait(std::ranges::max(in_flight_values));
+    vulkan::UploadBatch batch{*staging_ring_};
+
+    if (mesh_ready) {
+      load_model();
+      create_vertex_buffer();
+      create_index_buffer();
+      create_deformation_buffers();
+      create_node_buffers();
+      create_skinning_descriptor_sets();
+      create_morph_descriptor_sets();
+      fmt::print("Mesh visible after {:.1f} ms, {} device memory allocations\n",
+                 milliseconds_since_start(),
+                 allocator_->device_allocation_count());
+    }
+    if (materials_ready) {
+      // The layouts depend on the number of textures
+      create_materials(material_future_.get());
+      create_descriptor_set_layout();
+      create_pipeline_layout();
+      fmt::print("Materials visible after {:.1f} ms\n",
+                 milliseconds_since_start());
+    }
+    // Pipelines depend on the vertex layouts of the model and on the layouts
+    create_graphics_pipelines();
+
     create_descriptor_pool();
     create_descriptor_sets();
     create_command_buffers();
@@ -948,16 +2379,36 @@ private:
         0.1F, 10.0F);
     // ubo.proj[1][1] *= -1;
 
-    void* data = device_->mapMemory(*uniform_buffers_memory_[current_image], 0,
-                                    sizeof(ubo));
-    memcpy(data, &ubo, sizeof(ubo));
-    device_->unmapMemory(*uniform_buffers_memory_[current_image]);
+    // The first slice of the region is where the command buffers bind the
+    // frame uniforms
+    uniform_ring_.begin(current_image);
+    uniform_ring_.push(ubo);
+
+    animation_.update(time, scene_graph_, morph_weights_, thread_pool_);
+    update_morph_dispatches(current_image);
+    if (scene_graph_.update(thread_pool_)) {
+      joint_palette_.update(scene_graph_.world_matrices(), thread_pool_);
+      ++node_matrices_version_;
+    }
+    auto& version = node_buffer_versions_[current_image];
+    if (version != node_matrices_version_) {
+      const auto matrices = scene_graph_.world_matrices();
+      const glm::mat4 identity{1.0F};
+      auto* nodes = node_buffers_memory_[current_image].mapped();
+      memcpy(nodes, matrices.data(), matrices.size_bytes());
+      memcpy(nodes + matrices.size_bytes(), &identity, sizeof(identity));
+
+      if (const auto joints = joint_palette_.matrices(); !joints.empty()) {
+        memcpy(joint_buffers_memory_[current_image].mapped(), joints.data(),
+               joints.size_bytes());
+      }
+      version = node_matrices_version_;
+    }
   }
 
   auto render() -> void
   {
-    device_->waitForFences(1, &(*in_flight_fences[current_frame]), true,
-                           std::numeric_limits<uint64_t>::max());
+    graphics_queue_.wait(in_flight_values[current_frame]);
 
     const auto [result, image_index] = device_->acquireNextImageKHR(
         *swapchain_, std::numeric_limits<uint64_t>::max(),
@@ -970,30 +2421,24 @@ private:
     }
     assert(result == vk::Result::eSuccess);
 
+    // With more images than frames in flight, the frame that last rendered
+    // to this image may be another one than the current frame
+    graphics_queue_.wait(images_in_flight[image_index]);
+
     update_uniform_buffer(image_index);
 
-    vk::SubmitInfo submit_info;
-    const std::array wait_semaphores = {
-        *image_available_semaphores[current_frame]};
-    const std::array wait_stages{vk::PipelineStageFlags{
+    const std::array waits = {vulkan::SemaphoreWait{
+        *image_available_semaphores[current_frame],
         vk::PipelineStageFlagBits::eColorAttachmentOutput}};
     const std::array signal_semaphores = {
         *render_finished_semaphores[current_frame]};
 
-    submit_info
-        .setWaitSemaphoreCount(
-            static_cast<std::uint32_t>(wait_semaphores.size()))
-        .setPWaitSemaphores(wait_semaphores.data())
-        .setPWaitDstStageMask(wait_stages.data())
-        .setCommandBufferCount(1)
-        .setPCommandBuffers(&command_buffers_[image_index])
-        .setSignalSemaphoreCount(
-            static_cast<std::uint32_t>(signal_semaphores.size()))
-        .setPSignalSemaphores(signal_semaphores.data());
-
-    device_->resetFences(1, &*in_flight_fences[current_frame]);
-
-    graphics_queue_.submit(1, &submit_info, *in_flight_fences[current_frame]);
+    in_flight_values[current_frame] = graphics_queue_.submit(
+        {&command_buffers_[image_index], 1}, waits, signal_semaphores);
+    images_in_flight[image_index] = in_flight_values[current_frame];
+    for (const auto image : drawn_material_images_) {
+      material_image_residency_.touch(image, in_flight_values[current_frame]);
+    }
 
     vk::PresentInfoKHR present_info;
     present_info
@@ -1015,6 +2460,11 @@ private:
       }
     }
 
+    if (!first_frame_presented_) {
+      first_frame_presented_ = true;
+      fmt::print("First frame after {:.1f} ms\n", milliseconds_since_start());
+    }
+
     current_frame = (current_frame + 1) % frames_in_flight;
   }
 
@@ -1051,9 +2501,19 @@ private:
     }
 
     const auto supported_features = device.getFeatures();
+    // Queues signal timeline semaphores, which are core since Vulkan 1.2
+    const auto timeline_semaphore_supported =
+        device.getProperties().apiVersion >= VK_API_VERSION_1_2 &&
+        device
+            .getFeatures2<vk::PhysicalDeviceFeatures2,
+                          vk::PhysicalDeviceVulkan12Features>()
+            .get<vk::PhysicalDeviceVulkan12Features>()
+            .timelineSemaphore;
 
     return indices.is_complete() && extensions_supported &&
-           swap_chain_adequate && supported_features.samplerAnisotropy;
+           swap_chain_adequate && supported_features.samplerAnisotropy &&
+           supported_features.shaderSampledImageArrayDynamicIndexing &&
+           timeline_semaphore_supported;
   }
 
   [[nodiscard]] auto find_queue_families(const vk::PhysicalDevice& device)
@@ -1083,6 +2543,20 @@ private:
       ++i;
     }
 
+    // Graphics and compute families can transfer too, but only a family
+    // that does nothing else is backed by a separate copy engine
+    const auto transfer_only = std::ranges::find_if(
+        queue_family_properties, [](const vk::QueueFamilyProperties& property) {
+          return property.queueCount > 0 &&
+                 (property.queueFlags & vk::QueueFlagBits::eTransfer) &&
+                 !(property.queueFlags & (vk::QueueFlagBits::eGraphics |
+                                          vk::QueueFlagBits::eCompute));
+        });
+    if (transfer_only != queue_family_properties.end()) {
+      indices.transfer_family = static_cast<std::uint32_t>(
+          transfer_only - queue_family_properties.begin());
+    }
+
     return indices;
   }
 
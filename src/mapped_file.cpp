@@ -0,0 +1,118 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(std::string_view filename)
+{
+  const std::string name{filename};
+  HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("failed to open file: " + name);
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size)) {
+    CloseHandle(file);
+    throw std::runtime_error("failed to query size of file: " + name);
+  }
+  size_ = static_cast<std::size_t>(file_size.QuadPart);
+
+  if (size_ == 0) {
+    CloseHandle(file);
+    return;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
+    throw std::runtime_error("failed to map file: " + name);
+  }
+
+  // The view keeps the mapping object alive after its handle is closed
+  data_ = static_cast<std::byte*>(
+      MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  CloseHandle(mapping);
+  if (data_ == nullptr) {
+    throw std::runtime_error("failed to map file: " + name);
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+}
+
+#else
+
+MappedFile::MappedFile(std::string_view filename)
+{
+  const std::string name{filename};
+  const int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw std::runtime_error("failed to open file: " + name);
+  }
+
+  struct stat file_stat {
+  };
+  if (fstat(fd, &file_stat) == -1) {
+    close(fd);
+    throw std::runtime_error("failed to query size of file: " + name);
+  }
+  size_ = static_cast<std::size_t>(file_stat.st_size);
+
+  if (size_ == 0) {
+    close(fd);
+    return;
+  }
+
+  void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("failed to map file: " + name);
+  }
+  data_ = static_cast<std::byte*>(mapping);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_{std::exchange(other.data_, nullptr)},
+      size_{std::exchange(other.size_, 0)}
+{
+}
+
+auto MappedFile::operator=(MappedFile&& other) noexcept -> MappedFile&
+{
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  return *this;
+}
@@ -0,0 +1,46 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+/**
+ * @brief A read-only memory mapping of a whole file.
+ *
+ * The mapped bytes stay valid until the MappedFile is destroyed. Moving a
+ * MappedFile does not move the mapping, so spans into it survive the move.
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  explicit MappedFile(std::string_view filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+
+  MappedFile(MappedFile&& other) noexcept;
+  auto operator=(MappedFile&& other) noexcept -> MappedFile&;
+
+  [[nodiscard]] auto data() const noexcept -> const std::byte*
+  {
+    return data_;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t
+  {
+    return size_;
+  }
+
+  [[nodiscard]] auto bytes() const noexcept -> std::span<const std::byte>
+  {
+    return {data_, size_};
+  }
+
+private:
+  std::byte* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+#endif // MAPPED_FILE_HPP
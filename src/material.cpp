@@ -0,0 +1,236 @@
+#include "material.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+
+#include "hash.hpp"
+
+namespace {
+
+// Resolves glTF textures to deduplicated images, samplers and image/sampler
+// pairs on first use
+class MaterialBuilder {
+public:
+  explicit MaterialBuilder(GltfScene& scene)
+      : scene_{scene}, texture_indices_(scene.textures.size()),
+        image_indices_(scene.images.size())
+  {
+  }
+
+  auto add_material(const GltfMaterial& material) -> void
+  {
+    GpuMaterial result;
+    result.base_color_factor = material.base_color_factor;
+    result.emissive_factor = material.emissive_factor;
+    result.metallic_factor = material.metallic_factor;
+    result.roughness_factor = material.roughness_factor;
+    if (material.alpha_mode == GltfAlphaMode::mask) {
+      result.alpha_cutoff = material.alpha_cutoff;
+    }
+    result.base_color_texture = texture(material.base_color_texture);
+    result.metallic_roughness_texture =
+        texture(material.metallic_roughness_texture);
+    result.normal_texture = texture(material.normal_texture);
+    result.occlusion_texture = texture(material.occlusion_texture);
+    result.emissive_texture = texture(material.emissive_texture);
+    data_.materials.push_back(result);
+  }
+
+  auto finish() -> MaterialData
+  {
+    data_.materials.emplace_back();
+
+    auto& stats = data_.stats;
+    stats.unique_textures = data_.textures.size();
+    stats.unique_images = data_.images.size();
+    std::size_t unique_bytes = 0;
+    for (const auto& image : data_.images) {
+      unique_bytes += image.size_bytes();
+    }
+    stats.bytes_saved = referenced_bytes_ - unique_bytes;
+    return std::move(data_);
+  }
+
+private:
+  GltfScene& scene_;
+  MaterialData data_;
+  std::size_t referenced_bytes_ = 0;
+
+  std::vector<std::optional<std::uint32_t>> texture_indices_;
+  std::vector<std::optional<std::uint32_t>> image_indices_;
+  // Unique images by a hash of their size and pixels
+  std::unordered_multimap<std::uint64_t, std::uint32_t> image_hashes_;
+  std::map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t>
+      texture_pairs_;
+
+  [[nodiscard]] auto texture(std::optional<std::size_t> gltf_texture)
+      -> std::uint32_t
+  {
+    if (!gltf_texture) {
+      return GpuMaterial::no_texture;
+    }
+    auto& index = texture_indices_[*gltf_texture];
+    if (!index) {
+      index = resolve_texture(scene_.textures[*gltf_texture]);
+    }
+    if (*index != GpuMaterial::no_texture) {
+      ++data_.stats.referenced_textures;
+      referenced_bytes_ +=
+          data_.images[data_.textures[*index].image].size_bytes();
+    }
+    return *index;
+  }
+
+  [[nodiscard]] auto resolve_texture(const GltfTexture& texture)
+      -> std::uint32_t
+  {
+    if (!texture.source) {
+      return GpuMaterial::no_texture;
+    }
+    const auto image = resolve_image(*texture.source);
+    if (image == GpuMaterial::no_texture) {
+      return GpuMaterial::no_texture;
+    }
+
+    const auto sampler = resolve_sampler(
+        texture.sampler ? scene_.samplers[*texture.sampler] : GltfSampler{});
+    const auto [it, inserted] = texture_pairs_.try_emplace(
+        {image, sampler}, static_cast<std::uint32_t>(data_.textures.size()));
+    if (inserted) {
+      data_.textures.push_back({image, sampler});
+    }
+    return it->second;
+  }
+
+  [[nodiscard]] auto resolve_sampler(const GltfSampler& sampler)
+      -> std::uint32_t
+  {
+    // Scenes use a handful of samplers at most
+    const auto it = std::ranges::find(data_.samplers, sampler);
+    const auto index =
+        static_cast<std::uint32_t>(it - data_.samplers.begin());
+    if (it == data_.samplers.end()) {
+      data_.samplers.push_back(sampler);
+    }
+    return index;
+  }
+
+  // Returns the unique image with the same content as the glTF image
+  [[nodiscard]] auto resolve_image(std::size_t gltf_image) -> std::uint32_t
+  {
+    auto& index = image_indices_[gltf_image];
+    if (index) {
+      return *index;
+    }
+
+    auto& image = scene_.images[gltf_image];
+    if (!image.pixels) {
+      index = GpuMaterial::no_texture;
+      return *index;
+    }
+
+    const std::span pixels{image.pixels.get(), image.size_bytes()};
+    const auto hash = xxhash64(
+        pixels, (std::uint64_t{image.width} << 32) | image.height);
+    const auto [first, last] = image_hashes_.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+      const auto& other = data_.images[it->second];
+      if (other.width == image.width && other.height == image.height &&
+          std::memcmp(other.pixels.get(), pixels.data(), pixels.size()) ==
+              0) {
+        index = it->second;
+        return *index;
+      }
+    }
+
+    index = static_cast<std::uint32_t>(data_.images.size());
+    image_hashes_.emplace(hash, *index);
+    data_.images.push_back(std::move(image));
+    data_.image_sources.push_back(scene_.image_sources[gltf_image]);
+    return *index;
+  }
+};
+
+[[nodiscard]] auto to_vk_filter(std::optional<GltfFilter> filter) noexcept
+    -> vk::Filter
+{
+  switch (filter.value_or(GltfFilter::linear)) {
+  case GltfFilter::nearest:
+  case GltfFilter::nearest_mipmap_nearest:
+  case GltfFilter::nearest_mipmap_linear:
+    return vk::Filter::eNearest;
+  case GltfFilter::linear:
+  case GltfFilter::linear_mipmap_nearest:
+  case GltfFilter::linear_mipmap_linear:
+    break;
+  }
+  return vk::Filter::eLinear;
+}
+
+[[nodiscard]] auto to_vk_mipmap_mode(std::optional<GltfFilter> filter) noexcept
+    -> vk::SamplerMipmapMode
+{
+  switch (filter.value_or(GltfFilter::linear_mipmap_linear)) {
+  case GltfFilter::nearest:
+  case GltfFilter::linear:
+  case GltfFilter::nearest_mipmap_nearest:
+  case GltfFilter::linear_mipmap_nearest:
+    return vk::SamplerMipmapMode::eNearest;
+  case GltfFilter::nearest_mipmap_linear:
+  case GltfFilter::linear_mipmap_linear:
+    break;
+  }
+  return vk::SamplerMipmapMode::eLinear;
+}
+
+[[nodiscard]] auto to_vk_address_mode(GltfWrap wrap) noexcept
+    -> vk::SamplerAddressMode
+{
+  switch (wrap) {
+  case GltfWrap::clamp_to_edge:
+    return vk::SamplerAddressMode::eClampToEdge;
+  case GltfWrap::mirrored_repeat:
+    return vk::SamplerAddressMode::eMirroredRepeat;
+  case GltfWrap::repeat:
+    break;
+  }
+  return vk::SamplerAddressMode::eRepeat;
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto build_material_data(GltfScene& scene) -> MaterialData
+{
+  MaterialBuilder builder{scene};
+  for (const auto& material : scene.materials) {
+    builder.add_material(material);
+  }
+  return builder.finish();
+}
+
+[[nodiscard]] auto sampler_create_info(const GltfSampler& sampler) noexcept
+    -> vk::SamplerCreateInfo
+{
+  vk::SamplerCreateInfo create_info;
+  create_info.setMagFilter(to_vk_filter(sampler.mag_filter))
+      .setMinFilter(to_vk_filter(sampler.min_filter))
+      .setMipmapMode(to_vk_mipmap_mode(sampler.min_filter))
+      .setAddressModeU(to_vk_address_mode(sampler.wrap_s))
+      .setAddressModeV(to_vk_address_mode(sampler.wrap_t))
+      .setAddressModeW(vk::SamplerAddressMode::eRepeat)
+      .setAnisotropyEnable(true)
+      .setMaxAnisotropy(16)
+      .setBorderColor(vk::BorderColor::eIntOpaqueBlack)
+      .setUnnormalizedCoordinates(false)
+      .setCompareEnable(false)
+      .setCompareOp(vk::CompareOp::eAlways)
+      .setMipLodBias(0.F)
+      .setMinLod(0.F)
+      .setMaxLod(0.F);
+  return create_info;
+}
@@ -0,0 +1,84 @@
+#ifndef MATERIAL_HPP
+#define MATERIAL_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gltf.hpp"
+
+// A material as laid out in the material storage buffer, matching the std430
+// Material struct of shader.frag
+struct GpuMaterial {
+  static constexpr std::uint32_t no_texture = 0xFFFF'FFFF;
+
+  std::array<float, 4> base_color_factor{1.0F, 1.0F, 1.0F, 1.0F};
+  std::array<float, 3> emissive_factor{0.0F, 0.0F, 0.0F};
+  float metallic_factor = 1.0F;
+  float roughness_factor = 1.0F;
+  // Fragments with a lower alpha are discarded. Negative unless the material
+  // is alpha masked.
+  float alpha_cutoff = -1.0F;
+  // Indices into MaterialData::textures or no_texture
+  std::uint32_t base_color_texture = no_texture;
+  std::uint32_t metallic_roughness_texture = no_texture;
+  std::uint32_t normal_texture = no_texture;
+  std::uint32_t occlusion_texture = no_texture;
+  std::uint32_t emissive_texture = no_texture;
+  std::uint32_t padding = 0;
+};
+static_assert(sizeof(GpuMaterial) == 64);
+
+// An image sampled with a sampler, one element of the texture array
+struct MaterialTexture {
+  std::uint32_t image = 0;
+  std::uint32_t sampler = 0;
+
+  friend auto operator==(const MaterialTexture&, const MaterialTexture&)
+      -> bool = default;
+};
+
+struct MaterialStats {
+  // Texture slots of materials that refer to a texture
+  std::size_t referenced_textures = 0;
+  std::size_t unique_textures = 0;
+  std::size_t unique_images = 0;
+  // Decoded bytes that uploading one image per reference would have added
+  std::size_t bytes_saved = 0;
+};
+
+/**
+ * @brief The materials of a scene, ready to be uploaded.
+ *
+ * Images are deduplicated by their decoded content and samplers by their
+ * parameters, so every image and sampler is uploaded once no matter how many
+ * materials share it. Only the images and samplers that some material refers
+ * to are kept.
+ */
+struct MaterialData {
+  // The glTF materials in order, followed by the default material
+  std::vector<GpuMaterial> materials;
+  std::vector<GltfImage> images;
+  // Where each image was decoded from
+  std::vector<GltfImageSource> image_sources;
+  std::vector<GltfSampler> samplers;
+  std::vector<MaterialTexture> textures;
+  MaterialStats stats;
+
+  // The material of primitives that do not name one
+  [[nodiscard]] auto default_material() const noexcept -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(materials.size() - 1);
+  }
+};
+
+// Moves the decoded images out of scene
+[[nodiscard]] auto build_material_data(GltfScene& scene) -> MaterialData;
+
+[[nodiscard]] auto sampler_create_info(const GltfSampler& sampler) noexcept
+    -> vk::SamplerCreateInfo;
+
+#endif // MATERIAL_HPP
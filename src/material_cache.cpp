@@ -0,0 +1,277 @@
+#include "material_cache.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "cache_file.hpp"
+#include "gltf.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::array<char, 8> cache_magic = {'V', 'R', 'M', 'A',
+                                             'T', 'L', 'C', '\0'};
+// Bump whenever the layout of the file, GpuMaterial, GltfSampler,
+// MaterialTexture or MaterialStats changes
+constexpr std::uint32_t cache_version = 1;
+
+// Where the encoded bytes of an image lie
+struct CachedImage {
+  // Index into the dependencies
+  std::uint64_t file;
+  std::uint64_t byte_offset;
+  std::uint64_t byte_length;
+};
+
+struct CacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t material_size;
+  std::uint64_t source_hash;
+  // Newline separated paths of the files holding the images, relative to
+  // the glTF
+  std::uint64_t dependencies_offset;
+  std::uint64_t dependencies_size;
+  std::uint64_t materials_offset;
+  std::uint64_t material_count;
+  std::uint64_t samplers_offset;
+  std::uint64_t sampler_count;
+  std::uint64_t textures_offset;
+  std::uint64_t texture_count;
+  std::uint64_t images_offset;
+  std::uint64_t image_count;
+  MaterialStats stats;
+};
+static_assert(std::is_trivially_copyable_v<CacheHeader>);
+static_assert(std::is_trivially_copyable_v<CachedImage>);
+static_assert(std::is_trivially_copyable_v<GpuMaterial>);
+static_assert(std::is_trivially_copyable_v<GltfSampler>);
+static_assert(std::is_trivially_copyable_v<MaterialTexture>);
+
+[[nodiscard]] auto align_up(std::uint64_t value) noexcept -> std::uint64_t
+{
+  return (value + cache_section_alignment - 1) &
+         ~std::uint64_t{cache_section_alignment - 1};
+}
+
+auto print_material_stats(const MaterialData& data) -> void
+{
+  const auto& stats = data.stats;
+  constexpr double mib = 1024.0 * 1024.0;
+  fmt::print("Loaded {} materials: {} texture references, {} unique textures "
+             "of {} images, {:.2f} MiB saved by deduplication\n",
+             data.materials.size() - 1, stats.referenced_textures,
+             stats.unique_textures, stats.unique_images,
+             static_cast<double>(stats.bytes_saved) / mib);
+}
+
+// The renderer indexes its tables with the cached indices unchecked
+auto check_indices(std::span<const GpuMaterial> materials,
+                   std::size_t sampler_count,
+                   std::span<const MaterialTexture> textures,
+                   std::span<const CachedImage> images,
+                   std::size_t dependency_count) -> void
+{
+  const auto check = [](bool valid) {
+    if (!valid) {
+      throw std::runtime_error{"Material cache index is out of bounds"};
+    }
+  };
+  // The default material always comes last
+  check(!materials.empty());
+  for (const auto& material : materials) {
+    for (const auto texture :
+         {material.base_color_texture, material.metallic_roughness_texture,
+          material.normal_texture, material.occlusion_texture,
+          material.emissive_texture}) {
+      check(texture == GpuMaterial::no_texture || texture < textures.size());
+    }
+  }
+  for (const auto& texture : textures) {
+    check(texture.image < images.size() && texture.sampler < sampler_count);
+  }
+  for (const auto& image : images) {
+    check(image.file < dependency_count);
+  }
+}
+
+[[nodiscard]] auto read_material_cache(const fs::path& cache_path,
+                                       const fs::path& gltf_path,
+                                       ThreadPool& pool)
+    -> std::optional<MaterialData>
+{
+  if (!fs::exists(cache_path)) {
+    return std::nullopt;
+  }
+
+  const MappedFile cache{cache_path.string()};
+  const auto file = cache.bytes();
+
+  CacheHeader header;
+  if (file.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != cache_magic || header.version != cache_version ||
+      header.material_size != sizeof(GpuMaterial)) {
+    return std::nullopt;
+  }
+
+  const auto dependencies_bytes = cache_section(
+      file, header.dependencies_offset, header.dependencies_size);
+  const auto dependencies = split_lines(
+      {reinterpret_cast<const char*>(dependencies_bytes.data()),
+       dependencies_bytes.size()});
+  if (hash_cache_sources(gltf_path, dependencies) != header.source_hash) {
+    return std::nullopt;
+  }
+
+  const auto materials = cache_table<GpuMaterial>(
+      file, header.materials_offset, header.material_count);
+  const auto samplers = cache_table<GltfSampler>(file, header.samplers_offset,
+                                                 header.sampler_count);
+  const auto textures = cache_table<MaterialTexture>(
+      file, header.textures_offset, header.texture_count);
+  const auto images =
+      cache_table<CachedImage>(file, header.images_offset, header.image_count);
+  check_indices(materials, samplers.size(), textures, images,
+                dependencies.size());
+
+  MaterialData result;
+  result.materials.assign(materials.begin(), materials.end());
+  result.samplers.assign(samplers.begin(), samplers.end());
+  result.textures.assign(textures.begin(), textures.end());
+  result.stats = header.stats;
+  for (const auto& image : images) {
+    result.image_sources.push_back(
+        {dependencies[image.file], image.byte_offset, image.byte_length});
+  }
+
+  // Each image is decoded straight from the file holding it
+  const auto base_path = gltf_path.parent_path();
+  std::vector<std::future<GltfImage>> futures;
+  for (const auto& source : result.image_sources) {
+    futures.push_back(pool.submit([&base_path, &source] {
+      const MappedFile image_file{(base_path / source.file).string()};
+      return decode_gltf_image(cache_section(
+          image_file.bytes(), source.byte_offset, source.byte_length));
+    }));
+  }
+  // The tasks reference the sources, so they must finish before unwinding
+  for (const auto& future : futures) {
+    pool.wait(future);
+  }
+  for (auto& future : futures) {
+    result.images.push_back(future.get());
+  }
+  return result;
+}
+
+auto write_material_cache(const fs::path& cache_path,
+                          const fs::path& gltf_path, const MaterialData& data)
+    -> void
+{
+  // Images are referred to by the file they are stored in, which data uris
+  // and buffers held in memory lack
+  std::vector<std::string> dependencies;
+  std::vector<CachedImage> images;
+  for (std::size_t i = 0; i < data.image_sources.size(); ++i) {
+    const auto& source = data.image_sources[i];
+    if (source.file.empty()) {
+      throw std::runtime_error{
+          fmt::format("image {} is not stored in a file", i)};
+    }
+    const auto file = static_cast<std::uint64_t>(
+        std::ranges::find(dependencies, source.file) - dependencies.begin());
+    if (file == dependencies.size()) {
+      dependencies.push_back(source.file);
+    }
+    images.push_back({file, source.byte_offset, source.byte_length});
+  }
+  const auto dependency_list = join_lines(dependencies);
+
+  CacheHeader header{};
+  header.magic = cache_magic;
+  header.version = cache_version;
+  header.material_size = sizeof(GpuMaterial);
+  header.source_hash = hash_cache_sources(gltf_path, dependencies);
+  header.dependencies_offset = sizeof(CacheHeader);
+  header.dependencies_size = dependency_list.size();
+  header.materials_offset =
+      align_up(header.dependencies_offset + header.dependencies_size);
+  header.material_count = data.materials.size();
+  header.samplers_offset = align_up(
+      header.materials_offset + data.materials.size() * sizeof(GpuMaterial));
+  header.sampler_count = data.samplers.size();
+  header.textures_offset = align_up(
+      header.samplers_offset + data.samplers.size() * sizeof(GltfSampler));
+  header.texture_count = data.textures.size();
+  header.images_offset =
+      align_up(header.textures_offset +
+               data.textures.size() * sizeof(MaterialTexture));
+  header.image_count = images.size();
+  header.stats = data.stats;
+
+  CacheWriter file{cache_path};
+  file.write_at(0, &header, sizeof(header));
+  file.write_at(header.dependencies_offset, dependency_list.data(),
+                dependency_list.size());
+  file.write_at(header.materials_offset, data.materials.data(),
+                data.materials.size() * sizeof(GpuMaterial));
+  file.write_at(header.samplers_offset, data.samplers.data(),
+                data.samplers.size() * sizeof(GltfSampler));
+  file.write_at(header.textures_offset, data.textures.data(),
+                data.textures.size() * sizeof(MaterialTexture));
+  file.write_at(header.images_offset, images.data(),
+                images.size() * sizeof(CachedImage));
+  file.commit();
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto load_material_data(std::string_view filename,
+                                      ThreadPool& pool) -> MaterialData
+{
+  const fs::path gltf_path{filename};
+  const fs::path cache_path{gltf_path.string() + ".materialcache"};
+
+  try {
+    if (auto cached = read_material_cache(cache_path, gltf_path, pool);
+        cached) {
+      print_material_stats(*cached);
+      return std::move(*cached);
+    }
+  } catch (const std::exception& e) {
+    // A broken cache or a missing image file falls back to a full load
+    fmt::print(stderr, "Ignoring material cache {}: {}\n",
+               cache_path.string(), e.what());
+  }
+
+  auto scene_future = load_gltf_scene_async(filename, pool);
+  pool.wait(scene_future);
+  auto scene = scene_future.get();
+  auto data = build_material_data(scene);
+  print_material_stats(data);
+
+  try {
+    write_material_cache(cache_path, gltf_path, data);
+  } catch (const std::exception& e) {
+    fmt::print(stderr, "Failed to write material cache {}: {}\n",
+               cache_path.string(), e.what());
+  }
+
+  return data;
+}
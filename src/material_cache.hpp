@@ -0,0 +1,23 @@
+#ifndef MATERIAL_CACHE_HPP
+#define MATERIAL_CACHE_HPP
+
+#include <string_view>
+
+#include "material.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief Loads the materials of a glTF file and their images.
+ *
+ * The material, sampler and texture tables are read from
+ * "<filename>.materialcache" along with where the encoded bytes of every
+ * image are stored, if the content hash of the glTF file and the files
+ * holding the images matches the one stored in the cache. Only the images
+ * are then decoded, on the thread pool and without parsing any JSON.
+ * Otherwise the scene is loaded and the cache rewritten.
+ */
+[[nodiscard]] auto load_material_data(std::string_view filename,
+                                      ThreadPool& pool) -> MaterialData;
+
+#endif // MATERIAL_CACHE_HPP
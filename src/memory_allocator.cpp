@@ -0,0 +1,561 @@
+#include "memory_allocator.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+namespace vulkan {
+
+namespace {
+
+// Smallest range handed out, which also keeps every range aligned to the
+// usual buffer offset alignments
+constexpr vk::DeviceSize min_range_size = 256;
+
+constexpr vk::DeviceSize max_block_size = vk::DeviceSize{64} << 20U;
+constexpr vk::DeviceSize min_block_size = vk::DeviceSize{1} << 20U;
+
+} // anonymous namespace
+
+struct MemoryBlock {
+  vk::UniqueDeviceMemory memory;
+  // Start of the block in host memory, if it is host visible
+  std::byte* mapped = nullptr;
+  std::size_t pool = 0;
+  std::uint32_t heap = 0;
+  vk::DeviceSize size = 0;
+  // Dedicated blocks hold exactly one allocation and are never split
+  bool dedicated = false;
+  // Set while defragmentation moves the allocations out of the block, which
+  // keeps new ones from being placed in it
+  bool evacuating = false;
+  std::size_t allocation_count = 0;
+  // Allocations whose owner does not move them, which keep the block from
+  // being evacuated
+  std::size_t pinned_count = 0;
+  // Bytes of the ranges handed out
+  vk::DeviceSize range_bytes = 0;
+  // Offsets of the free ranges by order. A range of order k spans
+  // min_range_size << k bytes.
+  std::vector<std::set<vk::DeviceSize>> free_ranges;
+};
+
+namespace {
+
+// Order of the smallest range holding size bytes at the given alignment
+[[nodiscard]] auto range_order(vk::DeviceSize size,
+                               vk::DeviceSize alignment) noexcept
+    -> std::uint32_t
+{
+  const auto range_size = std::bit_ceil(std::max({size, alignment,
+                                                  min_range_size}));
+  return static_cast<std::uint32_t>(
+      std::countr_zero(range_size / min_range_size));
+}
+
+// Takes the lowest free range of the order, splitting a larger one if needed
+[[nodiscard]] auto take_range(MemoryBlock& block, std::uint32_t order)
+    -> std::optional<vk::DeviceSize>
+{
+  auto found = std::size_t{order};
+  while (found < block.free_ranges.size() &&
+         block.free_ranges[found].empty()) {
+    ++found;
+  }
+  if (found == block.free_ranges.size()) {
+    return std::nullopt;
+  }
+
+  auto& ranges = block.free_ranges[found];
+  const auto offset = *ranges.begin();
+  ranges.erase(ranges.begin());
+  // Every split frees the upper half
+  while (found > order) {
+    --found;
+    block.free_ranges[found].insert(offset + (min_range_size << found));
+  }
+  return offset;
+}
+
+// Frees a range, merging it with its buddy for as long as that is free too
+auto return_range(MemoryBlock& block, vk::DeviceSize offset,
+                  std::uint32_t order) -> void
+{
+  auto merged = std::size_t{order};
+  while (merged + 1 < block.free_ranges.size()) {
+    auto& ranges = block.free_ranges[merged];
+    const auto buddy = ranges.find(offset ^ (min_range_size << merged));
+    if (buddy == ranges.end()) {
+      break;
+    }
+    offset = std::min(offset, *buddy);
+    ranges.erase(buddy);
+    ++merged;
+  }
+  block.free_ranges[merged].insert(offset);
+}
+
+} // anonymous namespace
+
+Allocation::~Allocation()
+{
+  if (allocator_ != nullptr) {
+    allocator_->free(*this);
+  }
+}
+
+Allocation::Allocation(Allocation&& other) noexcept
+    : allocator_{std::exchange(other.allocator_, nullptr)},
+      block_{std::exchange(other.block_, nullptr)},
+      offset_{std::exchange(other.offset_, 0)},
+      size_{std::exchange(other.size_, 0)},
+      mapped_{std::exchange(other.mapped_, nullptr)},
+      order_{std::exchange(other.order_, 0)},
+      movable_{std::exchange(other.movable_, false)}
+{
+}
+
+auto Allocation::operator=(Allocation&& other) noexcept -> Allocation&
+{
+  if (this != &other) {
+    if (allocator_ != nullptr) {
+      allocator_->free(*this);
+    }
+    allocator_ = std::exchange(other.allocator_, nullptr);
+    block_ = std::exchange(other.block_, nullptr);
+    offset_ = std::exchange(other.offset_, 0);
+    size_ = std::exchange(other.size_, 0);
+    mapped_ = std::exchange(other.mapped_, nullptr);
+    order_ = std::exchange(other.order_, 0);
+    movable_ = std::exchange(other.movable_, false);
+  }
+  return *this;
+}
+
+auto Allocation::memory() const noexcept -> vk::DeviceMemory
+{
+  return block_ == nullptr ? vk::DeviceMemory{} : *block_->memory;
+}
+
+auto Allocation::heap() const noexcept -> std::uint32_t
+{
+  return block_ == nullptr ? 0 : block_->heap;
+}
+
+MemoryAllocator::MemoryAllocator(vk::PhysicalDevice physical_device,
+                                 vk::Device device,
+                                 bool memory_budget_supported)
+    : physical_device_{physical_device}, device_{device},
+      memory_budget_supported_{memory_budget_supported},
+      memory_properties_{physical_device.getMemoryProperties()},
+      buffer_image_granularity_{
+          physical_device.getProperties().limits.bufferImageGranularity},
+      pools_(std::size_t{memory_properties_.memoryTypeCount} * 2),
+      heap_usage_(memory_properties_.memoryHeapCount)
+{
+  for (std::uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i) {
+    const auto heap = memory_properties_.memoryTypes[i].heapIndex;
+    const auto heap_size = memory_properties_.memoryHeaps[heap].size;
+    // Small heaps, such as the host visible window into device memory, get
+    // smaller blocks so that one block cannot exhaust them
+    block_sizes_.push_back(std::clamp(std::bit_floor(heap_size / 8),
+                                      min_block_size, max_block_size));
+  }
+}
+
+MemoryAllocator::~MemoryAllocator() = default;
+
+auto MemoryAllocator::allocate(vk::Buffer buffer,
+                               vk::MemoryPropertyFlags properties)
+    -> Allocation
+{
+  auto requirements =
+      device_.getBufferMemoryRequirements2<vk::MemoryRequirements2,
+                                           vk::MemoryDedicatedRequirements>(
+          vk::BufferMemoryRequirementsInfo2{buffer});
+  const auto& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+  const vk::MemoryDedicatedAllocateInfo dedicated_info{{}, buffer};
+
+  auto allocation = allocate(
+      requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+      properties, false,
+      dedicated.prefersDedicatedAllocation == VK_TRUE ||
+              dedicated.requiresDedicatedAllocation == VK_TRUE
+          ? &dedicated_info
+          : nullptr);
+  device_.bindBufferMemory(buffer, allocation.memory(), allocation.offset());
+  return allocation;
+}
+
+auto MemoryAllocator::allocate(vk::Image image, vk::ImageTiling tiling,
+                               vk::MemoryPropertyFlags properties)
+    -> Allocation
+{
+  auto requirements =
+      device_.getImageMemoryRequirements2<vk::MemoryRequirements2,
+                                          vk::MemoryDedicatedRequirements>(
+          vk::ImageMemoryRequirementsInfo2{image});
+  const auto& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+  const vk::MemoryDedicatedAllocateInfo dedicated_info{image};
+
+  auto allocation = allocate(
+      requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+      properties, tiling == vk::ImageTiling::eOptimal,
+      dedicated.prefersDedicatedAllocation == VK_TRUE ||
+              dedicated.requiresDedicatedAllocation == VK_TRUE
+          ? &dedicated_info
+          : nullptr);
+  device_.bindImageMemory(image, allocation.memory(), allocation.offset());
+  return allocation;
+}
+
+auto MemoryAllocator::device_allocation_count() const -> std::size_t
+{
+  const std::scoped_lock lock{mutex_};
+  std::size_t count = 0;
+  for (const auto& pool : pools_) {
+    count += pool.blocks.size();
+  }
+  return count;
+}
+
+auto MemoryAllocator::heap_budgets() const -> std::vector<HeapBudget>
+{
+  std::vector<HeapBudget> budgets(memory_properties_.memoryHeapCount);
+  const std::scoped_lock lock{mutex_};
+  if (!memory_budget_supported_) {
+    // The share VK_EXT_memory_budget implementations commonly report for a
+    // process alone on the device
+    for (std::size_t i = 0; i < budgets.size(); ++i) {
+      budgets[i] = {heap_usage_[i].range_bytes,
+                    memory_properties_.memoryHeaps[i].size / 10 * 8};
+    }
+    return budgets;
+  }
+
+  auto properties = physical_device_.getMemoryProperties2<
+      vk::PhysicalDeviceMemoryProperties2,
+      vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+  const auto& budget =
+      properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+  for (std::size_t i = 0; i < budgets.size(); ++i) {
+    const auto free_bytes =
+        heap_usage_[i].block_bytes - heap_usage_[i].range_bytes;
+    budgets[i] = {budget.heapUsage[i] - std::min(budget.heapUsage[i],
+                                                  free_bytes),
+                  budget.heapBudget[i]};
+  }
+  return budgets;
+}
+
+auto MemoryAllocator::find_memory_type(std::uint32_t type_filter,
+                                       vk::MemoryPropertyFlags properties) const
+    -> std::uint32_t
+{
+  for (uint32_t i = 0; i < memory_properties_.memoryTypeCount; i++) {
+    if ((type_filter & (1U << i)) != 0 &&
+        (memory_properties_.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+auto MemoryAllocator::pool_index(std::uint32_t memory_type,
+                                 bool optimal) const noexcept -> std::size_t
+{
+  // Ranges start and end on multiples of min_range_size, so a linear and an
+  // optimal resource can only share a granularity page if it is larger
+  const auto separate =
+      optimal && buffer_image_granularity_ > min_range_size;
+  return std::size_t{memory_type} * 2 + (separate ? 1 : 0);
+}
+
+auto MemoryAllocator::create_block(
+    std::uint32_t memory_type, vk::DeviceSize size,
+    const vk::MemoryDedicatedAllocateInfo* dedicated)
+    -> std::unique_ptr<MemoryBlock>
+{
+  vk::MemoryAllocateInfo alloc_info{size, memory_type};
+  alloc_info.setPNext(dedicated);
+
+  auto block = std::make_unique<MemoryBlock>();
+  block->heap = memory_properties_.memoryTypes[memory_type].heapIndex;
+  block->size = size;
+  block->memory = device_.allocateMemoryUnique(alloc_info);
+  if (memory_properties_.memoryTypes[memory_type].propertyFlags &
+      vk::MemoryPropertyFlagBits::eHostVisible) {
+    // A memory object can only be mapped once, so every allocation in the
+    // block shares this mapping
+    block->mapped = static_cast<std::byte*>(
+        device_.mapMemory(*block->memory, 0, VK_WHOLE_SIZE));
+  }
+  return block;
+}
+
+auto MemoryAllocator::allocate(
+    const vk::MemoryRequirements& requirements,
+    vk::MemoryPropertyFlags properties, bool optimal,
+    const vk::MemoryDedicatedAllocateInfo* dedicated) -> Allocation
+{
+  const auto memory_type =
+      find_memory_type(requirements.memoryTypeBits, properties);
+  const auto block_size = block_sizes_[memory_type];
+  const auto order = range_order(requirements.size, requirements.alignment);
+
+  const std::scoped_lock lock{mutex_};
+  const auto pool = pool_index(memory_type, optimal);
+  auto& blocks = pools_[pool].blocks;
+
+  // The allocator is only set once the allocation succeeded, so that a
+  // throw does not free it with the lock held
+  Allocation allocation;
+  allocation.size_ = requirements.size;
+
+  // Offset 0 satisfies any alignment, so a dedicated block needs no padding
+  if (dedicated != nullptr || (min_range_size << order) > block_size / 2) {
+    auto block = create_block(memory_type, requirements.size, dedicated);
+    block->pool = pool;
+    block->dedicated = true;
+    block->allocation_count = 1;
+    block->pinned_count = 1;
+    allocation.allocator_ = this;
+    allocation.block_ = block.get();
+    allocation.mapped_ = block->mapped;
+    heap_usage_[block->heap].block_bytes += block->size;
+    heap_usage_[block->heap].range_bytes += block->size;
+    blocks.push_back(std::move(block));
+    return allocation;
+  }
+
+  if (auto placed = take_from_pool(pool, order, requirements.size, false)) {
+    return placed;
+  }
+
+  auto block = create_block(memory_type, block_size, nullptr);
+  block->pool = pool;
+  block->free_ranges.resize(
+      static_cast<std::size_t>(std::countr_zero(block_size / min_range_size)) +
+      1);
+  block->free_ranges.back().insert(0);
+  const auto offset = take_range(*block, order);
+  if (!offset) {
+    throw std::runtime_error{fmt::format(
+        "failed to place {} bytes in a new memory block", requirements.size)};
+  }
+  allocation = place(*block, *offset, order, requirements.size);
+  heap_usage_[block->heap].block_bytes += block->size;
+  blocks.push_back(std::move(block));
+  return allocation;
+}
+
+auto MemoryAllocator::place(MemoryBlock& block, vk::DeviceSize offset,
+                            std::uint32_t order, vk::DeviceSize size)
+    -> Allocation
+{
+  const auto range_size = min_range_size << order;
+  ++block.allocation_count;
+  ++block.pinned_count;
+  block.range_bytes += range_size;
+  heap_usage_[block.heap].range_bytes += range_size;
+
+  Allocation allocation;
+  allocation.allocator_ = this;
+  allocation.block_ = &block;
+  allocation.offset_ = offset;
+  allocation.size_ = size;
+  allocation.order_ = order;
+  allocation.mapped_ =
+      block.mapped == nullptr ? nullptr : block.mapped + offset;
+  return allocation;
+}
+
+auto MemoryAllocator::take_from_pool(std::size_t pool, std::uint32_t order,
+                                     vk::DeviceSize size, bool relocating)
+    -> Allocation
+{
+  for (const auto& block : pools_[pool].blocks) {
+    // Moving to an empty block would not free any
+    if (block->dedicated || block->evacuating ||
+        (relocating && block->allocation_count == 0)) {
+      continue;
+    }
+    if (const auto offset = take_range(*block, order)) {
+      auto allocation = place(*block, *offset, order, size);
+      if (relocating) {
+        allocation.movable_ = true;
+        --block->pinned_count;
+      }
+      return allocation;
+    }
+  }
+  return {};
+}
+
+auto MemoryAllocator::fragmentation_stats() const -> FragmentationStats
+{
+  const std::scoped_lock lock{mutex_};
+  FragmentationStats stats;
+  for (const auto& pool : pools_) {
+    for (const auto& block : pool.blocks) {
+      if (block->dedicated || !defragmentable(block->pool)) {
+        continue;
+      }
+      ++stats.block_count;
+      stats.free_bytes += block->size - block->range_bytes;
+      for (std::size_t order = block->free_ranges.size(); order-- > 0;) {
+        if (!block->free_ranges[order].empty()) {
+          stats.largest_free_range =
+              std::max(stats.largest_free_range, min_range_size << order);
+          break;
+        }
+      }
+    }
+  }
+  return stats;
+}
+
+auto MemoryAllocator::set_movable(Allocation& allocation) -> void
+{
+  const std::scoped_lock lock{mutex_};
+  if (allocation.block_ != nullptr && !allocation.movable_) {
+    allocation.movable_ = true;
+    --allocation.block_->pinned_count;
+  }
+}
+
+auto MemoryAllocator::begin_defragmentation() -> bool
+{
+  const std::scoped_lock lock{mutex_};
+  auto started = false;
+  for (auto& pool : pools_) {
+    // The least used block whose allocations can all move is emptied if
+    // the other used blocks have room for its ranges
+    MemoryBlock* source = nullptr;
+    vk::DeviceSize free_elsewhere = 0;
+    for (const auto& block : pool.blocks) {
+      if (block->dedicated || block->allocation_count == 0 ||
+          !defragmentable(block->pool)) {
+        continue;
+      }
+      free_elsewhere += block->size - block->range_bytes;
+      if (block->pinned_count == 0 &&
+          (source == nullptr || block->range_bytes < source->range_bytes)) {
+        source = block.get();
+      }
+    }
+    if (source == nullptr) {
+      continue;
+    }
+    free_elsewhere -= source->size - source->range_bytes;
+    if (free_elsewhere >= source->range_bytes) {
+      source->evacuating = true;
+      started = true;
+    }
+  }
+  return started;
+}
+
+auto MemoryAllocator::end_defragmentation() -> void
+{
+  const std::scoped_lock lock{mutex_};
+  for (auto& pool : pools_) {
+    for (auto& block : pool.blocks) {
+      block->evacuating = false;
+    }
+  }
+}
+
+auto MemoryAllocator::is_evacuating(const Allocation& allocation) const
+    -> bool
+{
+  const std::scoped_lock lock{mutex_};
+  return allocation.block_ != nullptr && allocation.block_->evacuating;
+}
+
+auto MemoryAllocator::relocate(vk::Buffer buffer, const Allocation& old)
+    -> Allocation
+{
+  const auto requirements = device_.getBufferMemoryRequirements(buffer);
+  auto allocation = relocate(requirements, old);
+  if (allocation) {
+    device_.bindBufferMemory(buffer, allocation.memory(),
+                             allocation.offset());
+  }
+  return allocation;
+}
+
+auto MemoryAllocator::relocate(vk::Image image, const Allocation& old)
+    -> Allocation
+{
+  const auto requirements = device_.getImageMemoryRequirements(image);
+  auto allocation = relocate(requirements, old);
+  if (allocation) {
+    device_.bindImageMemory(image, allocation.memory(), allocation.offset());
+  }
+  return allocation;
+}
+
+auto MemoryAllocator::relocate(const vk::MemoryRequirements& requirements,
+                               const Allocation& old) -> Allocation
+{
+  const std::scoped_lock lock{mutex_};
+  if (old.block_ == nullptr || old.block_->dedicated) {
+    return {};
+  }
+  // The resource was created like the old one, so the memory type of the
+  // old block suits it
+  return take_from_pool(old.block_->pool,
+                        range_order(requirements.size, requirements.alignment),
+                        requirements.size, true);
+}
+
+auto MemoryAllocator::defragmentable(std::size_t pool) const noexcept -> bool
+{
+  // Two pools per memory type
+  const auto flags = memory_properties_.memoryTypes[pool / 2].propertyFlags;
+  return (flags & vk::MemoryPropertyFlagBits::eDeviceLocal) &&
+         !(flags & vk::MemoryPropertyFlagBits::eHostVisible);
+}
+
+auto MemoryAllocator::free(const Allocation& allocation) noexcept -> void
+{
+  const std::scoped_lock lock{mutex_};
+  auto* block = allocation.block_;
+  auto& blocks = pools_[block->pool].blocks;
+  auto& usage = heap_usage_[block->heap];
+  if (!allocation.movable_) {
+    --block->pinned_count;
+  }
+  if (!block->dedicated) {
+    return_range(*block, allocation.offset_, allocation.order_);
+    block->range_bytes -= min_range_size << allocation.order_;
+    usage.range_bytes -= min_range_size << allocation.order_;
+    if (--block->allocation_count > 0) {
+      return;
+    }
+    // One empty block per pool stays around, so that a resource recreated
+    // every swapchain resize does not allocate device memory again
+    const auto empty_blocks =
+        std::ranges::count_if(blocks, [](const auto& other) {
+          return !other->dedicated && other->allocation_count == 0;
+        });
+    if (empty_blocks < 2) {
+      return;
+    }
+  } else {
+    usage.range_bytes -= block->size;
+  }
+  usage.block_bytes -= block->size;
+  std::erase_if(blocks,
+                [block](const auto& other) { return other.get() == block; });
+}
+
+} // namespace vulkan
@@ -0,0 +1,236 @@
+#ifndef MEMORY_ALLOCATOR_HPP
+#define MEMORY_ALLOCATOR_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vulkan {
+
+class MemoryAllocator;
+struct MemoryBlock;
+
+// How much of a memory heap is in use and how much the process may use
+struct HeapBudget {
+  vk::DeviceSize usage = 0;
+  vk::DeviceSize budget = 0;
+};
+
+// Free space of the blocks that defragmentation can empty
+struct FragmentationStats {
+  std::size_t block_count = 0;
+  vk::DeviceSize free_bytes = 0;
+  vk::DeviceSize largest_free_range = 0;
+
+  // Share of the free bytes that the largest allocation possible without a
+  // new block could not use
+  [[nodiscard]] auto fragmentation() const noexcept -> double
+  {
+    return free_bytes == 0 ? 0.0
+                           : 1.0 - static_cast<double>(largest_free_range) /
+                                       static_cast<double>(free_bytes);
+  }
+
+  friend auto operator==(const FragmentationStats&,
+                         const FragmentationStats&) -> bool = default;
+};
+
+/**
+ * @brief A range of device memory handed out by a MemoryAllocator.
+ *
+ * The range goes back to its allocator on destruction. Host visible memory
+ * stays mapped for as long as its block lives, so mapped() can be written at
+ * any time without mapping the memory again.
+ */
+class Allocation {
+public:
+  Allocation() = default;
+  ~Allocation();
+
+  Allocation(const Allocation&) = delete;
+  auto operator=(const Allocation&) -> Allocation& = delete;
+  Allocation(Allocation&& other) noexcept;
+  auto operator=(Allocation&& other) noexcept -> Allocation&;
+
+  [[nodiscard]] explicit operator bool() const noexcept
+  {
+    return block_ != nullptr;
+  }
+
+  [[nodiscard]] auto memory() const noexcept -> vk::DeviceMemory;
+
+  // Index of the memory heap the range was allocated from
+  [[nodiscard]] auto heap() const noexcept -> std::uint32_t;
+
+  [[nodiscard]] auto offset() const noexcept -> vk::DeviceSize
+  {
+    return offset_;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> vk::DeviceSize
+  {
+    return size_;
+  }
+
+  // Start of the range in host memory, or nullptr if it is not host visible
+  [[nodiscard]] auto mapped() const noexcept -> std::byte*
+  {
+    return mapped_;
+  }
+
+private:
+  friend class MemoryAllocator;
+
+  MemoryAllocator* allocator_ = nullptr;
+  MemoryBlock* block_ = nullptr;
+  vk::DeviceSize offset_ = 0;
+  vk::DeviceSize size_ = 0;
+  std::byte* mapped_ = nullptr;
+  // Size of the range as a power of two multiple of the smallest range
+  std::uint32_t order_ = 0;
+  // Whether the owner moves the resource when its block is evacuated
+  bool movable_ = false;
+};
+
+/**
+ * @brief Sub-allocates buffers and images from a few large blocks per memory
+ * type.
+ *
+ * Every block is split with a buddy allocator, whose power of two ranges are
+ * aligned to their own size and so satisfy any alignment up to it. Resources
+ * larger than half a block, and images the driver wants to keep apart, get a
+ * dedicated allocation instead. Linear and optimal resources only share
+ * blocks if bufferImageGranularity cannot place them on the same page.
+ *
+ * The bytes in use are counted per heap. With VK_EXT_memory_budget the
+ * driver reports usage and budget, which accounts for other processes and
+ * the driver's own allocations; otherwise the budget is a fixed share of the
+ * heap size.
+ *
+ * Defragmentation empties the least used block of each device local pool
+ * that is not host visible. The allocator cannot copy resources itself:
+ * between begin_defragmentation() and end_defragmentation() the owners of
+ * allocations in evacuating blocks create a copy of their resource, place it
+ * with relocate(), copy the contents over and free the old allocation.
+ * Owners opt in with set_movable(), and blocks holding any allocation that
+ * did not are left alone.
+ *
+ * Allocations refer back to the allocator, which therefore has to outlive
+ * all of them.
+ */
+class MemoryAllocator {
+public:
+  // memory_budget_supported tells whether VK_EXT_memory_budget is enabled
+  // on device
+  MemoryAllocator(vk::PhysicalDevice physical_device, vk::Device device,
+                  bool memory_budget_supported);
+  ~MemoryAllocator();
+
+  MemoryAllocator(const MemoryAllocator&) = delete;
+  auto operator=(const MemoryAllocator&) -> MemoryAllocator& = delete;
+  MemoryAllocator(MemoryAllocator&&) = delete;
+  auto operator=(MemoryAllocator&&) -> MemoryAllocator& = delete;
+
+  // Allocates memory for a buffer and binds it
+  [[nodiscard]] auto allocate(vk::Buffer buffer,
+                              vk::MemoryPropertyFlags properties)
+      -> Allocation;
+
+  // Allocates memory for an image created with tiling and binds it
+  [[nodiscard]] auto allocate(vk::Image image, vk::ImageTiling tiling,
+                              vk::MemoryPropertyFlags properties)
+      -> Allocation;
+
+  // Number of vkAllocateMemory calls currently alive
+  [[nodiscard]] auto device_allocation_count() const -> std::size_t;
+
+  // Indexed by heap. Free ranges of the blocks do not count as used, as
+  // allocations take them before allocating device memory again.
+  [[nodiscard]] auto heap_budgets() const -> std::vector<HeapBudget>;
+
+  [[nodiscard]] auto fragmentation_stats() const -> FragmentationStats;
+
+  // Tells that the owner of allocation moves its resource out of evacuating
+  // blocks. Relocated allocations are movable already.
+  auto set_movable(Allocation& allocation) -> void;
+
+  // Marks the blocks to empty, returning false if no block can be emptied.
+  // Nothing new is placed in them until end_defragmentation().
+  auto begin_defragmentation() -> bool;
+  auto end_defragmentation() -> void;
+
+  // Whether the allocation has to move for its block to be emptied
+  [[nodiscard]] auto is_evacuating(const Allocation& allocation) const
+      -> bool;
+
+  // Allocates memory for a resource created like the one of old outside the
+  // evacuating blocks and binds it. Returns an empty allocation if no other
+  // block has room, as moving to a new block would not free any memory.
+  [[nodiscard]] auto relocate(vk::Buffer buffer, const Allocation& old)
+      -> Allocation;
+  [[nodiscard]] auto relocate(vk::Image image, const Allocation& old)
+      -> Allocation;
+
+private:
+  friend class Allocation;
+
+  // The blocks of one memory type holding one kind of resource
+  struct Pool {
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;
+  };
+
+  struct HeapUsage {
+    // Device memory of the blocks
+    vk::DeviceSize block_bytes = 0;
+    // Bytes of the ranges handed out
+    vk::DeviceSize range_bytes = 0;
+  };
+
+  vk::PhysicalDevice physical_device_;
+  vk::Device device_;
+  bool memory_budget_supported_ = false;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+  vk::DeviceSize buffer_image_granularity_ = 1;
+  // Indexed by memory type
+  std::vector<vk::DeviceSize> block_sizes_;
+  // Two per memory type: linear resources, then optimal images if they
+  // cannot share blocks with linear resources
+  std::vector<Pool> pools_;
+  // Indexed by heap
+  std::vector<HeapUsage> heap_usage_;
+  mutable std::mutex mutex_;
+
+  [[nodiscard]] auto find_memory_type(std::uint32_t type_filter,
+                                      vk::MemoryPropertyFlags properties) const
+      -> std::uint32_t;
+  [[nodiscard]] auto pool_index(std::uint32_t memory_type,
+                                bool optimal) const noexcept -> std::size_t;
+  [[nodiscard]] auto
+  create_block(std::uint32_t memory_type, vk::DeviceSize size,
+               const vk::MemoryDedicatedAllocateInfo* dedicated)
+      -> std::unique_ptr<MemoryBlock>;
+  [[nodiscard]] auto
+  allocate(const vk::MemoryRequirements& requirements,
+           vk::MemoryPropertyFlags properties, bool optimal,
+           const vk::MemoryDedicatedAllocateInfo* dedicated) -> Allocation;
+  // Both require the lock to be held
+  [[nodiscard]] auto place(MemoryBlock& block, vk::DeviceSize offset,
+                           std::uint32_t order, vk::DeviceSize size)
+      -> Allocation;
+  // Returns an empty allocation if no block of the pool has room
+  [[nodiscard]] auto take_from_pool(std::size_t pool, std::uint32_t order,
+                                    vk::DeviceSize size, bool relocating)
+      -> Allocation;
+  [[nodiscard]] auto relocate(const vk::MemoryRequirements& requirements,
+                              const Allocation& old) -> Allocation;
+  [[nodiscard]] auto defragmentable(std::size_t pool) const noexcept -> bool;
+  auto free(const Allocation& allocation) noexcept -> void;
+};
+
+} // namespace vulkan
+
+#endif // MEMORY_ALLOCATOR_HPP
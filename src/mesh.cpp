@@ -0,0 +1,501 @@
+#include "mesh.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+#include "gltf.hpp"
+#include "thread_pool.hpp"
+
+// Picks the format an attribute is uploaded in. Normalized integers stay
+// quantized, everything else is converted to float32.
+static auto attribute_format(const GltfAccessor& accessor,
+                             std::uint8_t float_count) -> VertexAttributeFormat
+{
+  const auto count = static_cast<std::uint8_t>(component_count(accessor.type));
+  if (accessor.normalized) {
+    switch (accessor.component_type) {
+    case GltfComponentType::u8:
+      return {VertexComponent::unorm8, count};
+    case GltfComponentType::i8:
+      return {VertexComponent::snorm8, count};
+    case GltfComponentType::u16:
+      return {VertexComponent::unorm16, count};
+    case GltfComponentType::i16:
+      return {VertexComponent::snorm16, count};
+    default:
+      break;
+    }
+  }
+  return {VertexComponent::f32, float_count};
+}
+
+static auto is_skinned(const GltfPrimitive& primitive) -> bool
+{
+  return primitive.joints0 && primitive.weights0;
+}
+
+static auto is_morphed(const GltfPrimitive& primitive) -> bool
+{
+  return std::ranges::any_of(primitive.targets, [](const auto& target) {
+    return target.position.has_value();
+  });
+}
+
+static auto vertex_layout(const GltfScene& scene,
+                          const GltfPrimitive& primitive) -> VertexLayout
+{
+  VertexLayout layout;
+  // The skinning and morph passes write float32 positions
+  layout.position =
+      is_skinned(primitive) || is_morphed(primitive)
+          ? VertexAttributeFormat{VertexComponent::f32, 3}
+          : attribute_format(scene.accessors[*primitive.position], 3);
+  // Missing attributes take the smallest formats, filled with defaults
+  layout.color = primitive.color0
+                     ? attribute_format(scene.accessors[*primitive.color0], 3)
+                     : VertexAttributeFormat{VertexComponent::unorm8, 4};
+  layout.texcoord =
+      primitive.texcoord0
+          ? attribute_format(scene.accessors[*primitive.texcoord0], 2)
+          : VertexAttributeFormat{VertexComponent::unorm16, 2};
+  return layout;
+}
+
+// Writes the largest representable value into every component, which is
+// white for colors
+static auto fill_ones(VertexAttributeFormat format, std::size_t offset,
+                      std::size_t stride, std::span<std::byte> vertices)
+    -> void
+{
+  std::array<std::byte, 16> one{};
+  const auto component_size = format.component_size();
+  for (std::size_t c = 0; c < format.padded_count(); ++c) {
+    auto* component = one.data() + c * component_size;
+    switch (format.component) {
+    case VertexComponent::f32: {
+      constexpr float value = 1.0F;
+      std::memcpy(component, &value, sizeof(value));
+    } break;
+    case VertexComponent::unorm8:
+      component[0] = std::byte{0xFF};
+      break;
+    case VertexComponent::snorm8:
+      component[0] = std::byte{0x7F};
+      break;
+    case VertexComponent::unorm16: {
+      constexpr std::uint16_t value = 0xFFFF;
+      std::memcpy(component, &value, sizeof(value));
+    } break;
+    case VertexComponent::snorm16: {
+      constexpr std::uint16_t value = 0x7FFF;
+      std::memcpy(component, &value, sizeof(value));
+    } break;
+    }
+  }
+
+  const auto size = component_size * format.padded_count();
+  for (std::size_t i = offset; i < vertices.size(); i += stride) {
+    std::memcpy(vertices.data() + i, one.data(), size);
+  }
+}
+
+// Normalized integers are mapped to [0, 1] or [-1, 1]
+template <typename T>
+static auto convert_to_float(const std::byte* source, std::size_t source_stride,
+                             std::size_t components, bool normalized,
+                             std::byte* target, std::size_t target_stride,
+                             std::size_t count) -> void
+{
+  const auto scale =
+      normalized ? 1.0F / static_cast<float>(std::numeric_limits<T>::max())
+                 : 1.0F;
+  for (std::size_t i = 0; i < count; ++i) {
+    for (std::size_t c = 0; c < components; ++c) {
+      T value;
+      std::memcpy(&value, source + i * source_stride + c * sizeof(T),
+                  sizeof(T));
+      auto result = static_cast<float>(value);
+      if (normalized) {
+        result = std::max(result * scale, -1.0F);
+      }
+      std::memcpy(target + i * target_stride + c * sizeof(float), &result,
+                  sizeof(float));
+    }
+  }
+}
+
+// Copies an accessor into one attribute of the interleaved vertices
+static auto write_attribute(const GltfScene& scene, std::size_t accessor,
+                            VertexAttributeFormat format, std::size_t offset,
+                            std::size_t stride, std::span<std::byte> vertices)
+    -> void
+{
+  const auto& info = scene.accessors[accessor];
+  const auto count = vertices.size() / stride;
+  if (info.count < count) {
+    throw std::runtime_error{
+        fmt::format("Accessor {} has fewer elements than the positions",
+                    accessor)};
+  }
+
+  const auto* source = scene.accessor_bytes(accessor).data();
+  const auto source_stride = scene.accessor_stride(accessor);
+  const auto components =
+      std::min<std::size_t>(component_count(info.type), format.count);
+  auto* target = vertices.data() + offset;
+
+  if (format.component != VertexComponent::f32 ||
+      info.component_type == GltfComponentType::f32) {
+    // The formats match, so elements are copied as they are
+    const auto size = components * component_size(info.component_type);
+    for (std::size_t i = 0; i < count; ++i) {
+      std::memcpy(target + i * stride, source + i * source_stride, size);
+    }
+    return;
+  }
+
+  const auto normalized = info.normalized;
+  switch (info.component_type) {
+  case GltfComponentType::i8:
+    convert_to_float<std::int8_t>(source, source_stride, components,
+                                  normalized, target, stride, count);
+    break;
+  case GltfComponentType::u8:
+    convert_to_float<std::uint8_t>(source, source_stride, components,
+                                   normalized, target, stride, count);
+    break;
+  case GltfComponentType::i16:
+    convert_to_float<std::int16_t>(source, source_stride, components,
+                                   normalized, target, stride, count);
+    break;
+  case GltfComponentType::u16:
+    convert_to_float<std::uint16_t>(source, source_stride, components,
+                                    normalized, target, stride, count);
+    break;
+  case GltfComponentType::u32:
+    convert_to_float<std::uint32_t>(source, source_stride, components,
+                                    normalized, target, stride, count);
+    break;
+  case GltfComponentType::f32:
+    break;
+  }
+}
+
+static auto write_vertices(const GltfScene& scene,
+                           const GltfPrimitive& primitive,
+                           const VertexLayout& layout,
+                           std::span<std::byte> result) -> void
+{
+  const auto stride = layout.stride();
+
+  write_attribute(scene, *primitive.position, layout.position, 0, stride,
+                  result);
+
+  // Colors default to white. Quantized colors without alpha keep the filled
+  // value in the padding component.
+  fill_ones(layout.color, layout.color_offset(), stride, result);
+  if (primitive.color0) {
+    write_attribute(scene, *primitive.color0, layout.color,
+                    layout.color_offset(), stride, result);
+  }
+
+  // Texture coordinates default to zero, which the storage already holds
+  if (primitive.texcoord0) {
+    write_attribute(scene, *primitive.texcoord0, layout.texcoord,
+                    layout.texcoord_offset(), stride, result);
+  }
+}
+
+template <typename T>
+static auto write_joints(const GltfScene& scene, std::size_t accessor,
+                         std::span<SkinVertex> result) -> void
+{
+  const auto joints = scene.accessor_view<std::array<T, 4>>(accessor);
+  for (std::size_t i = 0; i < result.size(); ++i) {
+    const auto joint = joints[i];
+    for (std::size_t c = 0; c < joint.size(); ++c) {
+      result[i].joints[c] = joint[c];
+    }
+  }
+}
+
+// Writes the bind pose read by the skinning pass
+static auto write_skin_vertices(const GltfScene& scene,
+                                const GltfPrimitive& primitive,
+                                std::span<SkinVertex> result) -> void
+{
+  const auto bytes = std::as_writable_bytes(result);
+  write_attribute(scene, *primitive.position, {VertexComponent::f32, 3},
+                  offsetof(SkinVertex, position), sizeof(SkinVertex), bytes);
+  write_attribute(scene, *primitive.weights0, {VertexComponent::f32, 4},
+                  offsetof(SkinVertex, weights), sizeof(SkinVertex), bytes);
+
+  const auto accessor = *primitive.joints0;
+  const auto& joints = scene.accessors[accessor];
+  if (joints.type != GltfAccessorType::vec4 || joints.count < result.size()) {
+    throw std::runtime_error{
+        fmt::format("Accessor {} is not a valid JOINTS_0", accessor)};
+  }
+  switch (joints.component_type) {
+  case GltfComponentType::u8:
+    write_joints<std::uint8_t>(scene, accessor, result);
+    break;
+  case GltfComponentType::u16:
+    write_joints<std::uint16_t>(scene, accessor, result);
+    break;
+  default:
+    throw std::runtime_error{
+        fmt::format("Accessor {} is not a valid JOINTS_0", accessor)};
+  }
+}
+
+// Appends the non-zero deltas of every target, grouped by target, and writes
+// the index of the first delta of each target relative to the range
+static auto write_morph_deltas(const GltfScene& scene,
+                               const GltfPrimitive& primitive,
+                               std::span<std::uint32_t> offsets,
+                               std::vector<MorphDelta>& deltas) -> void
+{
+  constexpr std::array<float, 3> zero{};
+  for (std::size_t i = 0; i < offsets.size(); ++i) {
+    offsets[i] = static_cast<std::uint32_t>(deltas.size());
+    const auto position = primitive.targets[i].position;
+    if (!position) {
+      continue;
+    }
+    const auto view = scene.accessor_view<std::array<float, 3>>(*position);
+    for (std::size_t vertex = 0; vertex < view.size(); ++vertex) {
+      if (const auto delta = view[vertex]; delta != zero) {
+        deltas.push_back({.vertex = static_cast<std::uint32_t>(vertex),
+                          .position = delta});
+      }
+    }
+  }
+}
+
+// Writes indices of index_size bytes each
+static auto write_indices(const GltfScene& scene, std::size_t accessor,
+                          std::uint32_t index_size,
+                          std::span<std::byte> result) -> void
+{
+  switch (scene.accessors[accessor].component_type) {
+  case GltfComponentType::u8: {
+    // 8-bit indices are not universally supported by Vulkan
+    const auto indices = scene.accessor_span<std::uint8_t>(accessor);
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      const auto index = static_cast<std::uint16_t>(indices[i]);
+      std::memcpy(result.data() + i * sizeof(index), &index, sizeof(index));
+    }
+  } break;
+  case GltfComponentType::u16: {
+    const auto indices = scene.accessor_span<std::uint16_t>(accessor);
+    std::memcpy(result.data(), indices.data(), indices.size_bytes());
+  } break;
+  case GltfComponentType::u32: {
+    const auto indices = scene.accessor_span<std::uint32_t>(accessor);
+    if (index_size == sizeof(std::uint32_t)) {
+      std::memcpy(result.data(), indices.data(), indices.size_bytes());
+      break;
+    }
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      if (indices[i] > std::numeric_limits<std::uint16_t>::max()) {
+        throw std::runtime_error{fmt::format(
+            "Accessor {} has an index beyond the vertex count", accessor)};
+      }
+      const auto index = static_cast<std::uint16_t>(indices[i]);
+      std::memcpy(result.data() + i * sizeof(index), &index, sizeof(index));
+    }
+  } break;
+  default:
+    throw std::runtime_error{
+        fmt::format("Accessor {} has an invalid index type", accessor)};
+  }
+}
+
+[[nodiscard]] auto cook_mesh_data(const GltfScene& scene, ThreadPool& pool)
+    -> MeshData
+{
+  MeshData result;
+
+  // Lay out all primitives first, so that the conversion tasks can write to
+  // disjoint slices of the final storage
+  std::size_t vertex_bytes = 0;
+  std::size_t index_bytes = 0;
+  std::size_t skin_vertex_count = 0;
+  std::size_t morph_vertex_count = 0;
+  std::size_t morph_target_count = 0;
+  for (std::size_t i = 0; i < scene.meshes.size(); ++i) {
+    const auto& primitives = scene.meshes[i].primitives;
+    for (std::size_t j = 0; j < primitives.size(); ++j) {
+      const auto& primitive = primitives[j];
+      // Only triangle lists match the topology of our pipeline
+      if (primitive.mode != GltfPrimitiveMode::triangles) {
+        continue;
+      }
+      if (!primitive.position) {
+        throw std::runtime_error{fmt::format(
+            "Primitive {} of mesh {} has no POSITION attribute", j, i)};
+      }
+
+      DrawRange range;
+      range.mesh = static_cast<std::uint32_t>(i);
+      range.primitive = static_cast<std::uint32_t>(j);
+      if (primitive.material) {
+        range.material = static_cast<std::uint32_t>(*primitive.material);
+      }
+      range.layout = vertex_layout(scene, primitive);
+      const auto& positions = scene.accessors[*primitive.position];
+      range.vertex_count = static_cast<std::uint32_t>(positions.count);
+
+      // Vertex offsets are given in whole vertices of the range's stride
+      const auto stride = range.layout.stride();
+      range.vertex_byte_offset = (vertex_bytes + stride - 1) / stride * stride;
+      vertex_bytes = range.vertex_byte_offset + range.vertex_bytes();
+
+      if (is_skinned(primitive)) {
+        range.first_skin_vertex =
+            static_cast<std::uint32_t>(skin_vertex_count);
+        skin_vertex_count += range.vertex_count;
+      }
+      if (is_morphed(primitive)) {
+        range.first_morph_vertex =
+            static_cast<std::uint32_t>(morph_vertex_count);
+        morph_vertex_count += range.vertex_count;
+        range.first_morph_target =
+            static_cast<std::uint32_t>(morph_target_count);
+        range.morph_target_count =
+            static_cast<std::uint32_t>(primitive.targets.size());
+        morph_target_count += range.morph_target_count;
+      }
+
+      if (primitive.indices) {
+        // 32-bit indices are only kept when the vertices need them
+        const auto& accessor = scene.accessors[*primitive.indices];
+        const auto needs_32_bit =
+            accessor.component_type == GltfComponentType::u32 &&
+            range.vertex_count > std::uint32_t{1} << 16;
+        range.index_size = needs_32_bit ? 4 : 2;
+        range.index_count = static_cast<std::uint32_t>(accessor.count);
+        // Keep every range aligned for 32-bit index fetches
+        range.index_byte_offset = (index_bytes + 3) & ~std::size_t{3};
+        index_bytes = range.index_byte_offset +
+                      std::size_t{range.index_count} * range.index_size;
+      }
+
+      result.range_storage.push_back(range);
+    }
+  }
+
+  result.vertex_storage.resize(vertex_bytes);
+  result.index_storage.resize(index_bytes);
+  result.skin_vertex_storage.resize(skin_vertex_count);
+  result.morph_position_storage.resize(morph_vertex_count);
+  // The offsets end with one past the last delta
+  result.morph_offset_storage.resize(
+      morph_target_count == 0 ? 0 : morph_target_count + 1);
+  auto morph_weights = flatten_morph_weights(scene);
+  result.morph_weight_range_storage = std::move(morph_weights.ranges);
+  result.morph_weight_storage = std::move(morph_weights.weights);
+  result.node_storage = flatten_nodes(scene);
+  auto skins = flatten_skins(scene);
+  result.skin_storage = std::move(skins.skins);
+  result.joint_storage = std::move(skins.joints);
+  auto animations = flatten_animations(scene);
+  result.animation_storage = std::move(animations.clips);
+  result.animation_channel_storage = std::move(animations.channels);
+  result.keyframe_time_storage = std::move(animations.times);
+  result.keyframe_value_storage = std::move(animations.values);
+
+  // The number of deltas of each range is only known once it is converted,
+  // so each range collects them on its own and they are concatenated after
+  std::vector<std::vector<MorphDelta>> range_deltas(
+      result.range_storage.size());
+  std::vector<std::future<void>> tasks;
+  tasks.reserve(result.range_storage.size());
+  for (std::size_t i = 0; i < result.range_storage.size(); ++i) {
+    const auto& range = result.range_storage[i];
+    auto& deltas = range_deltas[i];
+    tasks.push_back(pool.submit([&scene, &result, &deltas, range] {
+      const auto& primitive =
+          scene.meshes[range.mesh].primitives[range.primitive];
+      write_vertices(scene, primitive, range.layout,
+                     std::span{result.vertex_storage}.subspan(
+                         range.vertex_byte_offset, range.vertex_bytes()));
+      if (primitive.indices) {
+        write_indices(scene, *primitive.indices, range.index_size,
+                      std::span{result.index_storage}.subspan(
+                          range.index_byte_offset,
+                          std::size_t{range.index_count} * range.index_size));
+      }
+      if (range.skinned()) {
+        write_skin_vertices(scene, primitive,
+                            std::span{result.skin_vertex_storage}.subspan(
+                                range.first_skin_vertex, range.vertex_count));
+      }
+      if (range.morphed()) {
+        write_attribute(scene, *primitive.position, {VertexComponent::f32, 3},
+                        0, sizeof(std::array<float, 3>),
+                        std::as_writable_bytes(
+                            std::span{result.morph_position_storage}.subspan(
+                                range.first_morph_vertex, range.vertex_count)));
+        write_morph_deltas(scene, primitive,
+                           std::span{result.morph_offset_storage}.subspan(
+                               range.first_morph_target,
+                               range.morph_target_count),
+                           deltas);
+      }
+    }));
+  }
+  // Every task refers to result, so all of them must finish before rethrowing
+  for (const auto& task : tasks) {
+    pool.wait(task);
+  }
+  for (auto& task : tasks) {
+    task.get();
+  }
+
+  for (std::size_t i = 0; i < result.range_storage.size(); ++i) {
+    const auto& range = result.range_storage[i];
+    if (!range.morphed()) {
+      continue;
+    }
+    const auto first_delta =
+        static_cast<std::uint32_t>(result.morph_delta_storage.size());
+    for (auto& offset : std::span{result.morph_offset_storage}.subspan(
+             range.first_morph_target, range.morph_target_count)) {
+      offset += first_delta;
+    }
+    result.morph_delta_storage.insert(result.morph_delta_storage.end(),
+                                      range_deltas[i].begin(),
+                                      range_deltas[i].end());
+  }
+  if (!result.morph_offset_storage.empty()) {
+    result.morph_offset_storage.back() =
+        static_cast<std::uint32_t>(result.morph_delta_storage.size());
+  }
+
+  result.vertices = result.vertex_storage;
+  result.indices = result.index_storage;
+  result.ranges = result.range_storage;
+  result.nodes = result.node_storage;
+  result.skins = result.skin_storage;
+  result.joints = result.joint_storage;
+  result.skin_vertices = result.skin_vertex_storage;
+  result.morph_positions = result.morph_position_storage;
+  result.morph_offsets = result.morph_offset_storage;
+  result.morph_deltas = result.morph_delta_storage;
+  result.morph_weight_ranges = result.morph_weight_range_storage;
+  result.morph_weights = result.morph_weight_storage;
+  result.animations = result.animation_storage;
+  result.animation_channels = result.animation_channel_storage;
+  result.keyframe_times = result.keyframe_time_storage;
+  result.keyframe_values = result.keyframe_value_storage;
+  return result;
+}
@@ -0,0 +1,135 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "animation.hpp"
+#include "mapped_file.hpp"
+#include "morph.hpp"
+#include "scene_graph.hpp"
+#include "skin.hpp"
+#include "vertex.hpp"
+
+struct GltfScene;
+class ThreadPool;
+
+// The vertices and indices of one glTF primitive inside MeshData. Vertex
+// offsets are multiples of the stride and index offsets multiples of 4.
+struct DrawRange {
+  static constexpr std::uint32_t no_material = 0xFFFF'FFFF;
+  static constexpr std::uint32_t not_skinned = 0xFFFF'FFFF;
+  static constexpr std::uint32_t not_morphed = 0xFFFF'FFFF;
+
+  std::uint32_t mesh = 0;
+  std::uint32_t primitive = 0;
+  // Index into GltfScene::materials, or no_material for the default material
+  std::uint32_t material = no_material;
+  std::uint64_t vertex_byte_offset = 0;
+  std::uint32_t vertex_count = 0;
+  // 0 for non-indexed primitives
+  std::uint32_t index_count = 0;
+  std::uint64_t index_byte_offset = 0;
+  // Either 2 or 4 bytes
+  std::uint32_t index_size = 0;
+  // Index into MeshData::skin_vertices of the bind pose of the first vertex.
+  // Skinned ranges always store float32 positions.
+  std::uint32_t first_skin_vertex = not_skinned;
+  // Index into MeshData::morph_positions of the first vertex. Morphed ranges
+  // always store float32 positions as well.
+  std::uint32_t first_morph_vertex = not_morphed;
+  // Index into MeshData::morph_offsets of the first morph target, one per
+  // target of the primitive whether it moves positions or not
+  std::uint32_t first_morph_target = 0;
+  std::uint32_t morph_target_count = 0;
+  VertexLayout layout;
+
+  [[nodiscard]] auto skinned() const noexcept -> bool
+  {
+    return first_skin_vertex != not_skinned;
+  }
+
+  [[nodiscard]] auto morphed() const noexcept -> bool
+  {
+    return first_morph_vertex != not_morphed;
+  }
+
+  [[nodiscard]] auto vertex_bytes() const noexcept -> std::size_t
+  {
+    return std::size_t{vertex_count} * layout.stride();
+  }
+
+  // The vertex and index offsets of the range within the shared buffers, in
+  // units of its own stride and index size
+  [[nodiscard]] auto first_vertex() const noexcept -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(vertex_byte_offset / layout.stride());
+  }
+
+  [[nodiscard]] auto first_index() const noexcept -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(index_byte_offset / index_size);
+  }
+};
+
+/**
+ * @brief GPU-ready geometry of every triangle primitive in a scene.
+ *
+ * The vertices of each primitive are interleaved in the layout of its range,
+ * which keeps quantized attributes in their compact formats. The vertices and
+ * indices of all primitives are concatenated, so that they can be uploaded as
+ * one vertex and one index buffer. The node hierarchy is stored
+ * flattened alongside. Skinned primitives additionally keep their bind pose
+ * for the skinning pass, morphed primitives their morph targets and
+ * animations their keyframes. The spans either point into a mapped mesh
+ * cache file or into the storage vectors.
+ */
+struct MeshData {
+  std::span<const std::byte> vertices;
+  std::span<const std::byte> indices;
+  std::span<const DrawRange> ranges;
+  std::span<const SceneNode> nodes;
+  std::span<const SkinRange> skins;
+  std::span<const SkinJoint> joints;
+  std::span<const SkinVertex> skin_vertices;
+  // The unmorphed positions of every morphed vertex and the deltas of every
+  // morph target. The deltas of target i are [morph_offsets[i],
+  // morph_offsets[i + 1]).
+  std::span<const std::array<float, 3>> morph_positions;
+  std::span<const std::uint32_t> morph_offsets;
+  std::span<const MorphDelta> morph_deltas;
+  std::span<const MorphWeightRange> morph_weight_ranges;
+  std::span<const float> morph_weights;
+  std::span<const AnimationClip> animations;
+  std::span<const AnimationChannel> animation_channels;
+  std::span<const float> keyframe_times;
+  std::span<const glm::vec4> keyframe_values;
+
+  MappedFile cache_file;
+  std::vector<std::byte> vertex_storage;
+  std::vector<std::byte> index_storage;
+  std::vector<DrawRange> range_storage;
+  std::vector<SceneNode> node_storage;
+  std::vector<SkinRange> skin_storage;
+  std::vector<SkinJoint> joint_storage;
+  std::vector<SkinVertex> skin_vertex_storage;
+  std::vector<std::array<float, 3>> morph_position_storage;
+  std::vector<std::uint32_t> morph_offset_storage;
+  std::vector<MorphDelta> morph_delta_storage;
+  std::vector<MorphWeightRange> morph_weight_range_storage;
+  std::vector<float> morph_weight_storage;
+  std::vector<AnimationClip> animation_storage;
+  std::vector<AnimationChannel> animation_channel_storage;
+  std::vector<float> keyframe_time_storage;
+  std::vector<glm::vec4> keyframe_value_storage;
+};
+
+// Converts the accessors of every triangle primitive concurrently and flattens
+// the node hierarchy, skins, morph targets and animations
+[[nodiscard]] auto cook_mesh_data(const GltfScene& scene, ThreadPool& pool)
+    -> MeshData;
+
+#endif // MESH_HPP
@@ -0,0 +1,411 @@
+#include "mesh_cache.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "cache_file.hpp"
+#include "gltf.hpp"
+#include "thread_pool.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::array<char, 8> cache_magic = {'V', 'R', 'M', 'E',
+                                             'S', 'H', 'C', '\0'};
+// Bump whenever the layout of the file, VertexLayout, DrawRange, SceneNode or
+// the skin, morph and animation types changes
+constexpr std::uint32_t cache_version = 9;
+
+struct CacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t range_size;
+  std::uint32_t node_size;
+  std::uint64_t source_hash;
+  // Newline separated paths of the external buffers, relative to the glTF
+  std::uint64_t dependencies_offset;
+  std::uint64_t dependencies_size;
+  std::uint64_t ranges_offset;
+  std::uint64_t range_count;
+  std::uint64_t nodes_offset;
+  std::uint64_t node_count;
+  std::uint64_t skins_offset;
+  std::uint64_t skin_count;
+  std::uint64_t joints_offset;
+  std::uint64_t joint_count;
+  std::uint64_t skin_vertices_offset;
+  std::uint64_t skin_vertex_count;
+  std::uint64_t morph_positions_offset;
+  std::uint64_t morph_vertex_count;
+  std::uint64_t morph_offsets_offset;
+  std::uint64_t morph_offset_count;
+  std::uint64_t morph_deltas_offset;
+  std::uint64_t morph_delta_count;
+  std::uint64_t morph_weight_ranges_offset;
+  std::uint64_t morph_weight_range_count;
+  std::uint64_t morph_weights_offset;
+  std::uint64_t morph_weight_count;
+  std::uint64_t animations_offset;
+  std::uint64_t animation_count;
+  std::uint64_t animation_channels_offset;
+  std::uint64_t animation_channel_count;
+  std::uint64_t keyframe_times_offset;
+  std::uint64_t keyframe_time_count;
+  std::uint64_t keyframe_values_offset;
+  std::uint64_t keyframe_value_count;
+  std::uint64_t vertices_offset;
+  std::uint64_t vertices_size;
+  std::uint64_t indices_offset;
+  std::uint64_t indices_size;
+};
+static_assert(std::is_trivially_copyable_v<CacheHeader>);
+static_assert(std::is_trivially_copyable_v<DrawRange>);
+static_assert(std::is_trivially_copyable_v<SceneNode>);
+static_assert(std::is_trivially_copyable_v<SkinRange>);
+static_assert(std::is_trivially_copyable_v<SkinJoint>);
+static_assert(std::is_trivially_copyable_v<SkinVertex>);
+static_assert(std::is_trivially_copyable_v<MorphDelta>);
+static_assert(std::is_trivially_copyable_v<MorphWeightRange>);
+static_assert(std::is_trivially_copyable_v<AnimationClip>);
+static_assert(std::is_trivially_copyable_v<AnimationChannel>);
+
+[[nodiscard]] auto align_up(std::uint64_t value) noexcept -> std::uint64_t
+{
+  return (value + cache_section_alignment - 1) &
+         ~std::uint64_t{cache_section_alignment - 1};
+}
+
+// Whether [first, first + count) lies within size elements, compared
+// without adding
+[[nodiscard]] auto fits(std::uint64_t first, std::uint64_t count,
+                        std::uint64_t size) noexcept -> bool
+{
+  return count <= size && first <= size - count;
+}
+
+// The renderer indexes its tables and slices the vertex and index data with
+// the cached offsets unchecked
+auto check_mesh_data(const MeshData& mesh) -> void
+{
+  const auto check = [](bool valid) {
+    if (!valid) {
+      throw std::runtime_error{"Mesh cache index is out of bounds"};
+    }
+  };
+
+  std::uint64_t mesh_count = 0;
+  for (const auto& range : mesh.ranges) {
+    mesh_count = std::max<std::uint64_t>(mesh_count, range.mesh + 1ULL);
+  }
+  // The most morph targets of any primitive of each mesh
+  std::vector<std::uint32_t> mesh_targets(mesh_count);
+  for (const auto& range : mesh.ranges) {
+    check(fits(range.vertex_byte_offset, range.vertex_bytes(),
+               mesh.vertices.size()));
+    if (range.index_count != 0) {
+      check(range.index_size == 2 || range.index_size == 4);
+      check(fits(range.index_byte_offset,
+                 std::uint64_t{range.index_count} * range.index_size,
+                 mesh.indices.size()));
+    }
+    check(!range.skinned() || fits(range.first_skin_vertex,
+                                   range.vertex_count,
+                                   mesh.skin_vertices.size()));
+    if (!range.morphed()) {
+      continue;
+    }
+    check(fits(range.first_morph_vertex, range.vertex_count,
+               mesh.morph_positions.size()));
+    // The deltas of target i are [morph_offsets[i], morph_offsets[i + 1])
+    check(fits(range.first_morph_target, range.morph_target_count + 1ULL,
+               mesh.morph_offsets.size()));
+    const auto offsets = mesh.morph_offsets.subspan(
+        range.first_morph_target, range.morph_target_count + 1ULL);
+    check(std::ranges::is_sorted(offsets));
+    check(offsets.back() <= mesh.morph_deltas.size());
+    for (auto i = offsets.front(); i < offsets.back(); ++i) {
+      check(mesh.morph_deltas[i].vertex < range.vertex_count);
+    }
+    mesh_targets[range.mesh] =
+        std::max(mesh_targets[range.mesh], range.morph_target_count);
+  }
+
+  for (std::size_t i = 0; i < mesh.nodes.size(); ++i) {
+    const auto& node = mesh.nodes[i];
+    check(node.parent == SceneNode::none || node.parent < i);
+    check(node.mesh == SceneNode::none || node.mesh < mesh_count);
+    check(node.skin == SceneNode::none || node.skin < mesh.skins.size());
+  }
+
+  for (const auto& skin : mesh.skins) {
+    check(fits(skin.first_joint, skin.joint_count, mesh.joints.size()));
+  }
+  for (const auto& joint : mesh.joints) {
+    check(joint.node < mesh.nodes.size());
+  }
+
+  for (const auto& range : mesh.morph_weight_ranges) {
+    check(range.node < mesh.nodes.size());
+    check(fits(range.first_weight, range.weight_count,
+               mesh.morph_weights.size()));
+    // Every target of the mesh of the node is blended with one of its weights
+    const auto node_mesh = mesh.nodes[range.node].mesh;
+    check(node_mesh == SceneNode::none ||
+          mesh_targets[node_mesh] <= range.weight_count);
+  }
+
+  for (const auto& clip : mesh.animations) {
+    check(fits(clip.first_channel, clip.channel_count,
+               mesh.animation_channels.size()));
+  }
+  for (const auto& channel : mesh.animation_channels) {
+    const auto value_count =
+        channel.interpolation == AnimationInterpolation::cubic_spline
+            ? std::uint64_t{channel.key_count} * 3
+            : std::uint64_t{channel.key_count};
+    check(channel.node < mesh.nodes.size());
+    check(fits(channel.first_key, channel.key_count,
+               mesh.keyframe_times.size()));
+    check(fits(channel.first_value, value_count,
+               mesh.keyframe_values.size()));
+  }
+}
+
+[[nodiscard]] auto read_mesh_cache(const fs::path& cache_path,
+                                   const fs::path& gltf_path)
+    -> std::optional<MeshData>
+{
+  if (!fs::exists(cache_path)) {
+    return std::nullopt;
+  }
+
+  MeshData result;
+  result.cache_file = MappedFile{cache_path.string()};
+  const auto file = result.cache_file.bytes();
+
+  CacheHeader header;
+  if (file.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != cache_magic || header.version != cache_version ||
+      header.range_size != sizeof(DrawRange) ||
+      header.node_size != sizeof(SceneNode)) {
+    return std::nullopt;
+  }
+
+  const auto dependencies_bytes = cache_section(
+      file, header.dependencies_offset, header.dependencies_size);
+  const auto dependencies = split_lines(
+      {reinterpret_cast<const char*>(dependencies_bytes.data()),
+       dependencies_bytes.size()});
+  if (hash_cache_sources(gltf_path, dependencies) != header.source_hash) {
+    return std::nullopt;
+  }
+
+  result.ranges =
+      cache_table<DrawRange>(file, header.ranges_offset, header.range_count);
+  result.nodes =
+      cache_table<SceneNode>(file, header.nodes_offset, header.node_count);
+  result.skins =
+      cache_table<SkinRange>(file, header.skins_offset, header.skin_count);
+  result.joints =
+      cache_table<SkinJoint>(file, header.joints_offset, header.joint_count);
+  result.skin_vertices =
+      cache_table<SkinVertex>(file, header.skin_vertices_offset,
+                              header.skin_vertex_count);
+  result.morph_positions =
+      cache_table<std::array<float, 3>>(file, header.morph_positions_offset,
+                                        header.morph_vertex_count);
+  result.morph_offsets =
+      cache_table<std::uint32_t>(file, header.morph_offsets_offset,
+                                 header.morph_offset_count);
+  result.morph_deltas =
+      cache_table<MorphDelta>(file, header.morph_deltas_offset,
+                              header.morph_delta_count);
+  result.morph_weight_ranges =
+      cache_table<MorphWeightRange>(file, header.morph_weight_ranges_offset,
+                                    header.morph_weight_range_count);
+  result.morph_weights =
+      cache_table<float>(file, header.morph_weights_offset,
+                         header.morph_weight_count);
+  result.animations =
+      cache_table<AnimationClip>(file, header.animations_offset,
+                                 header.animation_count);
+  result.animation_channels =
+      cache_table<AnimationChannel>(file, header.animation_channels_offset,
+                                    header.animation_channel_count);
+  result.keyframe_times =
+      cache_table<float>(file, header.keyframe_times_offset,
+                         header.keyframe_time_count);
+  result.keyframe_values =
+      cache_table<glm::vec4>(file, header.keyframe_values_offset,
+                             header.keyframe_value_count);
+  result.vertices =
+      cache_section(file, header.vertices_offset, header.vertices_size);
+  result.indices =
+      cache_section(file, header.indices_offset, header.indices_size);
+  check_mesh_data(result);
+  return result;
+}
+
+auto write_mesh_cache(const fs::path& cache_path, std::uint64_t source_hash,
+                      const std::vector<std::string>& dependencies,
+                      const MeshData& mesh) -> void
+{
+  const auto dependency_list = join_lines(dependencies);
+
+  CacheHeader header{};
+  header.magic = cache_magic;
+  header.version = cache_version;
+  header.range_size = sizeof(DrawRange);
+  header.node_size = sizeof(SceneNode);
+  header.source_hash = source_hash;
+  header.dependencies_offset = sizeof(CacheHeader);
+  header.dependencies_size = dependency_list.size();
+  header.ranges_offset =
+      align_up(header.dependencies_offset + header.dependencies_size);
+  header.range_count = mesh.ranges.size();
+  header.nodes_offset =
+      align_up(header.ranges_offset + mesh.ranges.size_bytes());
+  header.node_count = mesh.nodes.size();
+  header.skins_offset =
+      align_up(header.nodes_offset + mesh.nodes.size_bytes());
+  header.skin_count = mesh.skins.size();
+  header.joints_offset =
+      align_up(header.skins_offset + mesh.skins.size_bytes());
+  header.joint_count = mesh.joints.size();
+  header.skin_vertices_offset =
+      align_up(header.joints_offset + mesh.joints.size_bytes());
+  header.skin_vertex_count = mesh.skin_vertices.size();
+  header.morph_positions_offset =
+      align_up(header.skin_vertices_offset + mesh.skin_vertices.size_bytes());
+  header.morph_vertex_count = mesh.morph_positions.size();
+  header.morph_offsets_offset = align_up(header.morph_positions_offset +
+                                         mesh.morph_positions.size_bytes());
+  header.morph_offset_count = mesh.morph_offsets.size();
+  header.morph_deltas_offset =
+      align_up(header.morph_offsets_offset + mesh.morph_offsets.size_bytes());
+  header.morph_delta_count = mesh.morph_deltas.size();
+  header.morph_weight_ranges_offset =
+      align_up(header.morph_deltas_offset + mesh.morph_deltas.size_bytes());
+  header.morph_weight_range_count = mesh.morph_weight_ranges.size();
+  header.morph_weights_offset =
+      align_up(header.morph_weight_ranges_offset +
+               mesh.morph_weight_ranges.size_bytes());
+  header.morph_weight_count = mesh.morph_weights.size();
+  header.animations_offset =
+      align_up(header.morph_weights_offset + mesh.morph_weights.size_bytes());
+  header.animation_count = mesh.animations.size();
+  header.animation_channels_offset =
+      align_up(header.animations_offset + mesh.animations.size_bytes());
+  header.animation_channel_count = mesh.animation_channels.size();
+  header.keyframe_times_offset = align_up(
+      header.animation_channels_offset + mesh.animation_channels.size_bytes());
+  header.keyframe_time_count = mesh.keyframe_times.size();
+  header.keyframe_values_offset =
+      align_up(header.keyframe_times_offset + mesh.keyframe_times.size_bytes());
+  header.keyframe_value_count = mesh.keyframe_values.size();
+  header.vertices_offset = align_up(header.keyframe_values_offset +
+                                    mesh.keyframe_values.size_bytes());
+  header.vertices_size = mesh.vertices.size();
+  header.indices_offset =
+      align_up(header.vertices_offset + mesh.vertices.size_bytes());
+  header.indices_size = mesh.indices.size();
+
+  CacheWriter file{cache_path};
+  file.write_at(0, &header, sizeof(header));
+  file.write_at(header.dependencies_offset, dependency_list.data(),
+                dependency_list.size());
+  file.write_at(header.ranges_offset, mesh.ranges.data(),
+                mesh.ranges.size_bytes());
+  file.write_at(header.nodes_offset, mesh.nodes.data(),
+                mesh.nodes.size_bytes());
+  file.write_at(header.skins_offset, mesh.skins.data(),
+                mesh.skins.size_bytes());
+  file.write_at(header.joints_offset, mesh.joints.data(),
+                mesh.joints.size_bytes());
+  file.write_at(header.skin_vertices_offset, mesh.skin_vertices.data(),
+                mesh.skin_vertices.size_bytes());
+  file.write_at(header.morph_positions_offset, mesh.morph_positions.data(),
+                mesh.morph_positions.size_bytes());
+  file.write_at(header.morph_offsets_offset, mesh.morph_offsets.data(),
+                mesh.morph_offsets.size_bytes());
+  file.write_at(header.morph_deltas_offset, mesh.morph_deltas.data(),
+                mesh.morph_deltas.size_bytes());
+  file.write_at(header.morph_weight_ranges_offset,
+                mesh.morph_weight_ranges.data(),
+                mesh.morph_weight_ranges.size_bytes());
+  file.write_at(header.morph_weights_offset, mesh.morph_weights.data(),
+                mesh.morph_weights.size_bytes());
+  file.write_at(header.animations_offset, mesh.animations.data(),
+                mesh.animations.size_bytes());
+  file.write_at(header.animation_channels_offset,
+                mesh.animation_channels.data(),
+                mesh.animation_channels.size_bytes());
+  file.write_at(header.keyframe_times_offset, mesh.keyframe_times.data(),
+                mesh.keyframe_times.size_bytes());
+  file.write_at(header.keyframe_values_offset, mesh.keyframe_values.data(),
+                mesh.keyframe_values.size_bytes());
+  file.write_at(header.vertices_offset, mesh.vertices.data(),
+                mesh.vertices.size());
+  file.write_at(header.indices_offset, mesh.indices.data(),
+                mesh.indices.size());
+  file.commit();
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto load_mesh_data(std::string_view filename, ThreadPool& pool)
+    -> MeshData
+{
+  const fs::path gltf_path{filename};
+  const fs::path cache_path{gltf_path.string() + ".meshcache"};
+
+  try {
+    if (auto cached = read_mesh_cache(cache_path, gltf_path); cached) {
+      return std::move(*cached);
+    }
+  } catch (const std::exception& e) {
+    // A broken cache is rebuilt rather than treated as an error
+    fmt::print(stderr, "Ignoring mesh cache {}: {}\n", cache_path.string(),
+               e.what());
+  }
+
+  // Materials and their images are loaded separately
+  auto scene_future =
+      load_gltf_scene_async(filename, pool, {.decode_images = false});
+  pool.wait(scene_future);
+  const auto scene = scene_future.get();
+  if (const auto& stats = scene.meshopt_stats; stats.view_count > 0) {
+    constexpr double mib = 1024.0 * 1024.0;
+    const auto compressed = static_cast<double>(stats.compressed_bytes);
+    const auto decoded = static_cast<double>(stats.decoded_bytes);
+    fmt::print("Decoded {} meshopt buffer views: {:.2f} MiB on disk, {:.2f} "
+               "MiB in memory, {:.2f} GB/s\n",
+               stats.view_count, compressed / mib, decoded / mib,
+               decoded / stats.decode_seconds / 1e9);
+  }
+  auto mesh = cook_mesh_data(scene, pool);
+
+  try {
+    write_mesh_cache(cache_path,
+                     hash_cache_sources(gltf_path, scene.buffer_files),
+                     scene.buffer_files, mesh);
+  } catch (const std::exception& e) {
+    fmt::print(stderr, "Failed to write mesh cache {}: {}\n",
+               cache_path.string(), e.what());
+  }
+
+  return mesh;
+}
@@ -0,0 +1,21 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <string_view>
+
+#include "mesh.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief Loads the cooked meshes of a glTF file.
+ *
+ * The result is read from "<filename>.meshcache" if the content hash of the
+ * glTF file and its external buffers matches the one stored in the cache. The
+ * cache is memory-mapped and served without parsing any JSON. Otherwise the
+ * scene is loaded, cooked and the cache rewritten.
+ */
+[[nodiscard]] auto load_mesh_data(std::string_view filename, ThreadPool& pool)
+    -> MeshData;
+
+#endif // MESH_CACHE_HPP
@@ -0,0 +1,114 @@
+#include "morph.hpp"
+
+#include <algorithm>
+
+#include "gltf.hpp"
+#include "scene_graph.hpp"
+
+namespace {
+
+auto initial_weights(const GltfMesh& mesh, const GltfNode* node)
+    -> std::vector<float>
+{
+  if (node != nullptr && !node->weights.empty()) {
+    return node->weights;
+  }
+  if (!mesh.weights.empty()) {
+    return mesh.weights;
+  }
+  return std::vector<float>(mesh.target_count(), 0.0F);
+}
+
+auto append_weights(std::uint32_t node, std::vector<float> weights,
+                    FlatMorphWeights& result) -> void
+{
+  if (weights.empty()) {
+    return;
+  }
+  result.ranges.push_back(
+      {.node = node,
+       .first_weight = static_cast<std::uint32_t>(result.weights.size()),
+       .weight_count = static_cast<std::uint32_t>(weights.size())});
+  result.weights.insert(result.weights.end(), weights.begin(), weights.end());
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto flatten_morph_weights(const GltfScene& scene)
+    -> FlatMorphWeights
+{
+  FlatMorphWeights result;
+
+  // Without nodes, flatten_nodes() places every mesh on a root of its own
+  if (scene.nodes.empty()) {
+    for (std::size_t i = 0; i < scene.meshes.size(); ++i) {
+      append_weights(static_cast<std::uint32_t>(i),
+                     initial_weights(scene.meshes[i], nullptr), result);
+    }
+    return result;
+  }
+
+  const auto flat_indices = flat_node_indices(scene);
+  for (std::size_t i = 0; i < scene.nodes.size(); ++i) {
+    const auto& node = scene.nodes[i];
+    if (node.mesh) {
+      append_weights(flat_indices[i],
+                     initial_weights(scene.meshes[*node.mesh], &node),
+                     result);
+    }
+  }
+  std::ranges::sort(result.ranges, {}, &MorphWeightRange::node);
+  return result;
+}
+
+MorphWeights::MorphWeights(std::size_t node_count,
+                           std::span<const MorphWeightRange> ranges,
+                           std::span<const float> weights)
+    : node_ranges_(node_count, none), ranges_{ranges.begin(), ranges.end()},
+      weights_{weights.begin(), weights.end()}, changed_(ranges.size(), 1),
+      any_changed_{!ranges.empty()}
+{
+  for (std::size_t i = 0; i < ranges_.size(); ++i) {
+    node_ranges_.at(ranges_[i].node) = static_cast<std::uint32_t>(i);
+  }
+}
+
+auto MorphWeights::first_weight(std::size_t node) const noexcept
+    -> std::uint32_t
+{
+  const auto range = node_ranges_[node];
+  return range == none ? none : ranges_[range].first_weight;
+}
+
+auto MorphWeights::set(std::size_t node, std::size_t first, glm::vec4 weights)
+    -> void
+{
+  const auto index = node_ranges_.at(node);
+  if (index == none) {
+    return;
+  }
+  const auto& range = ranges_[index];
+  const std::array values{weights.x, weights.y, weights.z, weights.w};
+  const auto end =
+      std::min<std::size_t>(first + values.size(), range.weight_count);
+  for (auto i = first; i < end; ++i) {
+    auto& weight = weights_[range.first_weight + i];
+    if (weight != values[i - first]) {
+      weight = values[i - first];
+      changed_[index] = 1;
+      any_changed_ = true;
+    }
+  }
+}
+
+auto MorphWeights::changed(std::size_t node) const noexcept -> bool
+{
+  const auto range = node_ranges_[node];
+  return range != none && changed_[range] != 0;
+}
+
+auto MorphWeights::clear_changes() noexcept -> void
+{
+  std::ranges::fill(changed_, std::uint8_t{0});
+  any_changed_ = false;
+}
@@ -0,0 +1,89 @@
+#ifndef MORPH_HPP
+#define MORPH_HPP
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct GltfScene;
+
+// A non-zero displacement of one vertex by one morph target, matching the
+// MorphDelta struct of shaders/morph.comp. Vertices without a delta for a
+// target are not stored.
+struct MorphDelta {
+  // Index among the vertices of the primitive
+  std::uint32_t vertex = 0;
+  std::array<float, 3> position{};
+};
+static_assert(sizeof(MorphDelta) == 16);
+
+// The morph target weights of one node within the weights of all nodes
+struct MorphWeightRange {
+  // Index of the node in the flattened hierarchy
+  std::uint32_t node = 0;
+  std::uint32_t first_weight = 0;
+  std::uint32_t weight_count = 0;
+};
+
+struct FlatMorphWeights {
+  std::vector<MorphWeightRange> ranges;
+  std::vector<float> weights;
+};
+
+// Collects the initial weights of every node whose mesh has morph targets,
+// taken from the node, its mesh or zero, in that order
+[[nodiscard]] auto flatten_morph_weights(const GltfScene& scene)
+    -> FlatMorphWeights;
+
+/**
+ * @brief The current morph target weights of every morphed node.
+ *
+ * Remembers which nodes had their weights changed, so that meshes whose
+ * weights stayed the same are not blended again. Every node starts out
+ * changed.
+ */
+class MorphWeights {
+public:
+  static constexpr std::uint32_t none = 0xFFFF'FFFF;
+
+  MorphWeights() = default;
+  MorphWeights(std::size_t node_count,
+               std::span<const MorphWeightRange> ranges,
+               std::span<const float> weights);
+
+  [[nodiscard]] auto values() const noexcept -> std::span<const float>
+  {
+    return weights_;
+  }
+
+  // Returns the first weight of a node, or none if it has no morph targets
+  [[nodiscard]] auto first_weight(std::size_t node) const noexcept
+      -> std::uint32_t;
+
+  // Sets the weights of a node from first on. Components past its last
+  // weight are ignored, as are nodes without morph targets.
+  auto set(std::size_t node, std::size_t first, glm::vec4 weights) -> void;
+
+  [[nodiscard]] auto any_changed() const noexcept -> bool
+  {
+    return any_changed_;
+  }
+
+  [[nodiscard]] auto changed(std::size_t node) const noexcept -> bool;
+
+  auto clear_changes() noexcept -> void;
+
+private:
+  // Index into ranges_ of every node, or none
+  std::vector<std::uint32_t> node_ranges_;
+  std::vector<MorphWeightRange> ranges_;
+  std::vector<float> weights_;
+  std::vector<std::uint8_t> changed_;
+  bool any_changed_ = false;
+};
+
+#endif // MORPH_HPP
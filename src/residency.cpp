@@ -0,0 +1,26 @@
+#include "residency.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+auto ResidencyLru::reset(std::size_t count) -> void
+{
+  last_used_.assign(count, 0);
+}
+
+auto ResidencyLru::touch(std::uint32_t id, std::uint64_t frame) noexcept
+    -> void
+{
+  if (id < last_used_.size()) {
+    last_used_[id] = std::max(last_used_[id], frame);
+  }
+}
+
+auto ResidencyLru::order() const -> std::vector<std::uint32_t>
+{
+  std::vector<std::uint32_t> result(last_used_.size());
+  std::iota(result.begin(), result.end(), std::uint32_t{0});
+  std::ranges::stable_sort(result, {},
+                           [this](std::uint32_t id) { return last_used_[id]; });
+  return result;
+}
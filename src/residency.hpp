@@ -0,0 +1,32 @@
+#ifndef RESIDENCY_HPP
+#define RESIDENCY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Orders streamable resources by when they were last used.
+ *
+ * Resources are identified by an index into whatever table holds them and
+ * stamped with the frame that last used them, given by any counter that
+ * only grows, such as the timeline value of its submission. When memory
+ * runs short, the resources at the front of the order are the first to be
+ * dropped to a smaller version of themselves.
+ */
+class ResidencyLru {
+public:
+  // Tracks count resources, none of which was used yet
+  auto reset(std::size_t count) -> void;
+
+  // Marks id as used by frame, ignoring ids that are not tracked
+  auto touch(std::uint32_t id, std::uint64_t frame) noexcept -> void;
+
+  // Least recently used first, resources used by the same frame by id
+  [[nodiscard]] auto order() const -> std::vector<std::uint32_t>;
+
+private:
+  std::vector<std::uint64_t> last_used_;
+};
+
+#endif // RESIDENCY_HPP
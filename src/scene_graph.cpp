@@ -0,0 +1,261 @@
+#include "scene_graph.hpp"
+
+#include <fmt/format.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "gltf.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+// Levels smaller than this are updated on the calling thread
+constexpr std::size_t min_nodes_per_task = 4096;
+
+auto local_matrix(glm::vec3 translation, glm::quat rotation, glm::vec3 scale)
+    -> glm::mat4
+{
+  auto basis = glm::mat3_cast(rotation);
+  basis[0] *= scale.x;
+  basis[1] *= scale.y;
+  basis[2] *= scale.z;
+
+  glm::mat4 result{basis};
+  result[3] = glm::vec4{translation, 1.0F};
+  return result;
+}
+
+// glTF requires node matrices to be decomposable into TRS without shear
+auto to_scene_node(const GltfNode& node) -> SceneNode
+{
+  SceneNode result;
+  if (!node.matrix) {
+    result.translation = glm::make_vec3(node.translation.data());
+    result.rotation = glm::quat{node.rotation[3], node.rotation[0],
+                                node.rotation[1], node.rotation[2]};
+    result.scale = glm::make_vec3(node.scale.data());
+    return result;
+  }
+
+  const auto matrix = glm::make_mat4(node.matrix->data());
+  result.translation = glm::vec3{matrix[3]};
+
+  glm::mat3 basis{matrix};
+  result.scale = {glm::length(basis[0]), glm::length(basis[1]),
+                  glm::length(basis[2])};
+  if (glm::determinant(basis) < 0.0F) {
+    result.scale.x = -result.scale.x;
+  }
+  if (result.scale.x != 0.0F && result.scale.y != 0.0F &&
+      result.scale.z != 0.0F) {
+    basis[0] /= result.scale.x;
+    basis[1] /= result.scale.y;
+    basis[2] /= result.scale.z;
+    result.rotation = glm::quat_cast(basis);
+  }
+  return result;
+}
+
+// Returns the parent of every glTF node, or SceneNode::none for roots
+auto find_parents(const GltfScene& scene) -> std::vector<std::uint32_t>
+{
+  std::vector<std::uint32_t> parents(scene.nodes.size(), SceneNode::none);
+  for (std::size_t i = 0; i < scene.nodes.size(); ++i) {
+    for (const auto child : scene.nodes[i].children) {
+      if (parents[child] != SceneNode::none || child == i) {
+        throw std::runtime_error{
+            fmt::format("Node {} has more than one parent", child)};
+      }
+      parents[child] = static_cast<std::uint32_t>(i);
+    }
+  }
+  return parents;
+}
+
+// A breadth-first traversal puts every level after the previous one
+auto breadth_first_order(const GltfScene& scene,
+                         std::span<const std::uint32_t> parents)
+    -> std::vector<std::size_t>
+{
+  std::vector<std::size_t> order;
+  order.reserve(scene.nodes.size());
+  // Roots are the nodes that are nobody's child
+  for (std::size_t i = 0; i < scene.nodes.size(); ++i) {
+    if (parents[i] == SceneNode::none) {
+      order.push_back(i);
+    }
+  }
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    for (const auto child : scene.nodes[order[i]].children) {
+      order.push_back(child);
+    }
+  }
+  if (order.size() != scene.nodes.size()) {
+    throw std::runtime_error{"Node hierarchy contains a cycle"};
+  }
+  return order;
+}
+
+auto invert_order(std::span<const std::size_t> order)
+    -> std::vector<std::uint32_t>
+{
+  std::vector<std::uint32_t> result(order.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    result[order[i]] = static_cast<std::uint32_t>(i);
+  }
+  return result;
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto flatten_nodes(const GltfScene& scene)
+    -> std::vector<SceneNode>
+{
+  std::vector<SceneNode> result;
+
+  if (scene.nodes.empty()) {
+    for (std::size_t i = 0; i < scene.meshes.size(); ++i) {
+      SceneNode node;
+      node.mesh = static_cast<std::uint32_t>(i);
+      result.push_back(node);
+    }
+    return result;
+  }
+
+  const auto parents = find_parents(scene);
+  const auto order = breadth_first_order(scene, parents);
+  const auto flat_index = invert_order(order);
+
+  result.reserve(order.size());
+  for (const auto index : order) {
+    const auto& node = scene.nodes[index];
+    auto flat = to_scene_node(node);
+    if (parents[index] != SceneNode::none) {
+      flat.parent = flat_index[parents[index]];
+    }
+    if (node.mesh) {
+      flat.mesh = static_cast<std::uint32_t>(*node.mesh);
+      if (node.skin) {
+        flat.skin = static_cast<std::uint32_t>(*node.skin);
+      }
+    }
+    result.push_back(flat);
+  }
+  return result;
+}
+
+[[nodiscard]] auto flat_node_indices(const GltfScene& scene)
+    -> std::vector<std::uint32_t>
+{
+  const auto parents = find_parents(scene);
+  return invert_order(breadth_first_order(scene, parents));
+}
+
+SceneGraph::SceneGraph(std::span<const SceneNode> nodes)
+{
+  const auto count = nodes.size();
+  parents_.reserve(count);
+  meshes_.reserve(count);
+  translations_.reserve(count);
+  rotations_.reserve(count);
+  scales_.reserve(count);
+  world_matrices_.resize(count);
+  // Every world matrix starts out unknown
+  dirty_.assign(count, 1);
+  any_dirty_ = count != 0;
+
+  std::vector<std::uint32_t> depths(count, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto& node = nodes[i];
+    if (node.parent != SceneNode::none) {
+      if (node.parent >= i) {
+        throw std::runtime_error{
+            fmt::format("Node {} precedes its parent", i)};
+      }
+      depths[i] = depths[node.parent] + 1;
+    }
+    if (i > 0 && depths[i] != depths[i - 1]) {
+      if (depths[i] != depths[i - 1] + 1) {
+        throw std::runtime_error{
+            fmt::format("Node {} is not in breadth-first order", i)};
+      }
+      level_offsets_.push_back(i);
+    } else if (i == 0) {
+      level_offsets_.push_back(0);
+    }
+
+    parents_.push_back(node.parent);
+    meshes_.push_back(node.mesh);
+    translations_.push_back(node.translation);
+    rotations_.push_back(node.rotation);
+    scales_.push_back(node.scale);
+  }
+  level_offsets_.push_back(count);
+}
+
+auto SceneGraph::set_translation(std::size_t node, glm::vec3 translation)
+    -> void
+{
+  translations_.at(node) = translation;
+  mark_dirty(node);
+}
+
+auto SceneGraph::set_rotation(std::size_t node, glm::quat rotation) -> void
+{
+  rotations_.at(node) = rotation;
+  mark_dirty(node);
+}
+
+auto SceneGraph::set_scale(std::size_t node, glm::vec3 scale) -> void
+{
+  scales_.at(node) = scale;
+  mark_dirty(node);
+}
+
+auto SceneGraph::mark_dirty(std::size_t node) -> void
+{
+  dirty_[node] = 1;
+  any_dirty_ = true;
+}
+
+// Parents of the range are in an earlier level, so their dirty flags and
+// matrices are final
+auto SceneGraph::update_range(std::size_t begin, std::size_t end) -> void
+{
+  for (std::size_t i = begin; i < end; ++i) {
+    const auto parent = parents_[i];
+    if (parent != SceneNode::none && dirty_[parent] != 0) {
+      dirty_[i] = 1;
+    }
+    if (dirty_[i] == 0) {
+      continue;
+    }
+
+    const auto local =
+        local_matrix(translations_[i], rotations_[i], scales_[i]);
+    world_matrices_[i] =
+        parent == SceneNode::none ? local : world_matrices_[parent] * local;
+  }
+}
+
+auto SceneGraph::update(ThreadPool& pool) -> bool
+{
+  if (!any_dirty_) {
+    return false;
+  }
+
+  for (std::size_t level = 0; level + 1 < level_offsets_.size(); ++level) {
+    const auto begin = level_offsets_[level];
+    const auto end = level_offsets_[level + 1];
+    parallel_for(pool, end - begin, min_nodes_per_task,
+                 [this, begin](std::size_t first, std::size_t last) {
+                   update_range(begin + first, begin + last);
+                 });
+  }
+
+  std::ranges::fill(dirty_, std::uint8_t{0});
+  any_dirty_ = false;
+  return true;
+}
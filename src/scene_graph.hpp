@@ -0,0 +1,104 @@
+#ifndef SCENE_GRAPH_HPP
+#define SCENE_GRAPH_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct GltfScene;
+class ThreadPool;
+
+// A node of a flattened hierarchy, as produced by flatten_nodes() and stored
+// in the mesh cache
+struct SceneNode {
+  static constexpr std::uint32_t none = 0xFFFF'FFFF;
+
+  std::uint32_t parent = none;
+  std::uint32_t mesh = none;
+  // Index into MeshData::skins. The mesh of a skinned node is placed by its
+  // joints rather than by the node.
+  std::uint32_t skin = none;
+  glm::vec3 translation{0.0F};
+  glm::quat rotation{1.0F, 0.0F, 0.0F, 0.0F};
+  glm::vec3 scale{1.0F};
+};
+
+/**
+ * @brief Flattens the node hierarchy of a glTF scene in breadth-first order.
+ *
+ * Every parent precedes its children and the nodes of each depth are
+ * contiguous. Nodes given by a matrix are decomposed into TRS. Scenes without
+ * nodes get one root node per mesh.
+ *
+ * @throw std::runtime_error if the hierarchy is not a forest
+ */
+[[nodiscard]] auto flatten_nodes(const GltfScene& scene)
+    -> std::vector<SceneNode>;
+
+// Returns the index in the flattened hierarchy of every glTF node
+[[nodiscard]] auto flat_node_indices(const GltfScene& scene)
+    -> std::vector<std::uint32_t>;
+
+/**
+ * @brief A node hierarchy stored as structure of arrays.
+ *
+ * Setting a local transform marks the node dirty. update() then recomputes the
+ * world matrices of dirty nodes and their descendants only, one depth level
+ * at a time, with large levels split across a thread pool.
+ */
+class SceneGraph {
+public:
+  SceneGraph() = default;
+
+  // nodes must be in the order produced by flatten_nodes()
+  explicit SceneGraph(std::span<const SceneNode> nodes);
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t
+  {
+    return parents_.size();
+  }
+
+  [[nodiscard]] auto parents() const noexcept -> std::span<const std::uint32_t>
+  {
+    return parents_;
+  }
+
+  [[nodiscard]] auto meshes() const noexcept -> std::span<const std::uint32_t>
+  {
+    return meshes_;
+  }
+
+  [[nodiscard]] auto world_matrices() const noexcept
+      -> std::span<const glm::mat4>
+  {
+    return world_matrices_;
+  }
+
+  auto set_translation(std::size_t node, glm::vec3 translation) -> void;
+  auto set_rotation(std::size_t node, glm::quat rotation) -> void;
+  auto set_scale(std::size_t node, glm::vec3 scale) -> void;
+
+  // Returns whether any world matrix was recomputed
+  auto update(ThreadPool& pool) -> bool;
+
+private:
+  std::vector<std::uint32_t> parents_;
+  std::vector<std::uint32_t> meshes_;
+  std::vector<glm::vec3> translations_;
+  std::vector<glm::quat> rotations_;
+  std::vector<glm::vec3> scales_;
+  std::vector<glm::mat4> world_matrices_;
+  std::vector<std::uint8_t> dirty_;
+  // Start of each depth level, followed by the node count
+  std::vector<std::size_t> level_offsets_;
+  bool any_dirty_ = false;
+
+  auto mark_dirty(std::size_t node) -> void;
+  auto update_range(std::size_t begin, std::size_t end) -> void;
+};
+
+#endif // SCENE_GRAPH_HPP
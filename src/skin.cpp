@@ -0,0 +1,126 @@
+#include "skin.hpp"
+
+#include <fmt/format.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SKIN_USE_SSE 1
+#endif
+
+#include "gltf.hpp"
+#include "scene_graph.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+// Batches smaller than this are multiplied on the calling thread
+constexpr std::size_t min_joints_per_task = 2048;
+
+// result = lhs * rhs for column-major matrices
+auto multiply(const float* lhs, const float* rhs, float* result) noexcept
+    -> void
+{
+#ifdef SKIN_USE_SSE
+  const auto c0 = _mm_loadu_ps(lhs);
+  const auto c1 = _mm_loadu_ps(lhs + 4);
+  const auto c2 = _mm_loadu_ps(lhs + 8);
+  const auto c3 = _mm_loadu_ps(lhs + 12);
+  // Every column of the result combines the columns of lhs, weighted by the
+  // components of the matching column of rhs
+  for (std::size_t j = 0; j < 4; ++j) {
+    const auto* column = rhs + j * 4;
+    auto sum = _mm_mul_ps(c0, _mm_set1_ps(column[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_set1_ps(column[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c2, _mm_set1_ps(column[2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c3, _mm_set1_ps(column[3])));
+    _mm_storeu_ps(result + j * 4, sum);
+  }
+#else
+  for (std::size_t j = 0; j < 4; ++j) {
+    for (std::size_t i = 0; i < 4; ++i) {
+      float sum = 0.0F;
+      for (std::size_t k = 0; k < 4; ++k) {
+        sum += lhs[k * 4 + i] * rhs[j * 4 + k];
+      }
+      result[j * 4 + i] = sum;
+    }
+  }
+#endif
+}
+
+} // anonymous namespace
+
+[[nodiscard]] auto flatten_skins(const GltfScene& scene) -> FlatSkins
+{
+  FlatSkins result;
+  if (scene.skins.empty()) {
+    return result;
+  }
+
+  const auto flat_indices = flat_node_indices(scene);
+  for (const auto& skin : scene.skins) {
+    SkinRange range;
+    range.first_joint = static_cast<std::uint32_t>(result.joints.size());
+    range.joint_count = static_cast<std::uint32_t>(skin.joints.size());
+    if (range.joint_count > std::uint32_t{1} << 16) {
+      throw std::runtime_error{
+          fmt::format("Skin has {} joints, at most 65536 are supported",
+                      range.joint_count)};
+    }
+
+    for (const auto node : skin.joints) {
+      SkinJoint joint;
+      joint.node = flat_indices[node];
+      result.joints.push_back(joint);
+    }
+    if (skin.inverse_bind_matrices) {
+      const auto matrices = scene.accessor_view<std::array<float, 16>>(
+          *skin.inverse_bind_matrices);
+      for (std::size_t i = 0; i < skin.joints.size(); ++i) {
+        result.joints[range.first_joint + i].inverse_bind =
+            glm::make_mat4(matrices[i].data());
+      }
+    }
+    result.skins.push_back(range);
+  }
+  return result;
+}
+
+auto multiply_joint_matrices(std::span<const glm::mat4> lhs,
+                             std::span<const std::uint32_t> nodes,
+                             std::span<const glm::mat4> rhs,
+                             std::span<glm::mat4> result) noexcept -> void
+{
+  for (std::size_t i = 0; i < result.size(); ++i) {
+    multiply(glm::value_ptr(lhs[nodes[i]]), glm::value_ptr(rhs[i]),
+             glm::value_ptr(result[i]));
+  }
+}
+
+JointPalette::JointPalette(std::span<const SkinJoint> joints)
+{
+  nodes_.reserve(joints.size());
+  inverse_binds_.reserve(joints.size());
+  for (const auto& joint : joints) {
+    nodes_.push_back(joint.node);
+    inverse_binds_.push_back(joint.inverse_bind);
+  }
+  matrices_.resize(joints.size());
+}
+
+auto JointPalette::update(std::span<const glm::mat4> world_matrices,
+                          ThreadPool& pool) -> void
+{
+  parallel_for(pool, nodes_.size(), min_joints_per_task,
+               [&](std::size_t begin, std::size_t end) {
+                 multiply_joint_matrices(
+                     world_matrices,
+                     std::span{nodes_}.subspan(begin, end - begin),
+                     std::span{inverse_binds_}.subspan(begin, end - begin),
+                     std::span{matrices_}.subspan(begin, end - begin));
+               });
+}
@@ -0,0 +1,84 @@
+#ifndef SKIN_HPP
+#define SKIN_HPP
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct GltfScene;
+class ThreadPool;
+
+// The bind pose of a skinned vertex, matching the SkinVertex struct of
+// shaders/skinning.comp
+struct SkinVertex {
+  std::array<float, 3> position{};
+  // Indices into the joints of the skin the vertex is drawn with
+  std::array<std::uint16_t, 4> joints{};
+  std::array<float, 4> weights{};
+};
+static_assert(sizeof(SkinVertex) == 36);
+
+struct SkinJoint {
+  // Index of the joint node in the flattened hierarchy
+  std::uint32_t node = 0;
+  glm::mat4 inverse_bind{1.0F};
+};
+
+// The joints of one skin within the joints of all skins
+struct SkinRange {
+  std::uint32_t first_joint = 0;
+  std::uint32_t joint_count = 0;
+};
+
+struct FlatSkins {
+  std::vector<SkinRange> skins;
+  std::vector<SkinJoint> joints;
+};
+
+// Concatenates the joints of every skin, referring to joint nodes by their
+// index in the hierarchy produced by flatten_nodes()
+[[nodiscard]] auto flatten_skins(const GltfScene& scene) -> FlatSkins;
+
+// Writes lhs[nodes[i]] * rhs[i] to result[i], using SSE where available
+auto multiply_joint_matrices(std::span<const glm::mat4> lhs,
+                             std::span<const std::uint32_t> nodes,
+                             std::span<const glm::mat4> rhs,
+                             std::span<glm::mat4> result) noexcept -> void;
+
+/**
+ * @brief The skinning matrices of every joint of every skin.
+ *
+ * The joints of all skins are stored back to back, so that one update
+ * multiplies the world matrix of every joint with its inverse bind matrix in
+ * a single batch. Large batches are split across a thread pool.
+ */
+class JointPalette {
+public:
+  JointPalette() = default;
+  explicit JointPalette(std::span<const SkinJoint> joints);
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t
+  {
+    return nodes_.size();
+  }
+
+  [[nodiscard]] auto matrices() const noexcept -> std::span<const glm::mat4>
+  {
+    return matrices_;
+  }
+
+  // world_matrices are indexed by flattened node
+  auto update(std::span<const glm::mat4> world_matrices, ThreadPool& pool)
+      -> void;
+
+private:
+  std::vector<std::uint32_t> nodes_;
+  std::vector<glm::mat4> inverse_binds_;
+  std::vector<glm::mat4> matrices_;
+};
+
+#endif // SKIN_HPP
@@ -0,0 +1,389 @@
+#include "staging_ring.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "buffer_utils.hpp"
+
+namespace vulkan {
+
+namespace {
+
+// Offset alignment of every staged upload, a multiple of both the texel
+// sizes copyBufferToImage requires and the usual
+// optimalBufferCopyOffsetAlignment
+constexpr vk::DeviceSize staging_alignment = 256;
+
+[[nodiscard]] constexpr auto align_up(vk::DeviceSize offset) noexcept
+    -> vk::DeviceSize
+{
+  return (offset + staging_alignment - 1) / staging_alignment *
+         staging_alignment;
+}
+
+} // anonymous namespace
+
+StagingRing::StagingRing(MemoryAllocator& allocator,
+                         ImageStateTracker& image_states, vk::Device device,
+                         const DeviceQueue& graphics,
+                         const DeviceQueue& transfer, vk::DeviceSize size)
+    : image_states_{&image_states}, device_{device}, graphics_{graphics},
+      transfer_{transfer}, size_{size}
+{
+  const vk::CommandPoolCreateInfo pool_create_info{
+      vk::CommandPoolCreateFlagBits::eTransient, graphics_.family};
+  command_pool_ = device_.createCommandPoolUnique(pool_create_info);
+  if (transfer_.family != graphics_.family) {
+    const vk::CommandPoolCreateInfo transfer_pool_create_info{
+        vk::CommandPoolCreateFlagBits::eTransient, transfer_.family};
+    transfer_command_pool_ =
+        device_.createCommandPoolUnique(transfer_pool_create_info);
+  }
+
+  std::tie(buffer_, memory_) =
+      create_buffer(allocator, device_, size_,
+                    vk::BufferUsageFlagBits::eTransferSrc,
+                    vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+StagingRing::~StagingRing()
+{
+  finish();
+}
+
+auto StagingRing::begin_commands(vk::CommandPool pool)
+    -> vk::UniqueCommandBuffer
+{
+  const vk::CommandBufferAllocateInfo alloc_info{
+      pool, vk::CommandBufferLevel::ePrimary, 1};
+  auto command_buffer =
+      std::move(device_.allocateCommandBuffersUnique(alloc_info)[0]);
+  const vk::CommandBufferBeginInfo begin_info{
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
+  command_buffer->begin(begin_info);
+  return command_buffer;
+}
+
+auto StagingRing::end_commands(vk::UniqueCommandBuffer command_buffer,
+                               vk::DeviceSize begin, vk::DeviceSize size)
+    -> void
+{
+  // Transfer writes are visible to every command submitted afterwards
+  image_states_->add_memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                                    vk::AccessFlagBits::eTransferWrite,
+                                    vk::PipelineStageFlagBits::eAllCommands,
+                                    vk::AccessFlagBits::eMemoryRead);
+  image_states_->flush(*command_buffer);
+  command_buffer->end();
+
+  Submission submission;
+  submission.value = graphics_.queue->submit({&command_buffer.get(), 1});
+  submission.command_buffers.push_back(std::move(command_buffer));
+  submission.begin = begin;
+  submission.size = size;
+  push_submission(std::move(submission));
+}
+
+auto StagingRing::push_submission(Submission submission) -> void
+{
+  if (in_flight_.empty()) {
+    busy_since_ = std::chrono::steady_clock::now();
+  }
+  ++last_token_.value;
+  submission.token = last_token_;
+  in_flight_.push_back(std::move(submission));
+}
+
+auto StagingRing::stage(vk::DeviceSize begin, const void* data,
+                        vk::DeviceSize size) -> void
+{
+  memcpy(memory_.mapped() + begin, data, size);
+  head_ = align_up(begin + size);
+  if (!batch_.begin) {
+    batch_.begin = begin;
+  }
+  batch_.size += size;
+}
+
+auto StagingRing::upload(vk::Buffer dst, vk::DeviceSize dst_offset,
+                         const void* data, vk::DeviceSize size) -> UploadToken
+{
+  // Nothing is staged, so there is nothing to wait for
+  if (size == 0) {
+    return last_token_;
+  }
+  const auto* bytes = static_cast<const std::byte*>(data);
+  for (vk::DeviceSize done = 0; done < size;) {
+    const auto chunk_size = std::min(size - done, max_chunk_size());
+    const auto begin = reserve(chunk_size);
+    stage(begin, bytes + done, chunk_size);
+
+    const vk::BufferCopy region{begin, dst_offset + done, chunk_size};
+    auto& copies = batch_.buffer_copies;
+    if (copies.empty() || copies.back().dst != dst) {
+      copies.push_back({dst, {}});
+    }
+    copies.back().regions.push_back(region);
+    done += chunk_size;
+    if (done == size) {
+      batch_.uploaded_buffers.push_back(dst);
+    }
+    // The token is that of the batch holding the last chunk
+    if (done < size) {
+      maybe_flush_batch();
+    }
+  }
+  const auto token = batch_token();
+  maybe_flush_batch();
+  return token;
+}
+
+auto StagingRing::upload(vk::Image dst, std::uint32_t width,
+                         std::uint32_t height, std::uint32_t texel_size,
+                         const void* texels) -> UploadToken
+{
+  if (width == 0 || height == 0 || texel_size == 0) {
+    throw std::runtime_error{fmt::format(
+        "cannot upload a {}x{} image of {} byte texels", width, height,
+        texel_size)};
+  }
+  // Images are split into chunks of whole rows, which start at multiples of
+  // the granularity of the transfer queue. A granularity of zero only
+  // allows whole images.
+  const auto row_size = vk::DeviceSize{width} * texel_size;
+  auto chunk_rows = std::min<vk::DeviceSize>(max_chunk_size() / row_size,
+                                             height);
+  const auto granularity = transfer_.image_granularity.height;
+  if (chunk_rows < height) {
+    chunk_rows = granularity == 0 ? 0 : chunk_rows / granularity * granularity;
+  }
+  if (chunk_rows == 0) {
+    throw std::runtime_error{fmt::format(
+        "image rows of {} bytes do not fit the staging ring", row_size)};
+  }
+
+  image_states_->add(dst, vk::ImageAspectFlagBits::eColor);
+  const auto* bytes = static_cast<const std::byte*>(texels);
+  for (std::uint32_t row = 0; row < height;) {
+    const auto rows = static_cast<std::uint32_t>(
+        std::min<vk::DeviceSize>(height - row, chunk_rows));
+    const auto chunk_size = rows * row_size;
+    const auto begin = reserve(chunk_size);
+    stage(begin, bytes + row * row_size, chunk_size);
+
+    vk::BufferImageCopy region;
+    region.setBufferOffset(begin)
+        .setImageSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1})
+        .setImageOffset({0, static_cast<std::int32_t>(row), 0})
+        .setImageExtent({width, rows, 1});
+    auto& copies = batch_.image_copies;
+    if (copies.empty() || copies.back().dst != dst) {
+      copies.push_back({dst, {}});
+    }
+    copies.back().regions.push_back(region);
+    row += rows;
+    if (row == height) {
+      batch_.uploaded_images.push_back(dst);
+    } else {
+      maybe_flush_batch();
+    }
+  }
+  const auto token = batch_token();
+  maybe_flush_batch();
+  return token;
+}
+
+auto StagingRing::begin_batch() noexcept -> void
+{
+  ++batch_depth_;
+}
+
+auto StagingRing::end_batch() -> UploadToken
+{
+  const auto token = batch_token();
+  --batch_depth_;
+  maybe_flush_batch();
+  return batch_depth_ == 0 ? last_token_ : token;
+}
+
+auto StagingRing::maybe_flush_batch() -> void
+{
+  if (batch_depth_ == 0 || batch_.size >= max_chunk_size()) {
+    flush_batch();
+  }
+}
+
+auto StagingRing::flush_batch() -> void
+{
+  if (!batch_.begin) {
+    return;
+  }
+
+  if (transfer_command_pool_) {
+    submit_to_transfer_queue();
+  } else {
+    auto command_buffer = begin_commands(*command_pool_);
+    record_copies(*command_buffer);
+    for (const auto image : batch_.uploaded_images) {
+      image_states_->use(image, fragment_shader_read_access);
+    }
+    end_commands(std::move(command_buffer), *batch_.begin, batch_.size);
+  }
+  batch_ = {};
+}
+
+auto StagingRing::record_copies(vk::CommandBuffer command_buffer) -> void
+{
+  for (const auto& copies : batch_.image_copies) {
+    image_states_->use(copies.dst, transfer_destination_access);
+  }
+  image_states_->flush(command_buffer);
+  for (const auto& copies : batch_.buffer_copies) {
+    command_buffer.copyBuffer(*buffer_, copies.dst,
+                              static_cast<std::uint32_t>(
+                                  copies.regions.size()),
+                              copies.regions.data());
+  }
+  for (const auto& copies : batch_.image_copies) {
+    command_buffer.copyBufferToImage(
+        *buffer_, copies.dst, vk::ImageLayout::eTransferDstOptimal,
+        static_cast<std::uint32_t>(copies.regions.size()),
+        copies.regions.data());
+  }
+}
+
+auto StagingRing::submit_to_transfer_queue() -> void
+{
+  Submission submission;
+  submission.begin = *batch_.begin;
+  submission.size = batch_.size;
+
+  // The release makes the copies available, and the acquire visible to
+  // every later command on the graphics queue
+  vk::BufferMemoryBarrier ownership;
+  ownership.setSrcQueueFamilyIndex(transfer_.family)
+      .setDstQueueFamilyIndex(graphics_.family)
+      .setSize(VK_WHOLE_SIZE);
+
+  auto transfer_commands = begin_commands(*transfer_command_pool_);
+  record_copies(*transfer_commands);
+  for (const auto buffer : batch_.uploaded_buffers) {
+    image_states_->add_buffer_barrier(
+        vk::BufferMemoryBarrier{ownership}
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setBuffer(buffer),
+        vk::PipelineStageFlagBits::eTransfer, {});
+  }
+  for (const auto image : batch_.uploaded_images) {
+    image_states_->release(image, fragment_shader_read_access,
+                           transfer_.family, graphics_.family);
+  }
+  image_states_->flush(*transfer_commands);
+  transfer_commands->end();
+
+  auto acquire_commands = begin_commands(*command_pool_);
+  for (const auto buffer : batch_.uploaded_buffers) {
+    image_states_->add_buffer_barrier(
+        vk::BufferMemoryBarrier{ownership}
+            .setDstAccessMask(vk::AccessFlagBits::eMemoryRead)
+            .setBuffer(buffer),
+        {}, vk::PipelineStageFlagBits::eAllCommands);
+  }
+  for (const auto image : batch_.uploaded_images) {
+    image_states_->acquire(image, fragment_shader_read_access,
+                           transfer_.family, graphics_.family);
+  }
+  image_states_->flush(*acquire_commands);
+  acquire_commands->end();
+
+  const SemaphoreWait copies_done{
+      transfer_.queue->semaphore(), vk::PipelineStageFlagBits::eAllCommands,
+      transfer_.queue->submit({&transfer_commands.get(), 1})};
+  submission.value = graphics_.queue->submit(
+      {&acquire_commands.get(), 1}, {&copies_done, 1});
+
+  submission.command_buffers.push_back(std::move(transfer_commands));
+  submission.command_buffers.push_back(std::move(acquire_commands));
+  push_submission(std::move(submission));
+}
+
+auto StagingRing::is_complete(UploadToken token) -> bool
+{
+  retire(false);
+  return token <= completed_token_;
+}
+
+auto StagingRing::wait(UploadToken token) -> void
+{
+  if (last_token_ < token) {
+    flush_batch();
+  }
+  while (completed_token_ < token && !in_flight_.empty()) {
+    retire(true);
+  }
+}
+
+auto StagingRing::finish() -> void
+{
+  flush_batch();
+  while (!in_flight_.empty()) {
+    retire(true);
+  }
+}
+
+auto StagingRing::retire(bool wait) -> void
+{
+  if (wait && !in_flight_.empty()) {
+    graphics_.queue->wait(in_flight_.front().value);
+  }
+  while (!in_flight_.empty() &&
+         graphics_.queue->is_complete(in_flight_.front().value)) {
+    stats_.bytes += in_flight_.front().size;
+    completed_token_ = in_flight_.front().token;
+    in_flight_.pop_front();
+    if (in_flight_.empty()) {
+      stats_.seconds += std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - busy_since_)
+                            .count();
+    }
+  }
+}
+
+auto StagingRing::reserve(vk::DeviceSize size) -> vk::DeviceSize
+{
+  retire(false);
+  while (true) {
+    if (in_flight_.empty() && !batch_.begin) {
+      head_ = 0;
+      return 0;
+    }
+    // The ring is free from head_ up to the oldest staged data. The next
+    // head_ must stay short of it, or a full ring would look empty.
+    const auto tail =
+        in_flight_.empty() ? *batch_.begin : in_flight_.front().begin;
+    if (head_ >= tail) {
+      if (head_ + size <= size_) {
+        return head_;
+      }
+      if (align_up(size) < tail) {
+        return 0;
+      }
+    } else if (align_up(head_ + size) < tail) {
+      return head_;
+    }
+    // The pending batch fills the ring, so it has to go before anything
+    // can be waited for
+    if (in_flight_.empty()) {
+      flush_batch();
+    }
+    retire(true);
+  }
+}
+
+} // namespace vulkan
@@ -0,0 +1,261 @@
+#ifndef STAGING_RING_HPP
+#define STAGING_RING_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "image_state.hpp"
+#include "memory_allocator.hpp"
+#include "timeline_queue.hpp"
+
+namespace vulkan {
+
+// Totals of the uploads that completed so far
+struct UploadStats {
+  std::uint64_t bytes = 0;
+  // Time during which at least one upload was in flight
+  double seconds = 0.0;
+
+  [[nodiscard]] auto megabytes_per_second() const noexcept -> double
+  {
+    return seconds > 0.0 ? static_cast<double>(bytes) / 1e6 / seconds : 0.0;
+  }
+};
+
+// A queue and the family it comes from
+struct DeviceQueue {
+  TimelineQueue* queue = nullptr;
+  std::uint32_t family = 0;
+  // The minImageTransferGranularity of the family
+  vk::Extent3D image_granularity{1, 1, 1};
+};
+
+// Identifies a submission to a StagingRing. Submissions complete in order, so
+// a token is complete once any later one is.
+struct UploadToken {
+  std::uint64_t value = 0;
+
+  friend auto operator<=>(const UploadToken&, const UploadToken&) = default;
+};
+
+/**
+ * @brief A persistently mapped staging buffer that every upload goes through.
+ *
+ * Each upload copies its data to the next free part of the ring and records
+ * the transfer into the pending batch. A batch is submitted when the upload
+ * that started it returns, or once it holds half the ring, which lets one
+ * half be filled while the other is transferred. Its part of the ring is
+ * reused once the graphics queue timeline passes the batch, so an upload
+ * only waits on the queue when the ring is full. Between begin_batch() and
+ * end_batch() every upload joins the same batch, whose copies and layout
+ * transitions share a single command buffer and two pipeline barriers. Image
+ * layouts go through the ImageStateTracker shared with the commands given to
+ * submit().
+ *
+ * Every batch ends with a barrier that makes its data visible to all later
+ * commands on the queue, so no one has to wait for an upload before
+ * submitting work that reads it. Each upload returns a token that can be
+ * polled or waited on, for when the host has to know that the transfer is
+ * done, such as before destroying its source. Not thread safe.
+ *
+ * Given a transfer queue of another family than the graphics one, the copies
+ * run there, next to rendering. Each batch then releases the resources it
+ * completes to the graphics family, and a small command buffer submitted to
+ * the graphics queue waits for the copies on the transfer queue timeline and
+ * acquires them. Copies between resources passed to submit() stay on the
+ * graphics queue, which owns them.
+ */
+class StagingRing {
+public:
+  // transfer is the same as graphics on devices without a separate transfer
+  // family
+  StagingRing(MemoryAllocator& allocator, ImageStateTracker& image_states,
+              vk::Device device, const DeviceQueue& graphics,
+              const DeviceQueue& transfer, vk::DeviceSize size);
+  // Waits for the uploads in flight
+  ~StagingRing();
+
+  StagingRing(const StagingRing&) = delete;
+  auto operator=(const StagingRing&) -> StagingRing& = delete;
+  StagingRing(StagingRing&&) = delete;
+  auto operator=(StagingRing&&) -> StagingRing& = delete;
+
+  // Copies size bytes of data to dst at dst_offset
+  auto upload(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data,
+              vk::DeviceSize size) -> UploadToken;
+
+  // Copies tightly packed texels to a newly created 2D image and leaves it
+  // in the shader read only layout
+  auto upload(vk::Image dst, std::uint32_t width, std::uint32_t height,
+              std::uint32_t texel_size, const void* texels) -> UploadToken;
+
+  // Submits transfer commands that need no staged data, such as copies
+  // between device local resources, after the pending batch. Barriers left
+  // queued in the image state tracker are recorded at the end.
+  template <typename Record> auto submit(Record&& record) -> UploadToken
+  {
+    flush_batch();
+    auto command_buffer = begin_commands(*command_pool_);
+    std::forward<Record>(record)(*command_buffer);
+    end_commands(std::move(command_buffer), head_, 0);
+    return last_token_;
+  }
+
+  // Holds back the submission of uploads until the matching end_batch().
+  // Batches nest.
+  auto begin_batch() noexcept -> void;
+  auto end_batch() -> UploadToken;
+
+  [[nodiscard]] auto is_complete(UploadToken token) -> bool;
+  auto wait(UploadToken token) -> void;
+
+  // Waits for every upload in flight
+  auto finish() -> void;
+
+  [[nodiscard]] auto stats() const noexcept -> const UploadStats&
+  {
+    return stats_;
+  }
+
+  // Command buffers submitted so far
+  [[nodiscard]] auto submission_count() const noexcept -> std::uint64_t
+  {
+    return last_token_.value;
+  }
+
+private:
+  struct Submission {
+    std::vector<vk::UniqueCommandBuffer> command_buffers;
+    // Complete once the graphics queue timeline reaches it
+    std::uint64_t value = 0;
+    UploadToken token;
+    // Offset and size of the staged data in the ring
+    vk::DeviceSize begin = 0;
+    vk::DeviceSize size = 0;
+  };
+
+  // Consecutive copies to the same resource, recorded as one command
+  struct BufferCopies {
+    vk::Buffer dst;
+    std::vector<vk::BufferCopy> regions;
+  };
+  struct ImageCopies {
+    vk::Image dst;
+    std::vector<vk::BufferImageCopy> regions;
+  };
+
+  // Uploads staged but not submitted yet
+  struct Batch {
+    // Where the first staged byte is, if there is one
+    std::optional<vk::DeviceSize> begin;
+    vk::DeviceSize size = 0;
+    std::vector<BufferCopies> buffer_copies;
+    std::vector<ImageCopies> image_copies;
+    // Resources whose last bytes are copied, ready for the graphics queue
+    std::vector<vk::Buffer> uploaded_buffers;
+    std::vector<vk::Image> uploaded_images;
+  };
+
+  ImageStateTracker* image_states_;
+  vk::Device device_;
+  DeviceQueue graphics_;
+  DeviceQueue transfer_;
+  vk::UniqueCommandPool command_pool_;
+  // Null without a separate transfer family
+  vk::UniqueCommandPool transfer_command_pool_;
+  vk::UniqueBuffer buffer_;
+  Allocation memory_;
+  vk::DeviceSize size_ = 0;
+  // Where the next upload is staged
+  vk::DeviceSize head_ = 0;
+  // Oldest first
+  std::deque<Submission> in_flight_;
+  Batch batch_;
+  std::size_t batch_depth_ = 0;
+  UploadToken last_token_;
+  UploadToken completed_token_;
+  UploadStats stats_;
+  std::chrono::steady_clock::time_point busy_since_;
+
+  [[nodiscard]] auto max_chunk_size() const noexcept -> vk::DeviceSize
+  {
+    return size_ / 2;
+  }
+
+  // The token the pending batch gets when it is submitted
+  [[nodiscard]] auto batch_token() const noexcept -> UploadToken
+  {
+    return {last_token_.value + 1};
+  }
+
+  // Drops the submissions that completed, after waiting for the
+  // oldest one if wait is set
+  auto retire(bool wait) -> void;
+  // Returns the offset of size free bytes, waiting for transfers to finish
+  // until there are
+  [[nodiscard]] auto reserve(vk::DeviceSize size) -> vk::DeviceSize;
+  // Copies data to the ring at begin as part of the pending batch
+  auto stage(vk::DeviceSize begin, const void* data, vk::DeviceSize size)
+      -> void;
+  // Submits the pending batch once it is large enough, or at once outside
+  // of begin_batch()
+  auto maybe_flush_batch() -> void;
+  auto flush_batch() -> void;
+  // Records the copies of the pending batch and the transitions before them
+  auto record_copies(vk::CommandBuffer command_buffer) -> void;
+  // Submits the pending batch to the transfer queue and its acquire to the
+  // graphics queue
+  auto submit_to_transfer_queue() -> void;
+  [[nodiscard]] auto begin_commands(vk::CommandPool pool)
+      -> vk::UniqueCommandBuffer;
+  // Ends the command buffer with the queued barriers and submits it to the
+  // graphics queue
+  auto end_commands(vk::UniqueCommandBuffer command_buffer,
+                    vk::DeviceSize begin, vk::DeviceSize size) -> void;
+  // Assigns the next token to a submitted batch
+  auto push_submission(Submission submission) -> void;
+};
+
+/**
+ * @brief Merges the uploads made during its lifetime into as few submissions
+ * as the staging ring has room for.
+ */
+class UploadBatch {
+public:
+  explicit UploadBatch(StagingRing& ring) noexcept : ring_{&ring}
+  {
+    ring_->begin_batch();
+  }
+  // Submits the batch unless submit() did
+  ~UploadBatch()
+  {
+    if (ring_ != nullptr) {
+      ring_->end_batch();
+    }
+  }
+
+  UploadBatch(const UploadBatch&) = delete;
+  auto operator=(const UploadBatch&) -> UploadBatch& = delete;
+  UploadBatch(UploadBatch&&) = delete;
+  auto operator=(UploadBatch&&) -> UploadBatch& = delete;
+
+  auto submit() -> UploadToken
+  {
+    return std::exchange(ring_, nullptr)->end_batch();
+  }
+
+private:
+  StagingRing* ring_;
+};
+
+} // namespace vulkan
+
+#endif // STAGING_RING_HPP
@@ -0,0 +1,127 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(std::size_t thread_count)
+{
+  workers_.reserve(thread_count);
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back([this] { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::scoped_lock lock{mutex_};
+    stopping_ = true;
+  }
+  condition_.notify_all();
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+[[nodiscard]] auto ThreadPool::default_thread_count() noexcept -> std::size_t
+{
+  // Leave one core to the render thread
+  const std::size_t cores = std::thread::hardware_concurrency();
+  return std::max<std::size_t>(cores, 2) - 1;
+}
+
+auto ThreadPool::push(std::function<void()> task) -> void
+{
+  {
+    std::scoped_lock lock{mutex_};
+    tasks_.push_back(std::move(task));
+  }
+  condition_.notify_one();
+}
+
+auto ThreadPool::try_run_one() -> bool
+{
+  std::function<void()> task;
+  {
+    std::scoped_lock lock{mutex_};
+    if (tasks_.empty()) {
+      return false;
+    }
+    task = std::move(tasks_.front());
+    tasks_.pop_front();
+  }
+  task();
+  return true;
+}
+
+auto ThreadPool::worker_loop() -> void
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock{mutex_};
+      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+namespace {
+
+// Shared with the worker tasks, which may outlive the call
+struct ParallelFor {
+  const std::function<void(std::size_t, std::size_t)>* fn = nullptr;
+  std::size_t count = 0;
+  std::size_t chunk = 0;
+  std::size_t chunk_count = 0;
+  std::atomic<std::size_t> next{0};
+  std::atomic<std::size_t> done{0};
+
+  // Runs chunks until none are left
+  auto run() -> void
+  {
+    for (auto i = next.fetch_add(1); i < chunk_count; i = next.fetch_add(1)) {
+      const auto begin = i * chunk;
+      (*fn)(begin, std::min(begin + chunk, count));
+      if (done.fetch_add(1) + 1 == chunk_count) {
+        done.notify_one();
+      }
+    }
+  }
+};
+
+} // anonymous namespace
+
+auto parallel_for(ThreadPool& pool, std::size_t count,
+                  std::size_t min_per_task,
+                  const std::function<void(std::size_t, std::size_t)>& fn)
+    -> void
+{
+  const auto per_task = std::max<std::size_t>(min_per_task, 1);
+  const auto task_count = std::min(pool.thread_count() + 1, count / per_task);
+  if (task_count <= 1) {
+    fn(0, count);
+    return;
+  }
+
+  auto state = std::make_shared<ParallelFor>();
+  state->fn = &fn;
+  state->count = count;
+  state->chunk = (count + task_count - 1) / task_count;
+  state->chunk_count = (count + state->chunk - 1) / state->chunk;
+  for (std::size_t i = 1; i < task_count; ++i) {
+    // Completion is tracked through the state rather than the futures
+    static_cast<void>(pool.submit([state] { state->run(); }));
+  }
+  state->run();
+  for (auto done = state->done.load(); done != state->chunk_count;
+       done = state->done.load()) {
+    state->done.wait(done);
+  }
+}
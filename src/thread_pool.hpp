@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief A fixed set of worker threads executing submitted tasks in FIFO order.
+ *
+ * Tasks may submit further tasks and wait on them with wait(), which runs
+ * queued work on the waiting thread instead of blocking, so nested waits never
+ * starve the pool.
+ */
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t thread_count = default_thread_count());
+
+  // Finishes all queued tasks before joining the workers
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+  ThreadPool(ThreadPool&&) = delete;
+  auto operator=(ThreadPool&&) -> ThreadPool& = delete;
+
+  template <typename Func>
+  [[nodiscard]] auto submit(Func&& f)
+      -> std::future<std::invoke_result_t<std::decay_t<Func>>>
+  {
+    using Result = std::invoke_result_t<std::decay_t<Func>>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Func>(f));
+    auto future = task->get_future();
+    push([task = std::move(task)] { (*task)(); });
+    return future;
+  }
+
+  // Blocks until future is ready while helping to execute queued tasks
+  template <typename T> auto wait(const std::future<T>& future) -> void
+  {
+    while (future.wait_for(std::chrono::seconds{0}) !=
+           std::future_status::ready) {
+      if (!try_run_one()) {
+        future.wait_for(std::chrono::milliseconds{1});
+      }
+    }
+  }
+
+  [[nodiscard]] auto thread_count() const noexcept -> std::size_t
+  {
+    return workers_.size();
+  }
+
+  [[nodiscard]] static auto default_thread_count() noexcept -> std::size_t;
+
+private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> workers_;
+  bool stopping_ = false;
+
+  auto push(std::function<void()> task) -> void;
+  auto try_run_one() -> bool;
+  auto worker_loop() -> void;
+};
+
+/**
+ * @brief Calls fn(begin, end) for chunks of [0, count) across the pool.
+ *
+ * Only as many chunks as leave at least min_per_task elements to each are
+ * made. The calling thread works through the chunks as well and then waits
+ * only for the ones workers already took, never running other queued tasks,
+ * so per-frame work does not stall behind an asset load. Workers that get to
+ * their task after all chunks are taken return at once.
+ */
+auto parallel_for(ThreadPool& pool, std::size_t count,
+                  std::size_t min_per_task,
+                  const std::function<void(std::size_t, std::size_t)>& fn)
+    -> void;
+
+#endif // THREAD_POOL_HPP
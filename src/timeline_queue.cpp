@@ -0,0 +1,94 @@
+#include "timeline_queue.hpp"
+
+#include <fmt/format.h>
+
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace vulkan {
+
+TimelineQueue::TimelineQueue(vk::Device device, vk::Queue queue)
+    : device_{device}, queue_{queue}
+{
+  vk::SemaphoreTypeCreateInfo type_create_info;
+  type_create_info.setSemaphoreType(vk::SemaphoreType::eTimeline)
+      .setInitialValue(0);
+  vk::SemaphoreCreateInfo create_info;
+  create_info.setPNext(&type_create_info);
+  semaphore_ = device_.createSemaphoreUnique(create_info);
+}
+
+auto TimelineQueue::submit(std::span<const vk::CommandBuffer> command_buffers,
+                           std::span<const SemaphoreWait> waits,
+                           std::span<const vk::Semaphore> signals)
+    -> std::uint64_t
+{
+  std::vector<vk::Semaphore> wait_semaphores;
+  std::vector<vk::PipelineStageFlags> wait_stages;
+  std::vector<std::uint64_t> wait_values;
+  for (const auto& wait : waits) {
+    wait_semaphores.push_back(wait.semaphore);
+    wait_stages.push_back(wait.stages);
+    wait_values.push_back(wait.value);
+  }
+
+  const auto value = last_submitted_ + 1;
+  std::vector<vk::Semaphore> signal_semaphores(signals.begin(),
+                                               signals.end());
+  signal_semaphores.push_back(*semaphore_);
+  std::vector<std::uint64_t> signal_values(signal_semaphores.size(), 0);
+  signal_values.back() = value;
+
+  vk::TimelineSemaphoreSubmitInfo timeline_submit_info;
+  timeline_submit_info
+      .setWaitSemaphoreValueCount(
+          static_cast<std::uint32_t>(wait_values.size()))
+      .setPWaitSemaphoreValues(wait_values.data())
+      .setSignalSemaphoreValueCount(
+          static_cast<std::uint32_t>(signal_values.size()))
+      .setPSignalSemaphoreValues(signal_values.data());
+
+  vk::SubmitInfo submit_info;
+  submit_info.setPNext(&timeline_submit_info)
+      .setWaitSemaphoreCount(static_cast<std::uint32_t>(wait_semaphores.size()))
+      .setPWaitSemaphores(wait_semaphores.data())
+      .setPWaitDstStageMask(wait_stages.data())
+      .setCommandBufferCount(
+          static_cast<std::uint32_t>(command_buffers.size()))
+      .setPCommandBuffers(command_buffers.data())
+      .setSignalSemaphoreCount(
+          static_cast<std::uint32_t>(signal_semaphores.size()))
+      .setPSignalSemaphores(signal_semaphores.data());
+  queue_.submit(1, &submit_info, nullptr);
+
+  last_submitted_ = value;
+  return value;
+}
+
+auto TimelineQueue::is_complete(std::uint64_t value) -> bool
+{
+  if (value > completed_) {
+    completed_ = device_.getSemaphoreCounterValue(*semaphore_);
+  }
+  return value <= completed_;
+}
+
+auto TimelineQueue::wait(std::uint64_t value) -> void
+{
+  if (value <= completed_) {
+    return;
+  }
+  const vk::SemaphoreWaitInfo wait_info{{}, 1, &semaphore_.get(), &value};
+  // Errors throw, but a timeout comes back as a result
+  const auto result =
+      device_.waitSemaphores(wait_info, std::numeric_limits<uint64_t>::max());
+  if (result != vk::Result::eSuccess) {
+    throw std::runtime_error{fmt::format(
+        "waiting for timeline value {} returned {}", value,
+        vk::to_string(result))};
+  }
+  completed_ = value;
+}
+
+} // namespace vulkan
@@ -0,0 +1,74 @@
+#ifndef TIMELINE_QUEUE_HPP
+#define TIMELINE_QUEUE_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <span>
+
+namespace vulkan {
+
+// A semaphore whose signal the stages of a submission wait for
+struct SemaphoreWait {
+  vk::Semaphore semaphore;
+  vk::PipelineStageFlags stages;
+  // Ignored for binary semaphores
+  std::uint64_t value = 0;
+};
+
+/**
+ * @brief A queue whose submissions each signal the next value of a single
+ * timeline semaphore.
+ *
+ * The values grow with every submission, so telling whether some work is
+ * done takes one counter read, and waiting for it needs no fence to create,
+ * reset or destroy. Not thread safe.
+ */
+class TimelineQueue {
+public:
+  TimelineQueue() = default;
+  TimelineQueue(vk::Device device, vk::Queue queue);
+
+  [[nodiscard]] auto queue() const noexcept -> vk::Queue
+  {
+    return queue_;
+  }
+
+  [[nodiscard]] auto semaphore() const noexcept -> vk::Semaphore
+  {
+    return *semaphore_;
+  }
+
+  // The value the latest submission signals
+  [[nodiscard]] auto last_submitted() const noexcept -> std::uint64_t
+  {
+    return last_submitted_;
+  }
+
+  // Submits command buffers that wait for waits, and returns the value they
+  // signal along with the binary semaphores of signals
+  auto submit(std::span<const vk::CommandBuffer> command_buffers,
+              std::span<const SemaphoreWait> waits = {},
+              std::span<const vk::Semaphore> signals = {}) -> std::uint64_t;
+
+  [[nodiscard]] auto is_complete(std::uint64_t value) -> bool;
+  auto wait(std::uint64_t value) -> void;
+
+  // Waits for every submission so far
+  auto wait_idle() -> void
+  {
+    wait(last_submitted_);
+  }
+
+private:
+  vk::Device device_;
+  vk::Queue queue_;
+  vk::UniqueSemaphore semaphore_;
+  std::uint64_t last_submitted_ = 0;
+  // The value last read from the semaphore
+  std::uint64_t completed_ = 0;
+};
+
+} // namespace vulkan
+
+#endif // TIMELINE_QUEUE_HPP
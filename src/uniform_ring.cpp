@@ -0,0 +1,55 @@
+#include "uniform_ring.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "buffer_utils.hpp"
+
+namespace vulkan {
+
+namespace {
+
+[[nodiscard]] constexpr auto align_up(vk::DeviceSize offset,
+                                      vk::DeviceSize alignment) noexcept
+    -> vk::DeviceSize
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // anonymous namespace
+
+UniformRing::UniformRing(MemoryAllocator& allocator, vk::Device device,
+                         vk::DeviceSize min_alignment,
+                         vk::DeviceSize region_size, std::size_t region_count)
+    : alignment_{std::max<vk::DeviceSize>(min_alignment, 1)},
+      region_size_{align_up(region_size, alignment_)}
+{
+  std::tie(buffer_, memory_) =
+      create_buffer(allocator, device, region_size_ * region_count,
+                    vk::BufferUsageFlagBits::eUniformBuffer,
+                    vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+auto UniformRing::begin(std::size_t region) noexcept -> void
+{
+  region_begin_ = region_offset(region);
+  head_ = region_begin_;
+}
+
+auto UniformRing::allocate(vk::DeviceSize size) -> UniformSlice
+{
+  if (head_ + size > region_begin_ + region_size_) {
+    throw std::runtime_error{fmt::format(
+        "{} uniform bytes do not fit the {} bytes left to the frame", size,
+        region_begin_ + region_size_ - head_)};
+  }
+  const UniformSlice slice{static_cast<std::uint32_t>(head_),
+                           memory_.mapped() + head_};
+  head_ = align_up(head_ + size, alignment_);
+  return slice;
+}
+
+} // namespace vulkan
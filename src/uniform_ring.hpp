@@ -0,0 +1,74 @@
+#ifndef UNIFORM_RING_HPP
+#define UNIFORM_RING_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "memory_allocator.hpp"
+
+namespace vulkan {
+
+// Part of a UniformRing written by the host
+struct UniformSlice {
+  // Dynamic offset to bind the slice at
+  std::uint32_t offset = 0;
+  std::byte* data = nullptr;
+};
+
+/**
+ * @brief One persistently mapped uniform buffer shared by every frame.
+ *
+ * The buffer is split into one region per frame, and each frame hands out
+ * slices of its region linearly. All slices are bound through a single
+ * dynamic uniform buffer descriptor at their dynamic offset, so per-frame and
+ * per-object uniforms cost neither a map call nor a descriptor set of their
+ * own.
+ */
+class UniformRing {
+public:
+  UniformRing() = default;
+  UniformRing(MemoryAllocator& allocator, vk::Device device,
+              vk::DeviceSize min_alignment, vk::DeviceSize region_size,
+              std::size_t region_count);
+
+  [[nodiscard]] auto buffer() const noexcept -> vk::Buffer
+  {
+    return *buffer_;
+  }
+
+  [[nodiscard]] auto region_offset(std::size_t region) const noexcept
+      -> std::uint32_t
+  {
+    return static_cast<std::uint32_t>(region * region_size_);
+  }
+
+  // Starts handing out slices of a region, whose previous contents the
+  // device has to be done with
+  auto begin(std::size_t region) noexcept -> void;
+
+  // Returns the next size bytes of the current region
+  [[nodiscard]] auto allocate(vk::DeviceSize size) -> UniformSlice;
+
+  // Copies value to the next slice and returns its dynamic offset
+  template <typename T> auto push(const T& value) -> std::uint32_t
+  {
+    const auto slice = allocate(sizeof(T));
+    memcpy(slice.data, &value, sizeof(T));
+    return slice.offset;
+  }
+
+private:
+  vk::UniqueBuffer buffer_;
+  Allocation memory_;
+  vk::DeviceSize alignment_ = 1;
+  vk::DeviceSize region_size_ = 0;
+  vk::DeviceSize region_begin_ = 0;
+  vk::DeviceSize head_ = 0;
+};
+
+} // namespace vulkan
+
+#endif // UNIFORM_RING_HPP
@@ -0,0 +1,139 @@
+#ifndef VERTEX_HPP
+#define VERTEX_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Component encodings of vertex attributes. The integer encodings are
+// normalized to [0, 1] or [-1, 1] by the vertex fetch, so quantized glTF data
+// (KHR_mesh_quantization) reaches the GPU without being widened.
+enum class VertexComponent : std::uint8_t {
+  f32,
+  unorm8,
+  snorm8,
+  unorm16,
+  snorm16,
+};
+
+struct VertexAttributeFormat {
+  VertexComponent component = VertexComponent::f32;
+  std::uint8_t count = 0;
+
+  [[nodiscard]] constexpr auto component_size() const noexcept -> std::size_t
+  {
+    switch (component) {
+    case VertexComponent::unorm8:
+    case VertexComponent::snorm8:
+      return 1;
+    case VertexComponent::unorm16:
+    case VertexComponent::snorm16:
+      return 2;
+    case VertexComponent::f32:
+      return 4;
+    }
+    return 0;
+  }
+
+  // 8- and 16-bit vec3 attributes use four-component formats, since the
+  // three-component ones are rarely supported for vertex buffers
+  [[nodiscard]] constexpr auto padded_count() const noexcept -> std::size_t
+  {
+    return component != VertexComponent::f32 && count == 3 ? 4 : count;
+  }
+
+  // Size in bytes, rounded up so that the next attribute is 4-byte aligned
+  [[nodiscard]] constexpr auto size() const noexcept -> std::size_t
+  {
+    return (component_size() * padded_count() + 3) & ~std::size_t{3};
+  }
+
+  [[nodiscard]] auto vk_format() const noexcept -> vk::Format
+  {
+    const auto wide = padded_count() > 2;
+    switch (component) {
+    case VertexComponent::unorm8:
+      return wide ? vk::Format::eR8G8B8A8Unorm : vk::Format::eR8G8Unorm;
+    case VertexComponent::snorm8:
+      return wide ? vk::Format::eR8G8B8A8Snorm : vk::Format::eR8G8Snorm;
+    case VertexComponent::unorm16:
+      return wide ? vk::Format::eR16G16B16A16Unorm
+                  : vk::Format::eR16G16Unorm;
+    case VertexComponent::snorm16:
+      return wide ? vk::Format::eR16G16B16A16Snorm
+                  : vk::Format::eR16G16Snorm;
+    case VertexComponent::f32:
+      break;
+    }
+    switch (count) {
+    case 2:
+      return vk::Format::eR32G32Sfloat;
+    case 3:
+      return vk::Format::eR32G32B32Sfloat;
+    default:
+      return vk::Format::eR32G32B32A32Sfloat;
+    }
+  }
+
+  friend constexpr auto operator==(const VertexAttributeFormat&,
+                                   const VertexAttributeFormat&)
+      -> bool = default;
+};
+
+/**
+ * @brief The interleaved vertex layout of one draw range.
+ *
+ * Attributes are stored in the order position, color, texcoord at the
+ * locations the vertex shader expects. All-float32 layouts match the original
+ * 32-byte vertex.
+ */
+struct VertexLayout {
+  VertexAttributeFormat position{VertexComponent::f32, 3};
+  VertexAttributeFormat color{VertexComponent::f32, 3};
+  VertexAttributeFormat texcoord{VertexComponent::f32, 2};
+
+  [[nodiscard]] constexpr auto color_offset() const noexcept -> std::size_t
+  {
+    return position.size();
+  }
+
+  [[nodiscard]] constexpr auto texcoord_offset() const noexcept
+      -> std::size_t
+  {
+    return color_offset() + color.size();
+  }
+
+  [[nodiscard]] constexpr auto stride() const noexcept -> std::size_t
+  {
+    return texcoord_offset() + texcoord.size();
+  }
+
+  // Returns the vulkan binding description of a vertex
+  [[nodiscard]] auto binding_description() const
+      -> vk::VertexInputBindingDescription
+  {
+    return {0, static_cast<std::uint32_t>(stride()),
+            vk::VertexInputRate::eVertex};
+  }
+
+  [[nodiscard]] auto attributes_descriptions() const
+      -> std::vector<vk::VertexInputAttributeDescription>
+  {
+    return {
+        vk::VertexInputAttributeDescription{0, 0, position.vk_format(), 0},
+        vk::VertexInputAttributeDescription{
+            1, 0, color.vk_format(),
+            static_cast<std::uint32_t>(color_offset())},
+        vk::VertexInputAttributeDescription{
+            2, 0, texcoord.vk_format(),
+            static_cast<std::uint32_t>(texcoord_offset())},
+    };
+  }
+
+  friend constexpr auto operator==(const VertexLayout&, const VertexLayout&)
+      -> bool = default;
+};
+
+#endif // VERTEX_HPP